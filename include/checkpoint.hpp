@@ -0,0 +1,127 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dataset.hpp"
+#include "linear_algebra.hpp"
+#include "optimizer.hpp"
+
+namespace nn {
+
+// Version of the checkpoint file format, incremented on incompatible changes
+constexpr std::uint32_t kCheckpointVersion = 2;
+
+/**
+ * @brief      Everything Network::Sgd needs to continue training exactly
+ * where it stopped: the parameters, the state of the optimizer, and the
+ * position in the sequence of mini-batches.
+ *
+ * A state is taken between mini-batches. If mini_batch_idx is 0, epoch
+ * epoch_idx hasn't started: permutation is still the order of the previous
+ * epoch, which the shuffle engine will shuffle next. Otherwise permutation is
+ * the order of epoch epoch_idx, already shuffled.
+ */
+struct TrainingState {
+  std::vector<unsigned int> layer_sizes;
+  // kernels::Activation of every weight layer
+  std::vector<std::uint32_t> activations;
+  unsigned int mini_batch_size = 0;
+  // The epoch in progress, and the number of its mini-batches done
+  unsigned int epoch_idx = 0;
+  unsigned int mini_batch_idx = 0;
+  // Indices of the training examples in their current order (epochs shuffle
+  // the previous order rather than starting from scratch)
+  std::vector<unsigned int> permutation;
+  // State of the engine that shuffles the training data, as written by its
+  // operator<<
+  std::string shuffle_engine;
+  std::vector<Matrix<NNType>> weights;
+  std::vector<Vector<NNType>> biases;
+  // OptimizerType of the job, and its state (which has no buffers for
+  // OptimizerType::kSgd)
+  std::uint32_t optimizer = 0;
+  OptimizerState optimizer_state;
+};
+
+/**
+ * @brief      Write a training state to a checkpoint file: a header with a
+ * format version, byte-order tag and checksum, then the state. The file is
+ * replaced atomically, so a job preempted while writing keeps its previous
+ * checkpoint. Throws std::runtime_error if the file can't be written.
+ *
+ * @param[in]  path   The path of the file
+ * @param[in]  state  The state
+ */
+void SaveCheckpoint(const std::string &path, const TrainingState &state);
+
+/**
+ * @brief      Read a checkpoint file written by SaveCheckpoint, or by a
+ * version 1 writer (plain SGD only). Throws std::runtime_error if the file
+ * can't be read, or isn't a valid checkpoint.
+ *
+ * @param[in]  path  The path of the file
+ *
+ * @return     The training state
+ */
+TrainingState LoadCheckpoint(const std::string &path);
+
+/**
+ * @brief      This class describes a background thread that writes
+ * checkpoints, so that training only stops for as long as it takes to copy
+ * its state. A checkpoint taken while the previous one is still being written
+ * is skipped, rather than making training wait for the disk.
+ */
+class CheckpointWriter {
+public:
+  /**
+   * @brief      Constructs a new instance and starts its thread.
+   *
+   * @param[in]  path  The path of the checkpoint file
+   */
+  explicit CheckpointWriter(std::string path);
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+  /**
+   * @brief      Finishes writing any pending checkpoint, then stops the
+   * thread. Errors are lost: call Wait first to see them.
+   */
+  ~CheckpointWriter();
+  /**
+   * @brief      Start a checkpoint. Rethrows the error of a failed write, if
+   * any.
+   *
+   * @return     The state to fill in and Commit, reusing the buffers of the
+   * previous checkpoint, or nullptr if the previous checkpoint is still being
+   * written, in which case this one is skipped
+   */
+  TrainingState *Begin();
+  /**
+   * @brief      Write the state returned by Begin, in the background
+   */
+  void Commit();
+  /**
+   * @brief      Wait until the last committed checkpoint has been written.
+   * Rethrows the error of a failed write, if any.
+   */
+  void Wait();
+
+private:
+  void WriterLoop_();
+  void RethrowError_();
+  const std::string path_;
+  TrainingState state_;
+  std::mutex mutex_;
+  std::condition_variable committed_;
+  std::condition_variable written_;
+  bool pending_ = false;
+  bool stopping_ = false;
+  std::exception_ptr error_;
+  std::thread writer_;
+};
+
+} // namespace nn
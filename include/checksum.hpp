@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace nn {
+
+/**
+ * @brief      This class describes a 64-bit FNV-1a hash of a stream of bytes,
+ * used as the checksum of files. Bytes are hashed eight at a time, as words
+ * in the machine's byte order (with a partial last word hashed byte by byte),
+ * so that hashing keeps up with reading from memory. The result only depends
+ * on the bytes, not on how they are split across calls to Update.
+ */
+class Fnv1aHash {
+public:
+  /**
+   * @brief      Hash more bytes
+   *
+   * @param[in]  data  The bytes
+   * @param[in]  size  The number of bytes
+   */
+  void Update(const void *data, std::size_t size) {
+    const auto *bytes = static_cast<const std::uint8_t *>(data);
+    // Complete a word left partial by the previous call
+    while (size > 0 && n_pending_ > 0) {
+      pending_[n_pending_++] = *bytes++;
+      size--;
+      if (n_pending_ == 8) {
+        HashWord_(pending_);
+        n_pending_ = 0;
+      }
+    }
+    for (; size >= 8; bytes += 8, size -= 8) {
+      HashWord_(bytes);
+    }
+    std::memcpy(pending_, bytes, size);
+    n_pending_ = size;
+  }
+  /**
+   * @brief      The hash of every byte so far
+   */
+  std::uint64_t value() const {
+    std::uint64_t hash = hash_;
+    for (std::size_t i = 0; i < n_pending_; i++) {
+      hash = (hash ^ pending_[i]) * kPrime;
+    }
+    return hash;
+  }
+
+private:
+  static constexpr std::uint64_t kPrime = 0x100000001b3;
+  void HashWord_(const std::uint8_t *bytes) {
+    std::uint64_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    hash_ = (hash_ ^ word) * kPrime;
+  }
+  std::uint64_t hash_ = 0xcbf29ce484222325;
+  std::uint8_t pending_[8];
+  std::size_t n_pending_ = 0;
+};
+
+} // namespace nn
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "dataset.hpp"
+#include "transport.hpp"
+
+namespace nn {
+
+/**
+ * @brief      Sum an array over every rank of a ring, leaving the same sum on
+ * all of them, with a ring allreduce: the array is split into one chunk per
+ * rank, the chunks are summed as they pass around the ring
+ * (reduce-scatter), and the sums then go around once more (allgather).
+ * Every rank sends and receives 2 * (size - 1) / size of the array, however
+ * many ranks there are. Every rank must call it with the same n.
+ *
+ * The sums are added up in a different order for every chunk, but each is
+ * computed once and copied to the other ranks, so the results are
+ * bit-identical on all of them.
+ *
+ * @param      transport  The transport
+ * @param      data       The array, replaced by the sum
+ * @param[in]  n          The number of elements
+ * @param      buffer     Room for a received chunk, grown as needed and
+ * best kept between calls
+ */
+void AllReduceSum(Transport &transport, NNType *data, std::size_t n,
+                  std::vector<NNType> &buffer);
+
+/**
+ * @brief      Copy bytes from a rank to every other one. Each rank forwards
+ * what it has to the next, so the bytes reach the last rank after size - 1
+ * exchanges. It is meant for setting up a job, not for every step. Every
+ * rank must call it with the same n_bytes and root.
+ *
+ * @param      transport  The transport
+ * @param      data       The bytes, sent from the root and replaced on the
+ * other ranks
+ * @param[in]  n_bytes    The number of bytes
+ * @param[in]  root       The rank the bytes come from
+ */
+void Broadcast(Transport &transport, void *data, std::size_t n_bytes,
+               unsigned int root = 0);
+
+} // namespace nn
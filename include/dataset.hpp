@@ -0,0 +1,287 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "linear_algebra.hpp"
+
+namespace nn {
+
+using NNType = float;
+
+// input and ground truth (one-hot) output
+using Example = std::pair<Vector<NNType>, Vector<NNType>>;
+using AnnotatedData = std::vector<Example>;
+
+/**
+ * @brief      This class describes a data set of examples, read one example at
+ * a time straight into the rows of a batch. Implementations may store the
+ * examples in any format and convert them as they are read, so a data set
+ * never has to be expanded into Vectors up front.
+ */
+class Dataset {
+public:
+  virtual ~Dataset() = default;
+  /**
+   * @brief      The number of examples
+   */
+  virtual unsigned int size() const = 0;
+  /**
+   * @brief      The number of values in every input
+   */
+  virtual unsigned int input_size() const = 0;
+  /**
+   * @brief      The number of values in every ground truth output
+   */
+  virtual unsigned int output_size() const = 0;
+  /**
+   * @brief      Write the input of an example
+   *
+   * @param[in]  idx    The example index
+   * @param      input  Where to write input_size() values
+   */
+  virtual void GetInput(unsigned int idx, NNType *input) const = 0;
+  /**
+   * @brief      Write the ground truth output of an example
+   *
+   * @param[in]  idx           The example index
+   * @param      ground_truth  Where to write output_size() values
+   */
+  virtual void GetGroundTruth(unsigned int idx, NNType *ground_truth) const = 0;
+  /**
+   * @brief      Whether this is a classification data set, whose ground truths
+   * are the one-hot vectors of class ids. Training and evaluation then use
+   * Label directly instead of the ground truth vectors.
+   */
+  virtual bool has_labels() const { return false; }
+  /**
+   * @brief      The class id of an example, if has_labels()
+   *
+   * @param[in]  idx   The example index
+   */
+  virtual unsigned int Label(unsigned int idx) const {
+    (void)idx;
+    assert(false);
+    return 0;
+  }
+};
+
+/**
+ * @brief      This class describes a data set backed by annotated data that is
+ * already in memory. The annotated data is referenced, not copied, and must
+ * outlive the data set.
+ */
+class AnnotatedDataset : public Dataset {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  data  The annotated data
+   */
+  explicit AnnotatedDataset(const AnnotatedData &data) : data_(data) {}
+  unsigned int size() const override { return data_.size(); }
+  unsigned int input_size() const override {
+    return data_.empty() ? 0 : data_.front().first.length;
+  }
+  unsigned int output_size() const override {
+    return data_.empty() ? 0 : data_.front().second.length;
+  }
+  void GetInput(unsigned int idx, NNType *input) const override {
+    const auto &example_input = data_[idx].first;
+    std::copy(example_input.begin(), example_input.end(), input);
+  }
+  void GetGroundTruth(unsigned int idx, NNType *ground_truth) const override {
+    const auto &example_output = data_[idx].second;
+    std::copy(example_output.begin(), example_output.end(), ground_truth);
+  }
+
+private:
+  const AnnotatedData &data_;
+};
+
+/**
+ * @brief      This class describes a mini-batch as a non-owning view of some
+ * examples of a data set, selected by a range of indices into it (e.g. part of
+ * a shuffled permutation). Nothing is copied.
+ */
+class MiniBatch {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  dataset  The data set
+   * @param[in]  indices  Indices of the examples in the mini-batch
+   * @param[in]  size     The number of examples
+   */
+  MiniBatch(const Dataset &dataset, const unsigned int *indices,
+            unsigned int size)
+      : dataset_(dataset), indices_(indices), size_(size) {}
+  const Dataset &dataset() const { return dataset_; }
+  /**
+   * @brief      Index in the data set of the i-th example of the mini-batch
+   */
+  unsigned int index(unsigned int i) const {
+    assert(i < size_);
+    return indices_[i];
+  }
+  /**
+   * @brief      View of examples [begin, end) of this mini-batch
+   */
+  MiniBatch Slice(unsigned int begin, unsigned int end) const {
+    assert(begin <= end && end <= size_);
+    return MiniBatch(dataset_, indices_ + begin, end - begin);
+  }
+  unsigned int size() const { return size_; }
+
+private:
+  const Dataset &dataset_;
+  const unsigned int *indices_;
+  unsigned int size_;
+};
+
+/**
+ * @brief      This class describes a read-only view of a batch of examples
+ * ready to train on, one example per row: the inputs, and either the ground
+ * truths or, for data sets with labels, the class ids.
+ */
+struct BatchView {
+  unsigned int size;
+  MatrixView<const NNType> inputs;
+  // Unused if labels isn't null
+  MatrixView<const NNType> ground_truths;
+  const unsigned int *labels;
+  /**
+   * @brief      View of examples [begin, end) of this batch
+   */
+  BatchView Slice(unsigned int begin, unsigned int end) const {
+    assert(begin <= end && end <= size);
+    return {end - begin, inputs.Block(begin, 0, end - begin, inputs.width),
+            ground_truths.Block(begin, 0, end - begin, ground_truths.width),
+            labels ? labels + begin : nullptr};
+  }
+};
+
+/**
+ * @brief      This class describes contiguous buffers holding up to
+ * max_batch_size examples, converted from a data set's storage format.
+ */
+class Batch {
+public:
+  /**
+   * @brief      Constructs a new, empty instance.
+   *
+   * @param[in]  input_size      The number of values in every input
+   * @param[in]  output_size     The number of values in every ground truth
+   * @param[in]  max_batch_size  The maximum number of examples
+   */
+  Batch(unsigned int input_size, unsigned int output_size,
+        unsigned int max_batch_size)
+      : inputs(max_batch_size, input_size),
+        ground_truths(max_batch_size, output_size), labels(max_batch_size) {}
+  /**
+   * @brief      Read the examples of a mini-batch
+   */
+  void Assemble(const MiniBatch &mini_batch) {
+    assert(mini_batch.size() <= inputs.height);
+    const auto &dataset = mini_batch.dataset();
+    size = mini_batch.size();
+    has_labels = dataset.has_labels();
+    for (unsigned int example_idx = 0; example_idx < size; example_idx++) {
+      const unsigned int idx = mini_batch.index(example_idx);
+      dataset.GetInput(idx, inputs.Row(example_idx).data());
+      if (has_labels) {
+        labels[example_idx] = dataset.Label(idx);
+      } else {
+        dataset.GetGroundTruth(idx, ground_truths.Row(example_idx).data());
+      }
+    }
+  }
+  BatchView View() const {
+    return {size, inputs.Block(0, 0, size, inputs.width),
+            ground_truths.Block(0, 0, size, ground_truths.width),
+            has_labels ? labels.data() : nullptr};
+  }
+
+  unsigned int size = 0;
+  Matrix<NNType> inputs;
+  Matrix<NNType> ground_truths;
+  std::vector<unsigned int> labels;
+  bool has_labels = false;
+};
+
+/**
+ * @brief      Storage format of the inputs of a CompactDataset
+ */
+enum class InputFormat {
+  kUint8,   // one byte per value, 0 to 255 times the scale
+  kFloat16, // IEEE 754 half precision, times the scale
+};
+
+/**
+ * @brief      This class describes a classification data set stored compactly:
+ * inputs are quantised to bytes or half precision floats with one scale for
+ * the whole data set, and labels are integer class ids rather than one-hot
+ * vectors. Everything is in two contiguous buffers, with no allocation per
+ * example.
+ */
+class CompactDataset : public Dataset {
+public:
+  /**
+   * @brief      Constructs a new, empty instance.
+   *
+   * @param[in]  input_size  The number of values in every input
+   * @param[in]  n_classes   The number of classes
+   * @param[in]  format      The storage format of inputs
+   * @param[in]  scale       The value of one unit of a stored input, e.g.
+   * 1 / 255 for bytes of images normalised to [0, 1]
+   */
+  CompactDataset(unsigned int input_size, unsigned int n_classes,
+                 InputFormat format, NNType scale);
+  /**
+   * @brief      Quantise every example of another classification data set,
+   * or of one with one-hot ground truths
+   *
+   * @param[in]  source  The source data set
+   * @param[in]  format  The storage format of inputs
+   * @param[in]  scale   The value of one unit of a stored input
+   *
+   * @return     The compact data set
+   */
+  static CompactDataset FromDataset(const Dataset &source, InputFormat format,
+                                    NNType scale);
+  /**
+   * @brief      Reserve memory for a number of examples
+   */
+  void Reserve(unsigned int n_examples);
+  /**
+   * @brief      Quantise and append an example. Inputs are rounded to the
+   * nearest stored value, saturating for bytes.
+   *
+   * @param[in]  input  input_size() values
+   * @param[in]  label  The class id
+   */
+  void Add(const NNType *input, unsigned int label);
+  unsigned int size() const override { return labels_.size(); }
+  unsigned int input_size() const override { return input_size_; }
+  unsigned int output_size() const override { return n_classes_; }
+  void GetInput(unsigned int idx, NNType *input) const override;
+  void GetGroundTruth(unsigned int idx, NNType *ground_truth) const override;
+  bool has_labels() const override { return true; }
+  unsigned int Label(unsigned int idx) const override { return labels_[idx]; }
+  InputFormat format() const { return format_; }
+  NNType scale() const { return scale_; }
+
+private:
+  std::size_t BytesPerInput_() const;
+  const unsigned int input_size_;
+  const unsigned int n_classes_;
+  const InputFormat format_;
+  const NNType scale_;
+  std::vector<std::uint8_t> inputs_;
+  std::vector<std::uint16_t> labels_;
+};
+
+} // namespace nn
@@ -0,0 +1,470 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace nn {
+
+template <typename T> class Vector;
+template <typename T> class Matrix;
+
+/**
+ * @brief      Base class of the lazy elementwise expressions on vectors
+ * (a + b, 2.f * a - b, ...). An expression only records its operands: it is
+ * evaluated by constructing or assigning a Vector from it, in a single loop
+ * straight into the destination, so compound expressions make no temporary
+ * vectors. Expressions convert implicitly to Vector, but a template function
+ * that deduces T from a Vector<T> parameter needs an explicit Vector(...)
+ * around the expression.
+ *
+ * Vectors are held by reference, and temporary vectors (e.g. the result of a
+ * matrix-vector product) are moved into the expression, so an expression
+ * stays valid as long as the named vectors it uses do.
+ *
+ * Every expression has a value_type, a length() and an operator[].
+ *
+ * @tparam     Derived  The expression type
+ */
+template <typename Derived> struct VectorExpression {
+  const Derived &derived() const { return static_cast<const Derived &>(*this); }
+};
+
+/**
+ * @brief      Base class of the lazy elementwise expressions on matrices,
+ * which are evaluated by constructing or assigning a Matrix from them (see
+ * VectorExpression). Every expression has a value_type, a height(), a
+ * width() and an operator()(i, j).
+ *
+ * @tparam     Derived  The expression type
+ */
+template <typename Derived> struct MatrixExpression {
+  const Derived &derived() const { return static_cast<const Derived &>(*this); }
+};
+
+namespace detail {
+
+template <typename T>
+using RemoveCvRef = std::remove_cv_t<std::remove_reference_t<T>>;
+
+template <typename T> struct IsVector : std::false_type {};
+template <typename T> struct IsVector<Vector<T>> : std::true_type {};
+template <typename T> struct IsMatrix : std::false_type {};
+template <typename T> struct IsMatrix<Matrix<T>> : std::true_type {};
+
+// Whether a type can be an operand of a vector (or matrix) expression
+template <typename T>
+constexpr bool kIsVectorOperand =
+    IsVector<RemoveCvRef<T>>::value ||
+    std::is_base_of_v<VectorExpression<RemoveCvRef<T>>, RemoveCvRef<T>>;
+template <typename T>
+constexpr bool kIsMatrixOperand =
+    IsMatrix<RemoveCvRef<T>>::value ||
+    std::is_base_of_v<MatrixExpression<RemoveCvRef<T>>, RemoveCvRef<T>>;
+
+struct Plus {
+  template <typename T> T operator()(T a, T b) const { return a + b; }
+};
+struct Minus {
+  template <typename T> T operator()(T a, T b) const { return a - b; }
+};
+struct Multiplies {
+  template <typename T> T operator()(T a, T b) const { return a * b; }
+};
+
+/**
+ * @brief      A vector in an expression
+ */
+template <typename T>
+class VectorReference : public VectorExpression<VectorReference<T>> {
+public:
+  using value_type = T;
+  explicit VectorReference(const Vector<T> &vector)
+      : data_(vector.data()), length_(vector.length) {}
+  unsigned int length() const { return length_; }
+  T operator[](unsigned int i) const { return data_[i]; }
+
+private:
+  const T *data_;
+  unsigned int length_;
+};
+
+/**
+ * @brief      A temporary vector in an expression, which the expression owns
+ */
+template <typename T>
+class VectorValue : public VectorExpression<VectorValue<T>> {
+public:
+  using value_type = T;
+  explicit VectorValue(Vector<T> &&vector) : vector_(std::move(vector)) {}
+  unsigned int length() const { return vector_.length; }
+  T operator[](unsigned int i) const { return vector_.data()[i]; }
+
+private:
+  Vector<T> vector_;
+};
+
+/**
+ * @brief      Elementwise operation on two vector expressions
+ */
+template <typename Operation, typename Left, typename Right>
+class VectorBinary
+    : public VectorExpression<VectorBinary<Operation, Left, Right>> {
+public:
+  using value_type = typename Left::value_type;
+  static_assert(std::is_same_v<value_type, typename Right::value_type>,
+                "operands of an expression have the same data type");
+  VectorBinary(Left left, Right right)
+      : left_(std::move(left)), right_(std::move(right)) {
+    assert(left_.length() == right_.length());
+  }
+  unsigned int length() const { return left_.length(); }
+  value_type operator[](unsigned int i) const {
+    return Operation()(left_[i], right_[i]);
+  }
+
+private:
+  Left left_;
+  Right right_;
+};
+
+/**
+ * @brief      Elementwise operation on a scalar and a vector expression
+ */
+template <typename Operation, typename Operand>
+class VectorScalar
+    : public VectorExpression<VectorScalar<Operation, Operand>> {
+public:
+  using value_type = typename Operand::value_type;
+  VectorScalar(value_type scalar, Operand operand)
+      : scalar_(scalar), operand_(std::move(operand)) {}
+  unsigned int length() const { return operand_.length(); }
+  value_type operator[](unsigned int i) const {
+    return Operation()(scalar_, operand_[i]);
+  }
+
+private:
+  value_type scalar_;
+  Operand operand_;
+};
+
+/**
+ * @brief      A matrix in an expression
+ */
+template <typename T>
+class MatrixReference : public MatrixExpression<MatrixReference<T>> {
+public:
+  using value_type = T;
+  explicit MatrixReference(const Matrix<T> &matrix)
+      : data_(matrix.data()), height_(matrix.height), width_(matrix.width),
+        stride_(matrix.stride) {}
+  unsigned int height() const { return height_; }
+  unsigned int width() const { return width_; }
+  T operator()(unsigned int i, unsigned int j) const {
+    return data_[static_cast<std::size_t>(i) * stride_ + j];
+  }
+
+private:
+  const T *data_;
+  unsigned int height_;
+  unsigned int width_;
+  unsigned int stride_;
+};
+
+/**
+ * @brief      A temporary matrix in an expression, which the expression owns
+ */
+template <typename T>
+class MatrixValue : public MatrixExpression<MatrixValue<T>> {
+public:
+  using value_type = T;
+  explicit MatrixValue(Matrix<T> &&matrix) : matrix_(std::move(matrix)) {}
+  unsigned int height() const { return matrix_.height; }
+  unsigned int width() const { return matrix_.width; }
+  T operator()(unsigned int i, unsigned int j) const {
+    return matrix_.data()[static_cast<std::size_t>(i) * matrix_.stride + j];
+  }
+
+private:
+  Matrix<T> matrix_;
+};
+
+/**
+ * @brief      Elementwise operation on two matrix expressions
+ */
+template <typename Operation, typename Left, typename Right>
+class MatrixBinary
+    : public MatrixExpression<MatrixBinary<Operation, Left, Right>> {
+public:
+  using value_type = typename Left::value_type;
+  static_assert(std::is_same_v<value_type, typename Right::value_type>,
+                "operands of an expression have the same data type");
+  MatrixBinary(Left left, Right right)
+      : left_(std::move(left)), right_(std::move(right)) {
+    assert(left_.height() == right_.height());
+    assert(left_.width() == right_.width());
+  }
+  unsigned int height() const { return left_.height(); }
+  unsigned int width() const { return left_.width(); }
+  value_type operator()(unsigned int i, unsigned int j) const {
+    return Operation()(left_(i, j), right_(i, j));
+  }
+
+private:
+  Left left_;
+  Right right_;
+};
+
+/**
+ * @brief      Elementwise operation on a scalar and a matrix expression
+ */
+template <typename Operation, typename Operand>
+class MatrixScalar
+    : public MatrixExpression<MatrixScalar<Operation, Operand>> {
+public:
+  using value_type = typename Operand::value_type;
+  MatrixScalar(value_type scalar, Operand operand)
+      : scalar_(scalar), operand_(std::move(operand)) {}
+  unsigned int height() const { return operand_.height(); }
+  unsigned int width() const { return operand_.width(); }
+  value_type operator()(unsigned int i, unsigned int j) const {
+    return Operation()(scalar_, operand_(i, j));
+  }
+
+private:
+  value_type scalar_;
+  Operand operand_;
+};
+
+/**
+ * @brief      Operation between every row of a matrix expression and a
+ * vector expression
+ */
+template <typename Operation, typename MatrixOperand, typename VectorOperand>
+class MatrixRows : public MatrixExpression<
+                       MatrixRows<Operation, MatrixOperand, VectorOperand>> {
+public:
+  using value_type = typename MatrixOperand::value_type;
+  static_assert(
+      std::is_same_v<value_type, typename VectorOperand::value_type>,
+      "operands of an expression have the same data type");
+  MatrixRows(MatrixOperand matrix, VectorOperand vector)
+      : matrix_(std::move(matrix)), vector_(std::move(vector)) {
+    assert(matrix_.width() == vector_.length());
+  }
+  unsigned int height() const { return matrix_.height(); }
+  unsigned int width() const { return matrix_.width(); }
+  value_type operator()(unsigned int i, unsigned int j) const {
+    return Operation()(matrix_(i, j), vector_[j]);
+  }
+
+private:
+  MatrixOperand matrix_;
+  VectorOperand vector_;
+};
+
+// Operands as held by expressions: vectors and matrices by reference,
+// temporaries by value, and expressions moved or copied
+template <typename T> VectorReference<T> Operand(const Vector<T> &vector) {
+  return VectorReference<T>(vector);
+}
+template <typename T> VectorValue<T> Operand(Vector<T> &&vector) {
+  return VectorValue<T>(std::move(vector));
+}
+template <typename T> MatrixReference<T> Operand(const Matrix<T> &matrix) {
+  return MatrixReference<T>(matrix);
+}
+template <typename T> MatrixValue<T> Operand(Matrix<T> &&matrix) {
+  return MatrixValue<T>(std::move(matrix));
+}
+template <typename E,
+          std::enable_if_t<!IsVector<RemoveCvRef<E>>::value &&
+                               !IsMatrix<RemoveCvRef<E>>::value,
+                           int> = 0>
+RemoveCvRef<E> Operand(E &&expression) {
+  return std::forward<E>(expression);
+}
+
+template <typename E>
+using OperandType = decltype(Operand(std::declval<E>()));
+// The data type of an operand, as a non-deduced parameter type for scalars
+template <typename E> using ScalarType = typename OperandType<E>::value_type;
+
+template <typename Operation, typename L, typename R>
+VectorBinary<Operation, OperandType<L>, OperandType<R>>
+MakeVectorBinary(L &&left, R &&right) {
+  return {Operand(std::forward<L>(left)), Operand(std::forward<R>(right))};
+}
+template <typename Operation, typename L, typename R>
+MatrixBinary<Operation, OperandType<L>, OperandType<R>>
+MakeMatrixBinary(L &&left, R &&right) {
+  return {Operand(std::forward<L>(left)), Operand(std::forward<R>(right))};
+}
+
+} // namespace detail
+
+/**
+ * @brief      Vector addition
+ *
+ * @param[in]  vector1  The first vector (or vector expression)
+ * @param[in]  vector2  The second vector (or vector expression)
+ *
+ * @return     The expression of the addition
+ */
+template <typename L, typename R,
+          std::enable_if_t<detail::kIsVectorOperand<L> &&
+                               detail::kIsVectorOperand<R>,
+                           int> = 0>
+auto operator+(L &&vector1, R &&vector2) {
+  return detail::MakeVectorBinary<detail::Plus>(std::forward<L>(vector1),
+                                                std::forward<R>(vector2));
+}
+
+/**
+ * @brief      Vector subtraction
+ *
+ * @param[in]  vector1  The first vector (or vector expression)
+ * @param[in]  vector2  The second vector (or vector expression)
+ *
+ * @return     The expression of the subtraction
+ */
+template <typename L, typename R,
+          std::enable_if_t<detail::kIsVectorOperand<L> &&
+                               detail::kIsVectorOperand<R>,
+                           int> = 0>
+auto operator-(L &&vector1, R &&vector2) {
+  return detail::MakeVectorBinary<detail::Minus>(std::forward<L>(vector1),
+                                                 std::forward<R>(vector2));
+}
+
+/**
+ * @brief      Elementwise vector multiplication
+ *
+ * @param[in]  vector1  The first vector (or vector expression)
+ * @param[in]  vector2  The second vector (or vector expression)
+ *
+ * @return     The expression of the multiplication
+ */
+template <typename L, typename R,
+          std::enable_if_t<detail::kIsVectorOperand<L> &&
+                               detail::kIsVectorOperand<R>,
+                           int> = 0>
+auto operator*(L &&vector1, R &&vector2) {
+  return detail::MakeVectorBinary<detail::Multiplies>(
+      std::forward<L>(vector1), std::forward<R>(vector2));
+}
+
+/**
+ * @brief      Scalar vector multiplication
+ *
+ * @param[in]  scalar  The scalar
+ * @param[in]  vector  The vector (or vector expression)
+ *
+ * @return     The expression of the multiplication
+ */
+template <typename E,
+          std::enable_if_t<detail::kIsVectorOperand<E>, int> = 0>
+auto operator*(detail::ScalarType<E> scalar, E &&vector) {
+  return detail::VectorScalar<detail::Multiplies, detail::OperandType<E>>(
+      scalar, detail::Operand(std::forward<E>(vector)));
+}
+
+/**
+ * @brief      Scalar-vector broadcast subtraction
+ *
+ * @param[in]  scalar  The scalar
+ * @param[in]  vector  The vector (or vector expression)
+ *
+ * @return     The expression of the subtraction
+ */
+template <typename E,
+          std::enable_if_t<detail::kIsVectorOperand<E>, int> = 0>
+auto operator-(detail::ScalarType<E> scalar, E &&vector) {
+  return detail::VectorScalar<detail::Minus, detail::OperandType<E>>(
+      scalar, detail::Operand(std::forward<E>(vector)));
+}
+
+/**
+ * @brief      Vector negation
+ *
+ * @param[in]  vector  The vector (or vector expression)
+ *
+ * @return     The expression of the negation
+ */
+template <typename E,
+          std::enable_if_t<detail::kIsVectorOperand<E>, int> = 0>
+auto operator-(E &&vector) {
+  return detail::VectorScalar<detail::Multiplies, detail::OperandType<E>>(
+      -1, detail::Operand(std::forward<E>(vector)));
+}
+
+/**
+ * @brief      Matrix subtraction
+ *
+ * @param[in]  matrix1  The first matrix (or matrix expression)
+ * @param[in]  matrix2  The second matrix (or matrix expression)
+ *
+ * @return     The expression of the subtraction
+ */
+template <typename L, typename R,
+          std::enable_if_t<detail::kIsMatrixOperand<L> &&
+                               detail::kIsMatrixOperand<R>,
+                           int> = 0>
+auto operator-(L &&matrix1, R &&matrix2) {
+  return detail::MakeMatrixBinary<detail::Minus>(std::forward<L>(matrix1),
+                                                 std::forward<R>(matrix2));
+}
+
+/**
+ * @brief      Elementwise matrix multiplication
+ *
+ * @param[in]  matrix1  The first matrix (or matrix expression)
+ * @param[in]  matrix2  The second matrix (or matrix expression)
+ *
+ * @return     The expression of the multiplication
+ */
+template <typename L, typename R,
+          std::enable_if_t<detail::kIsMatrixOperand<L> &&
+                               detail::kIsMatrixOperand<R>,
+                           int> = 0>
+auto ElementwiseProduct(L &&matrix1, R &&matrix2) {
+  return detail::MakeMatrixBinary<detail::Multiplies>(
+      std::forward<L>(matrix1), std::forward<R>(matrix2));
+}
+
+/**
+ * @brief      Scalar matrix multiplication.
+ *
+ * @param[in]  scalar  The scalar
+ * @param[in]  matrix  The matrix (or matrix expression)
+ *
+ * @return     The expression of the multiplication
+ */
+template <typename E,
+          std::enable_if_t<detail::kIsMatrixOperand<E>, int> = 0>
+auto operator*(detail::ScalarType<E> scalar, E &&matrix) {
+  return detail::MatrixScalar<detail::Multiplies, detail::OperandType<E>>(
+      scalar, detail::Operand(std::forward<E>(matrix)));
+}
+
+/**
+ * @brief      Matrix-vector broadcast addition, adding the vector to every
+ * row of the matrix
+ *
+ * @param[in]  matrix  The matrix (or matrix expression)
+ * @param[in]  vector  The vector (or vector expression)
+ *
+ * @return     The expression of the addition
+ */
+template <typename M, typename V,
+          std::enable_if_t<detail::kIsMatrixOperand<M> &&
+                               detail::kIsVectorOperand<V>,
+                           int> = 0>
+auto operator+(M &&matrix, V &&vector) {
+  return detail::MatrixRows<detail::Plus, detail::OperandType<M>,
+                            detail::OperandType<V>>(
+      detail::Operand(std::forward<M>(matrix)),
+      detail::Operand(std::forward<V>(vector)));
+}
+
+} // namespace nn
@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+namespace nn {
+
+/**
+ * @brief      Convert a float to IEEE 754 half precision, rounding to the
+ * nearest representable value (ties to even). Values too large for half
+ * precision become infinities, and NaNs stay NaNs.
+ *
+ * @param[in]  value  The value
+ *
+ * @return     The bits of the half precision value
+ */
+inline std::uint16_t FloatToHalf(float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const std::uint32_t sign = (bits >> 16) & 0x8000;
+  bits &= 0x7fffffff;
+  if (bits >= 0x7f800000) {
+    // Infinity, or NaN (kept quiet, with the top of its payload, as F16C
+    // does)
+    return sign | 0x7c00 |
+           (bits > 0x7f800000 ? 0x200 | ((bits >> 13) & 0x3ff) : 0);
+  }
+  if (bits >= 0x477ff000) {
+    // At least halfway between the largest half (65504) and 65536
+    return sign | 0x7c00;
+  }
+  if (bits < 0x38800000) {
+    // Below the smallest normal half (2^-14): subnormal or zero, in units of
+    // 2^-24
+    if (bits < 0x33000000) {
+      return sign;
+    }
+    const std::uint32_t exponent = bits >> 23;
+    const std::uint32_t mantissa = (bits & 0x7fffff) | 0x800000;
+    const std::uint32_t shift = 126 - exponent;
+    std::uint32_t result = mantissa >> shift;
+    const std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const std::uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (result & 1))) {
+      result++;
+    }
+    return sign | result;
+  }
+  // Normal: rebias the exponent and round the mantissa from 23 to 10 bits. A
+  // carry out of the mantissa correctly increments the exponent.
+  std::uint32_t result = (bits >> 13) - ((127 - 15) << 10);
+  const std::uint32_t remainder = bits & 0x1fff;
+  if (remainder > 0x1000 || (remainder == 0x1000 && (result & 1))) {
+    result++;
+  }
+  return sign | result;
+}
+
+/**
+ * @brief      Convert IEEE 754 half precision to a float, which is exact
+ *
+ * @param[in]  half  The bits of the half precision value
+ *
+ * @return     The value
+ */
+inline float HalfToFloat(std::uint16_t half) {
+  const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000) << 16;
+  const std::uint32_t exponent = (half >> 10) & 0x1f;
+  const std::uint32_t mantissa = half & 0x3ff;
+  if (exponent == 0) {
+    // Zero or subnormal, mantissa * 2^-24
+    const float magnitude =
+        static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+    return sign ? -magnitude : magnitude;
+  }
+  const std::uint32_t bits =
+      exponent == 0x1f
+          ? sign | 0x7f800000 | (mantissa << 13)
+          : sign | ((exponent + (127 - 15)) << 23) | (mantissa << 13);
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/**
+ * @brief      Convert a float to bfloat16 (the upper half of a float),
+ * rounding to the nearest representable value (ties to even). NaNs stay NaNs.
+ *
+ * @param[in]  value  The value
+ *
+ * @return     The bits of the bfloat16 value
+ */
+inline std::uint16_t FloatToBfloat16(float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    // NaN (kept quiet, as rounding could turn it into an infinity)
+    return (bits >> 16) | 0x40;
+  }
+  // Rounding may carry into the exponent, which correctly rounds the largest
+  // values up to infinity
+  return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+/**
+ * @brief      Convert bfloat16 to a float, which is exact
+ *
+ * @param[in]  bfloat16  The bits of the bfloat16 value
+ *
+ * @return     The value
+ */
+inline float Bfloat16ToFloat(std::uint16_t bfloat16) {
+  const std::uint32_t bits = static_cast<std::uint32_t>(bfloat16) << 16;
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+/**
+ * @brief      An IEEE 754 half precision number, as a storage type: it is
+ * trivial, so it can be an element of a Matrix or Vector, and it is converted
+ * to float for any arithmetic.
+ */
+struct Float16 {
+  Float16() = default;
+  explicit Float16(float value) : bits(FloatToHalf(value)) {}
+  explicit operator float() const { return HalfToFloat(bits); }
+  std::uint16_t bits;
+};
+
+/**
+ * @brief      A bfloat16 number, as a storage type (see Float16). It has the
+ * range of a float with 8 bits of precision, where Float16 has 11 bits of
+ * precision and a range up to 65504.
+ */
+struct BFloat16 {
+  BFloat16() = default;
+  explicit BFloat16(float value) : bits(FloatToBfloat16(value)) {}
+  explicit operator float() const { return Bfloat16ToFloat(bits); }
+  std::uint16_t bits;
+};
+
+} // namespace nn
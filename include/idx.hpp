@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dataset.hpp"
+#include "linear_algebra.hpp"
+#include "mapped_file.hpp"
+
+namespace nn {
+
+/**
+ * @brief      This class describes a read-only, memory-mapped file in the IDX
+ * format (as used by MNIST) with unsigned byte elements. The header is
+ * validated once when the file is opened, and the elements are then used in
+ * place: nothing is read until it is touched, and the pages are shared with
+ * the operating system's file cache.
+ *
+ * Throws std::runtime_error if the file can't be mapped or isn't a valid
+ * unsigned byte IDX file.
+ */
+class IdxFile {
+public:
+  /**
+   * @brief      Map a file
+   *
+   * @param[in]  path  The path of the file
+   */
+  explicit IdxFile(const std::string &path);
+  /**
+   * @brief      The size of every dimension, outermost first
+   */
+  const std::vector<unsigned int> &dims() const { return dims_; }
+  /**
+   * @brief      The elements, in row-major order
+   */
+  const std::uint8_t *data() const { return data_; }
+  /**
+   * @brief      The number of elements
+   */
+  std::size_t size() const;
+  /**
+   * @brief      View of the elements as a matrix with one row per item (the
+   * outermost dimension), with all other dimensions flattened into the row
+   */
+  MatrixView<const std::uint8_t> Items() const;
+
+private:
+  MappedFile file_;
+  const std::uint8_t *data_;
+  std::vector<unsigned int> dims_;
+};
+
+/**
+ * @brief      This class describes a classification data set read from a pair
+ * of memory-mapped IDX files, one of images and one of labels, e.g. MNIST.
+ * The images stay in the file as bytes: they are scaled to NNType as they are
+ * read into a batch, and the one-hot ground truths are generated from the
+ * labels, so the resident data set is the size of the files.
+ */
+class IdxDataset : public Dataset {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  images_path  The path of the images file (n x rows x cols)
+   * @param[in]  labels_path  The path of the labels file (n)
+   * @param[in]  n_classes    The number of classes
+   * @param[in]  scale        The scale of image bytes, to map them to [0, 1]
+   * by default
+   */
+  IdxDataset(const std::string &images_path, const std::string &labels_path,
+             unsigned int n_classes = 10, NNType scale = 1.f / 255.f);
+  unsigned int size() const override { return images_.dims().front(); }
+  unsigned int input_size() const override { return images_.Items().width; }
+  unsigned int output_size() const override { return n_classes_; }
+  void GetInput(unsigned int idx, NNType *input) const override;
+  void GetGroundTruth(unsigned int idx, NNType *ground_truth) const override;
+  bool has_labels() const override { return true; }
+  unsigned int Label(unsigned int idx) const override {
+    return labels_.data()[idx];
+  }
+  /**
+   * @brief      Zero-copy view of an image, as bytes
+   */
+  MatrixView<const std::uint8_t> Image(unsigned int idx) const;
+
+private:
+  IdxFile images_;
+  IdxFile labels_;
+  const unsigned int n_classes_;
+  const NNType scale_;
+};
+
+} // namespace nn
@@ -0,0 +1,148 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "dataset.hpp"
+#include "kernels.hpp"
+#include "linear_algebra.hpp"
+#include "model_file.hpp"
+
+namespace nn {
+
+class Network;
+
+/**
+ * @brief      This class describes a fixed number of preallocated scratch
+ * buffers ("slots") that threads claim one at a time, with an atomic flag per
+ * slot, so that concurrent callers neither allocate nor lock. A thread that
+ * finds every slot busy spins until one is released.
+ */
+class ScratchSlots {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  n_slots    The number of slots, 0 meaning one per hardware
+   * thread
+   * @param[in]  slot_size  The size of every slot in bytes, rounded up to a
+   * whole number of cache lines
+   */
+  ScratchSlots(unsigned int n_slots, std::size_t slot_size);
+  /**
+   * @brief      Claim a free slot, waiting if there is none
+   *
+   * @return     The slot index
+   */
+  unsigned int Acquire() const;
+  /**
+   * @brief      Give a slot claimed with Acquire back
+   *
+   * @param[in]  slot_idx  The slot index
+   */
+  void Release(unsigned int slot_idx) const {
+    flags_[slot_idx].busy.store(false, std::memory_order_release);
+  }
+  /**
+   * @brief      The buffer of a slot, aligned to kAlignment bytes
+   */
+  void *data(unsigned int slot_idx) const {
+    return buffer_.get() + slot_idx * slot_size_;
+  }
+  unsigned int size() const { return n_slots_; }
+
+private:
+  // On its own cache line, so that threads using neighbouring slots don't
+  // share one
+  struct alignas(kAlignment) Flag {
+    std::atomic<bool> busy{false};
+  };
+  unsigned int n_slots_;
+  std::size_t slot_size_;
+  AlignedBuffer<unsigned char> buffer_;
+  std::unique_ptr<Flag[]> flags_;
+};
+
+/**
+ * @brief      This class describes a trained network frozen for serving. The
+ * weights and biases are copied once into a single aligned buffer, with every
+ * weight row padded to a whole number of cache lines so that the
+ * matrix-vector kernel reads each row from an aligned start. Scratch buffers
+ * for the hidden layers are preallocated in ScratchSlots, so Predict never
+ * allocates, and several threads can call it at once.
+ *
+ * The model doesn't refer to the network after construction: later training
+ * doesn't change it. It can be saved to a model file, and loaded from one
+ * without copying: the parameters are laid out in the file exactly as in
+ * memory, and used in place from the mapped file.
+ */
+class InferenceModel {
+public:
+  /**
+   * @brief      Constructs a new instance from a network.
+   *
+   * @param[in]  network  The network
+   * @param[in]  n_slots  The number of scratch slots, i.e. of Predict calls
+   * that can run at once without waiting, 0 meaning one per hardware thread
+   */
+  explicit InferenceModel(const Network &network, unsigned int n_slots = 0);
+  /**
+   * @brief      Constructs a new instance from a model file (see ModelFile),
+   * which is mapped for the lifetime of the model. Throws std::runtime_error
+   * if the file isn't a valid model file.
+   *
+   * @param[in]  path             The path of the file
+   * @param[in]  n_slots          The number of scratch slots, as above
+   * @param[in]  verify_checksum  Whether to check the file's checksum, which
+   * reads it all up front
+   */
+  explicit InferenceModel(const std::string &path, unsigned int n_slots = 0,
+                          bool verify_checksum = true);
+  /**
+   * @brief      Save to a model file, which is replaced atomically. Throws
+   * std::runtime_error if the file can't be written.
+   *
+   * @param[in]  path  The path of the file
+   */
+  void Save(const std::string &path) const;
+  /**
+   * @brief      Feed one input forward. Thread-safe, and makes no heap
+   * allocations. If more threads call it at once than there are slots, the
+   * extra ones spin until a slot is free.
+   *
+   * @param[in]  input   The input, input_size() elements
+   * @param[out] output  The output, output_size() elements
+   */
+  void Predict(const NNType *input, NNType *output) const;
+  unsigned int input_size() const { return layers_.front().n_inputs; }
+  unsigned int output_size() const { return layers_.back().n_outputs; }
+  unsigned int n_slots() const { return slots_.size(); }
+
+private:
+  InferenceModel(ModelFile &&file, unsigned int n_slots);
+  struct Layer {
+    unsigned int n_inputs;
+    unsigned int n_outputs;
+    // Distance between weight rows, in elements
+    unsigned int stride;
+    // Offsets into parameters_, in elements
+    std::size_t weights_offset;
+    std::size_t biases_offset;
+    kernels::Activation activation;
+  };
+  std::vector<Layer> layers_;
+  // The parameters, in owned_parameters_ or in a mapped file
+  AlignedBuffer<NNType> owned_parameters_;
+  std::optional<ModelFile> file_;
+  const NNType *parameters_;
+  std::size_t n_parameters_;
+  // Every slot has two buffers of scratch_stride_ elements, which the hidden
+  // layers alternate between
+  unsigned int scratch_stride_;
+  ScratchSlots slots_;
+};
+
+} // namespace nn
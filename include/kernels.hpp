@@ -0,0 +1,309 @@
+#pragma once
+#include <cstdint>
+
+#include "float16.hpp"
+
+namespace nn {
+namespace kernels {
+
+/**
+ * @brief      Instruction set used by the kernels. Ordered from least to most
+ * capable.
+ */
+enum class Isa { kGeneric, kAvx2, kAvx512 };
+
+/**
+ * @brief      Detect the most capable instruction set that was compiled in and
+ * that both the CPU (from CPUID) and the operating system support.
+ *
+ * @return     The detected instruction set
+ */
+Isa DetectIsa();
+/**
+ * @brief      The instruction set the kernels currently dispatch to. This is
+ * DetectIsa() unless overridden with SetIsa or by setting the environment
+ * variable NN_KERNEL_ISA to "generic", "avx2" or "avx512".
+ *
+ * @return     The active instruction set
+ */
+Isa ActiveIsa();
+/**
+ * @brief      Override the instruction set the kernels dispatch to. Must not be
+ * called while kernels are running on other threads.
+ *
+ * @param[in]  isa   The instruction set
+ *
+ * @return     false (and nothing changes) if the instruction set isn't
+ * supported on this machine
+ */
+bool SetIsa(Isa isa);
+/**
+ * @brief      Human readable name of an instruction set
+ *
+ * @param[in]  isa   The instruction set
+ *
+ * @return     The name
+ */
+const char *IsaName(Isa isa);
+
+/**
+ * @brief      Allocate the calling thread's scratch space for Sgemm, which is
+ * otherwise allocated by its first call. Threads that will run kernels can
+ * call it when they start, so that no later call allocates.
+ */
+void ReserveScratch();
+
+/**
+ * @brief      Single precision general matrix multiply on row-major matrices,
+ * C = alpha * op(A) * op(B) + beta * C, where op(X) is X or X^T. The product
+ * is cache-blocked and register-tiled. If beta is zero, C is not read.
+ *
+ * @param[in]  transpose_a  Whether op(A) = A^T (A stored as k x m)
+ * @param[in]  transpose_b  Whether op(B) = B^T (B stored as n x k)
+ * @param[in]  m            Rows of op(A) and C
+ * @param[in]  n            Columns of op(B) and C
+ * @param[in]  k            Columns of op(A), rows of op(B)
+ * @param[in]  alpha        Scale of the product
+ * @param[in]  a            A
+ * @param[in]  lda          Row stride of A
+ * @param[in]  b            B
+ * @param[in]  ldb          Row stride of B
+ * @param[in]  beta         Scale of the existing C
+ * @param      c            C
+ * @param[in]  ldc          Row stride of C
+ */
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc);
+
+/**
+ * @brief      Single precision general matrix multiply as above, with B stored
+ * at half precision (IEEE half or bfloat16). B is converted to float as it is
+ * packed, so it is read at half the memory traffic while the products and
+ * sums are still single precision.
+ */
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const Float16 *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc);
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const BFloat16 *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc);
+
+/**
+ * @brief      Convert floats to half precision (IEEE half or bfloat16),
+ * rounding to nearest even
+ *
+ * @param[in]  n     The number of values
+ * @param[in]  x     The floats
+ * @param[out] y     The half precision values
+ */
+void ConvertToHalf(unsigned int n, const float *x, Float16 *y);
+void ConvertToHalf(unsigned int n, const float *x, BFloat16 *y);
+
+/**
+ * @brief      Single precision general matrix vector multiply on a row-major
+ * matrix, y = alpha * op(A) * x + beta * y. If beta is zero, y is not read.
+ *
+ * @param[in]  transpose_a  Whether op(A) = A^T
+ * @param[in]  m            Rows of A
+ * @param[in]  n            Columns of A
+ * @param[in]  alpha        Scale of the product
+ * @param[in]  a            A
+ * @param[in]  lda          Row stride of A
+ * @param[in]  x            x (length n, or m if transposed)
+ * @param[in]  beta         Scale of the existing y
+ * @param      y            y (length m, or n if transposed)
+ */
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y);
+/**
+ * @brief      Matrix vector multiply as above, on a matrix stored at half
+ * precision, which is converted to float as it is loaded. Products are
+ * summed in single precision.
+ */
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const Float16 *a, unsigned int lda, const float *x, float beta,
+           float *y);
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const BFloat16 *a, unsigned int lda, const float *x, float beta,
+           float *y);
+
+/**
+ * @brief      Integer matrix vector multiply on a row-major int8 matrix and a
+ * uint8 vector, y = A * x, accumulated exactly in int32. Every element of x
+ * must be at most 127: the SIMD kernels add pairs of 8-bit products in 16
+ * bits (maddubs), which then can't saturate, so every instruction set gives
+ * the same result. Uses AVX-512 VNNI where the CPU has it.
+ *
+ * @param[in]  m     Rows of A, and length of y
+ * @param[in]  n     Columns of A, and length of x
+ * @param[in]  a     A
+ * @param[in]  lda   Row stride of A
+ * @param[in]  x     x, with elements in [0, 127]
+ * @param[out] y     y
+ */
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y);
+
+/**
+ * @brief      Quantise floats to the inputs of Int8Gemv, q = x * scale +
+ * offset clamped to [0, 127] and rounded down (so an offset with 0.5 added
+ * rounds to nearest). The product and sum are rounded separately on every
+ * instruction set, so the result doesn't depend on it.
+ *
+ * @param[in]  n       Length of x and q
+ * @param[in]  x       x
+ * @param[in]  scale   The scale
+ * @param[in]  offset  The offset
+ * @param[out] q       q
+ */
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q);
+
+/**
+ * @brief      Activation function applied by the fused activation kernels
+ */
+enum class Activation { kSigmoid, kRelu };
+
+/**
+ * @brief      Add a bias to every row of a row-major matrix and apply an
+ * activation function, in one in-place pass: X = f(X + 1 * bias^T). The
+ * sigmoid uses a vectorised exponential accurate to a few ulp, and ReLU is
+ * branchless.
+ *
+ * @param[in]  activation  The activation function
+ * @param[in]  m           Rows of X
+ * @param[in]  n           Columns of X, and length of the bias
+ * @param[in]  bias        The bias
+ * @param      x           X, the weighted inputs on entry and the activations
+ * on exit
+ * @param[in]  ldx         Row stride of X
+ */
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx);
+
+/**
+ * @brief      Multiply a row-major matrix elementwise by the derivative of an
+ * activation function, D = D .* f'(z). The derivative is computed from the
+ * activations A = f(z) of the forward pass, which is enough for the
+ * supported functions (sigmoid' = a (1 - a), relu' = [a > 0]), so the
+ * weighted inputs need not be kept.
+ *
+ * @param[in]  activation   The activation function
+ * @param[in]  m            Rows of A and D
+ * @param[in]  n            Columns of A and D
+ * @param[in]  activations  A
+ * @param[in]  lda          Row stride of A
+ * @param      d            D
+ * @param[in]  ldd          Row stride of D
+ */
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd);
+
+/**
+ * @brief      Momentum update of parameters from their summed gradients, in
+ * one in-place pass over the parameters, gradients and velocities:
+ * V = momentum * V - learning_rate * G, then P += V, or with Nesterov
+ * momentum P += momentum * V - learning_rate * G (with the new V)
+ *
+ * @param[in]  n              Number of parameters
+ * @param[in]  learning_rate  The learning rate, divided by the number of
+ * examples the gradients are summed over
+ * @param[in]  momentum       The momentum
+ * @param[in]  nesterov       Whether to use Nesterov momentum
+ * @param[in]  gradients      G
+ * @param      velocities     V
+ * @param      parameters     P
+ */
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters);
+
+/**
+ * @brief      Adam update (Kingma and Ba, 2015) of parameters from their
+ * summed gradients, in one in-place pass over the parameters, gradients and
+ * moments: with g = gradient_scale * G, M = beta1 * M + (1 - beta1) * g,
+ * V = beta2 * V + (1 - beta2) * g^2 and P -= step_size * M / (sqrt(V) +
+ * epsilon). The bias correction of the moments is folded into step_size.
+ *
+ * @param[in]  n               Number of parameters
+ * @param[in]  gradient_scale  Scale turning the summed gradients into means
+ * @param[in]  beta1           Decay rate of the first moments
+ * @param[in]  beta2           Decay rate of the second moments
+ * @param[in]  step_size       The step size
+ * @param[in]  epsilon         Added to the root of the second moments
+ * @param[in]  gradients       G
+ * @param      moments         M
+ * @param      second_moments  V
+ * @param      parameters      P
+ */
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters);
+
+/**
+ * @brief      Compress a vector to its non-zero elements and their indices in
+ * increasing order, i.e. one row of a sparse matrix in compressed sparse row
+ * (CSR) format. NaNs count as non-zero.
+ *
+ * @param[in]  n        Length of x
+ * @param[in]  x        x
+ * @param[out] indices  The indices of the non-zero elements (room for n)
+ * @param[out] values   The non-zero elements (room for n)
+ *
+ * @return     The number of non-zero elements
+ */
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values);
+
+/**
+ * @brief      Product of a sparse matrix in CSR format and a transposed dense
+ * row-major matrix, C = A * B^T, touching only the columns of B at the
+ * non-zero elements of A. Row i of A has the values and column indices at
+ * [row_offsets[i], row_offsets[i + 1]); the column indices of a row must be
+ * distinct.
+ *
+ * @param[in]  m            Rows of A and C
+ * @param[in]  n            Rows of B, and columns of C
+ * @param[in]  row_offsets  The row offsets of A (m + 1 of them)
+ * @param[in]  columns      The column indices of A
+ * @param[in]  values       The values of A
+ * @param[in]  b            B
+ * @param[in]  ldb          Row stride of B
+ * @param[out] c            C
+ * @param[in]  ldc          Row stride of C
+ */
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc);
+
+/**
+ * @brief      Sum of the outer products of the rows of a dense row-major
+ * matrix and of a sparse matrix in CSR format (as for SparseGemm),
+ * C = D^T * A. Only the columns of C at the non-zero elements of A are
+ * computed, and the others are zeroed.
+ *
+ * @param[in]  m            Rows of D and A
+ * @param[in]  n            Columns of D, and rows of C
+ * @param[in]  k            Columns of A and C
+ * @param[in]  d            D
+ * @param[in]  ldd          Row stride of D
+ * @param[in]  row_offsets  The row offsets of A (m + 1 of them)
+ * @param[in]  columns      The column indices of A
+ * @param[in]  values       The values of A
+ * @param[out] c            C
+ * @param[in]  ldc          Row stride of C
+ */
+void SparseOuterProducts(unsigned int m, unsigned int n, unsigned int k,
+                         const float *d, unsigned int ldd,
+                         const unsigned int *row_offsets,
+                         const unsigned int *columns, const float *values,
+                         float *c, unsigned int ldc);
+
+} // namespace kernels
+} // namespace nn
@@ -1,37 +1,289 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <initializer_list>
 #include <iostream>
+#include <memory>
+#include <new>
 #include <random>
-#include <valarray>
+#include <type_traits>
+#include <utility>
+
+#include "expression.hpp"
+#include "kernels.hpp"
 
 namespace nn {
 
 // need to define in cpp file to avoid multiple defs
 extern std::default_random_engine generator;
 
+// Alignment in bytes of every buffer owned by a Matrix or Vector (one cache
+// line, and wide enough for a full AVX-512 register)
+constexpr std::size_t kAlignment = 64;
+
 /**
- * @brief      This class describes a matrix.
+ * @brief      Deleter for buffers allocated by AllocateAligned
  *
  * @tparam     T     data type
  */
-template <typename T> class Matrix {
+template <typename T> struct AlignedDeleter {
+  void operator()(T *pointer) const {
+    ::operator delete[](pointer, std::align_val_t(kAlignment));
+  }
+};
+
+template <typename T> using AlignedBuffer = std::unique_ptr<T[], AlignedDeleter<T>>;
+
+/**
+ * @brief      Allocate an uninitialised buffer aligned to kAlignment bytes
+ *
+ * @param[in]  size  The number of elements
+ *
+ * @tparam     T     Data type (must be trivial, no constructors are run)
+ *
+ * @return     The buffer
+ */
+template <typename T> AlignedBuffer<T> AllocateAligned(std::size_t size) {
+  static_assert(std::is_trivial_v<T>, "aligned buffers hold trivial types");
+  if (size == 0) {
+    return AlignedBuffer<T>();
+  }
+  return AlignedBuffer<T>(static_cast<T *>(
+      ::operator new[](size * sizeof(T), std::align_val_t(kAlignment))));
+}
+
+/**
+ * @brief      This class describes a non-owning, strided view of a vector. It
+ * is used for rows and columns of a matrix.
+ *
+ * @tparam     T     data type (const-qualify for a read-only view)
+ */
+template <typename T> class VectorView {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param      data    Pointer to the first element
+   * @param[in]  length  The length
+   * @param[in]  stride  The distance in elements between consecutive elements
+   */
+  VectorView(T *data, unsigned int length, unsigned int stride = 1)
+      : length(length), stride(stride), data_(data) {}
+  /**
+   * @brief      Conversion to a read-only view.
+   */
+  operator VectorView<const T>() const {
+    return VectorView<const T>(data_, length, stride);
+  }
+  T &operator[](unsigned int i) const {
+    assert(i < length);
+    return data_[i * stride];
+  }
+  T *data() const { return data_; }
+
+  const unsigned int length;
+  const unsigned int stride;
+
+private:
+  T *data_;
+};
+
+/**
+ * @brief      This class describes a non-owning, row-major view of a matrix
+ * whose rows are "stride" elements apart.
+ *
+ * @tparam     T     data type (const-qualify for a read-only view)
+ */
+template <typename T> class MatrixView {
 public:
   /**
    * @brief      Constructs a new instance.
    *
+   * @param      data    Pointer to the first element
+   * @param[in]  height  The height
+   * @param[in]  width   The width
+   * @param[in]  stride  The distance in elements between consecutive rows
+   */
+  MatrixView(T *data, unsigned int height, unsigned int width,
+             unsigned int stride)
+      : height(height), width(width), stride(stride), data_(data) {
+    assert(stride >= width);
+  }
+  /**
+   * @brief      Conversion to a read-only view.
+   */
+  operator MatrixView<const T>() const {
+    return MatrixView<const T>(data_, height, width, stride);
+  }
+  T &operator()(unsigned int i, unsigned int j) const {
+    assert(i < height);
+    assert(j < width);
+    return data_[i * stride + j];
+  }
+  /**
+   * @brief      View of a row
+   *
+   * @param[in]  i     The row index
+   *
+   * @return     The row
+   */
+  VectorView<T> Row(unsigned int i) const {
+    assert(i < height);
+    return VectorView<T>(data_ + i * stride, width);
+  }
+  /**
+   * @brief      View of a column
+   *
+   * @param[in]  j     The column index
+   *
+   * @return     The column
+   */
+  VectorView<T> Column(unsigned int j) const {
+    assert(j < width);
+    return VectorView<T>(data_ + j, height, stride);
+  }
+  /**
+   * @brief      View of a rectangular sub-matrix
+   *
+   * @param[in]  row     The first row
+   * @param[in]  col     The first column
+   * @param[in]  height  The height of the block
+   * @param[in]  width   The width of the block
+   *
+   * @return     The sub-matrix
+   */
+  MatrixView<T> Block(unsigned int row, unsigned int col, unsigned int height,
+                      unsigned int width) const {
+    assert(row + height <= this->height);
+    assert(col + width <= this->width);
+    return MatrixView<T>(data_ + row * stride + col, height, width, stride);
+  }
+  T *data() const { return data_; }
+
+  const unsigned int height;
+  const unsigned int width;
+  const unsigned int stride;
+
+private:
+  T *data_;
+};
+
+/**
+ * @brief      This class describes a lazily transposed matrix. It refers to
+ * the original matrix without copying it, and products with it are computed
+ * by kernels that read the original matrix in transposed order.
+ *
+ * @tparam     T     data type
+ */
+template <typename T> class TransposedView {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  matrix  The matrix to transpose
+   */
+  explicit TransposedView(MatrixView<const T> matrix)
+      : height(matrix.width), width(matrix.height), matrix(matrix) {}
+  const T &operator()(unsigned int i, unsigned int j) const {
+    return matrix(j, i);
+  }
+
+  const unsigned int height;
+  const unsigned int width;
+  const MatrixView<const T> matrix; // the matrix before transposition
+};
+
+/**
+ * @brief      This class describes a matrix. Elements are stored row-major in
+ * a single buffer aligned to kAlignment bytes.
+ *
+ * @tparam     T     data type
+ */
+template <typename T> class Matrix {
+public:
+  /**
+   * @brief      Constructs a new zero-initialised instance.
+   *
    * @param[in]  height  The height
    * @param[in]  width   The width
    */
   Matrix(unsigned int height, unsigned int width)
-      : height(height), width(width),
-        rows(std::valarray<std::valarray<T>>(std::valarray<T>(width), height)) {
+      : height(height), width(width), stride(width),
+        data_(AllocateAligned<T>(static_cast<std::size_t>(height) * width)) {
+    std::fill(begin(), end(), static_cast<T>(0));
+  }
+  /**
+   * @brief      Constructs a new instance by copying the contents of a view.
+   *
+   * @param[in]  view  The view
+   */
+  explicit Matrix(MatrixView<const T> view) : Matrix(view.height, view.width) {
+    for (unsigned int i = 0; i < height; i++) {
+      std::copy(view.data() + i * view.stride,
+                view.data() + i * view.stride + width, data_.get() + i * stride);
+    }
   }
   /**
    * @brief      Constructs a new instance via copy.
    *
-   * @param[in]  <unnamed>  { parameter_description }
+   * @param[in]  other  The other matrix
+   */
+  Matrix(const Matrix<T> &other)
+      : height(other.height), width(other.width), stride(other.stride),
+        data_(AllocateAligned<T>(other.size())) {
+    std::copy(other.begin(), other.end(), begin());
+  }
+  /**
+   * @brief      Constructs a new instance via move. The other matrix is left
+   * without a buffer and must not be read from.
+   *
+   * @param      other  The other matrix
+   */
+  Matrix(Matrix<T> &&other) noexcept
+      : height(other.height), width(other.width), stride(other.stride),
+        data_(std::move(other.data_)) {}
+  /**
+   * @brief      Constructs a new instance by evaluating a matrix expression,
+   * in a single pass and without zero-initialising the buffer first.
+   *
+   * @param[in]  expression  The expression
    */
-  Matrix(const Matrix<T> &) = default;
+  template <typename E>
+  Matrix(const MatrixExpression<E> &expression)
+      : height(expression.derived().height()),
+        width(expression.derived().width()), stride(width),
+        data_(AllocateAligned<T>(static_cast<std::size_t>(height) * width)) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out = value; });
+  }
+  /**
+   * @brief      Copy assignment operator. The dimensions must match.
+   *
+   * @param[in]  other  The other matrix
+   *
+   * @return     The result of the assignment
+   */
+  Matrix<T> &operator=(const Matrix<T> &other) {
+    assert(height == other.height);
+    assert(width == other.width);
+    if (this != &other) {
+      std::copy(other.begin(), other.end(), begin());
+    }
+    return *this;
+  }
+  /**
+   * @brief      Move assignment operator. The dimensions must match.
+   *
+   * @param      other  The other matrix
+   *
+   * @return     The result of the assignment
+   */
+  Matrix<T> &operator=(Matrix<T> &&other) noexcept {
+    assert(height == other.height);
+    assert(width == other.width);
+    std::swap(data_, other.data_);
+    return *this;
+  }
   /**
    * @brief      Addition assignment operator.
    *
@@ -40,7 +292,13 @@ public:
    * @return     The result of the addition assignment
    */
   Matrix<T> &operator+=(const Matrix<T> &other) {
-    rows += other.rows;
+    assert(height == other.height);
+    assert(width == other.width);
+    const T *other_data = other.data();
+    T *this_data = data();
+    for (std::size_t i = 0; i < size(); i++) {
+      this_data[i] += other_data[i];
+    }
     return *this;
   }
   /**
@@ -51,22 +309,64 @@ public:
    * @return     The result of the subtraction assignment
    */
   Matrix<T> &operator-=(const Matrix<T> &other) {
-    rows -= other.rows;
+    assert(height == other.height);
+    assert(width == other.width);
+    const T *other_data = other.data();
+    T *this_data = data();
+    for (std::size_t i = 0; i < size(); i++) {
+      this_data[i] -= other_data[i];
+    }
     return *this;
   }
   /**
-   * @brief      Move assignment operator.
+   * @brief      Assignment of a matrix expression, evaluated straight into
+   * this matrix. The dimensions must match. The expression may refer to this
+   * matrix, since every element only depends on the same element of its
+   * operands.
    *
-   * @param      other  The other matrix
+   * @param[in]  expression  The expression
    *
    * @return     The result of the assignment
    */
-  Matrix<T> &operator=(Matrix<T> &&other) {
-    assert(height == other.height);
-    assert(width == other.width);
-    rows = other.rows; // TODO: optimise via move?
+  template <typename E>
+  Matrix<T> &operator=(const MatrixExpression<E> &expression) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out = value; });
+    return *this;
+  }
+  /**
+   * @brief      Addition assignment of a matrix expression.
+   *
+   * @param[in]  expression  The expression
+   *
+   * @return     The result of the addition assignment
+   */
+  template <typename E>
+  Matrix<T> &operator+=(const MatrixExpression<E> &expression) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out += value; });
     return *this;
   }
+  /**
+   * @brief      Subtraction assignment of a matrix expression.
+   *
+   * @param[in]  expression  The expression
+   *
+   * @return     The result of the subtraction assignment
+   */
+  template <typename E>
+  Matrix<T> &operator-=(const MatrixExpression<E> &expression) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out -= value; });
+    return *this;
+  }
+  T &operator()(unsigned int i, unsigned int j) {
+    assert(i < height);
+    assert(j < width);
+    return data_[i * stride + j];
+  }
+  const T &operator()(unsigned int i, unsigned int j) const {
+    assert(i < height);
+    assert(j < width);
+    return data_[i * stride + j];
+  }
   /**
    * @brief      Generate random matrix using normal distribution
    *
@@ -81,10 +381,8 @@ public:
                           T stddev) {
     std::normal_distribution<T> distribution(mean, stddev);
     Matrix<T> matrix(height, width);
-    for (unsigned int i = 0; i < height; i++) {
-      for (unsigned int j = 0; j < width; j++) {
-        matrix.rows[i][j] = distribution(generator);
-      }
+    for (auto &element : matrix) {
+      element = distribution(generator);
     }
     return matrix;
   }
@@ -97,58 +395,143 @@ public:
    * @return     Zero matrix
    */
   static Matrix<T> Zeros(unsigned int height, unsigned int width) {
-    Matrix<T> matrix(height, width);
-    for (unsigned int i = 0; i < height; i++) {
-      for (unsigned int j = 0; j < width; j++) {
-        matrix.rows[i][j] = static_cast<T>(0);
-      }
-    }
-    return matrix;
+    return Matrix<T>(height, width);
   }
   /**
    * @brief      Transpose matrix
    *
    * @return     The transposed matrix
    */
-  Matrix<T> Transpose() {
+  Matrix<T> Transpose() const {
     Matrix<T> matrix_t(width, height);
     for (unsigned int i = 0; i < height; i++) {
       for (unsigned int j = 0; j < width; j++) {
-        matrix_t.rows[j][i] = rows[i][j];
+        matrix_t(j, i) = (*this)(i, j);
       }
     }
     return matrix_t;
   }
+  /**
+   * @brief      Lazy transpose, which doesn't copy the matrix. The matrix
+   * must outlive the returned view.
+   *
+   * @return     The transposed view
+   */
+  TransposedView<T> Transposed() const { return TransposedView<T>(View()); }
+  MatrixView<T> View() { return MatrixView<T>(data(), height, width, stride); }
+  MatrixView<const T> View() const {
+    return MatrixView<const T>(data(), height, width, stride);
+  }
+  VectorView<T> Row(unsigned int i) { return View().Row(i); }
+  VectorView<const T> Row(unsigned int i) const { return View().Row(i); }
+  VectorView<T> Column(unsigned int j) { return View().Column(j); }
+  VectorView<const T> Column(unsigned int j) const { return View().Column(j); }
+  MatrixView<T> Block(unsigned int row, unsigned int col, unsigned int height,
+                      unsigned int width) {
+    return View().Block(row, col, height, width);
+  }
+  MatrixView<const T> Block(unsigned int row, unsigned int col,
+                            unsigned int height, unsigned int width) const {
+    return View().Block(row, col, height, width);
+  }
+  T *data() { return data_.get(); }
+  const T *data() const { return data_.get(); }
+  std::size_t size() const { return static_cast<std::size_t>(height) * stride; }
+  T *begin() { return data(); }
+  T *end() { return data() + size(); }
+  const T *begin() const { return data(); }
+  const T *end() const { return data() + size(); }
+
   const unsigned int height;
   const unsigned int width;
-  std::valarray<std::valarray<T>> rows;
+  const unsigned int stride; // distance in elements between rows
+
+private:
+  // Combine every element of an expression into this matrix
+  template <typename E, typename Combine>
+  void Evaluate_(const E &expression, Combine combine) {
+    static_assert(std::is_same_v<T, typename E::value_type>,
+                  "an expression is evaluated into its own data type");
+    assert(height == expression.height());
+    assert(width == expression.width());
+    for (unsigned int i = 0; i < height; i++) {
+      T *row = data() + static_cast<std::size_t>(i) * stride;
+      for (unsigned int j = 0; j < width; j++) {
+        combine(row[j], expression(i, j));
+      }
+    }
+  }
+
+  AlignedBuffer<T> data_;
 };
 
 /**
- * @brief      This class describes a vector.
+ * @brief      This class describes a vector. Elements are stored contiguously
+ * in a buffer aligned to kAlignment bytes.
  *
  * @tparam     T     data type
  */
 template <typename T> class Vector {
 public:
   /**
-   * @brief      Constructs a new instance.
+   * @brief      Constructs a new zero-initialised instance.
    *
    * @param[in]  length  The length
    */
   explicit Vector(unsigned int length)
-      : length(length), elements(std::valarray<T>(length)) {}
-  Vector(std::valarray<T> elements)
-      : length(elements.size()), elements(elements) {}
+      : length(length), data_(AllocateAligned<T>(length)) {
+    std::fill(begin(), end(), static_cast<T>(0));
+  }
+  /**
+   * @brief      Constructs a new instance from a list of elements.
+   *
+   * @param[in]  elements  The elements
+   */
+  Vector(std::initializer_list<T> elements)
+      : length(elements.size()), data_(AllocateAligned<T>(elements.size())) {
+    std::copy(elements.begin(), elements.end(), begin());
+  }
+  /**
+   * @brief      Constructs a new instance by copying the contents of a view.
+   *
+   * @param[in]  view  The view
+   */
+  explicit Vector(VectorView<const T> view)
+      : length(view.length), data_(AllocateAligned<T>(view.length)) {
+    for (unsigned int i = 0; i < length; i++) {
+      data_[i] = view[i];
+    }
+  }
+  /**
+   * @brief      Constructs a new instance by evaluating a vector expression,
+   * in a single pass and without zero-initialising the buffer first.
+   *
+   * @param[in]  expression  The expression
+   */
+  template <typename E>
+  Vector(const VectorExpression<E> &expression)
+      : length(expression.derived().length()),
+        data_(AllocateAligned<T>(length)) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out = value; });
+  }
   Vector(const Vector<T> &other)
-      : length(other.length), elements(other.elements) {}
+      : length(other.length), data_(AllocateAligned<T>(other.length)) {
+    std::copy(other.begin(), other.end(), begin());
+  }
+  Vector(Vector<T> &&other) noexcept
+      : length(other.length), data_(std::move(other.data_)) {}
   Vector<T> &operator=(const Vector<T> &other) {
     assert(length == other.length);
     if (this != &other) {
-      elements = other.elements;
+      std::copy(other.begin(), other.end(), begin());
     }
     return *this;
   }
+  Vector<T> &operator=(Vector<T> &&other) noexcept {
+    assert(length == other.length);
+    std::swap(data_, other.data_);
+    return *this;
+  }
   /**
    * @brief      Addition assignment operator.
    *
@@ -157,7 +540,10 @@ public:
    * @return     The result of the addition assignment
    */
   Vector<T> &operator+=(const Vector<T> &other) {
-    elements += other.elements;
+    assert(length == other.length);
+    for (unsigned int i = 0; i < length; i++) {
+      data_[i] += other.data_[i];
+    }
     return *this;
   }
   /**
@@ -168,9 +554,59 @@ public:
    * @return     The result of the subtraction assignment
    */
   Vector<T> &operator-=(const Vector<T> &other) {
-    elements -= other.elements;
+    assert(length == other.length);
+    for (unsigned int i = 0; i < length; i++) {
+      data_[i] -= other.data_[i];
+    }
+    return *this;
+  }
+  /**
+   * @brief      Assignment of a vector expression, evaluated straight into
+   * this vector. The lengths must match. The expression may refer to this
+   * vector, since every element only depends on the same element of its
+   * operands.
+   *
+   * @param[in]  expression  The expression
+   *
+   * @return     The result of the assignment
+   */
+  template <typename E>
+  Vector<T> &operator=(const VectorExpression<E> &expression) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out = value; });
     return *this;
   }
+  /**
+   * @brief      Addition assignment of a vector expression.
+   *
+   * @param[in]  expression  The expression
+   *
+   * @return     The result of the addition assignment
+   */
+  template <typename E>
+  Vector<T> &operator+=(const VectorExpression<E> &expression) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out += value; });
+    return *this;
+  }
+  /**
+   * @brief      Subtraction assignment of a vector expression.
+   *
+   * @param[in]  expression  The expression
+   *
+   * @return     The result of the subtraction assignment
+   */
+  template <typename E>
+  Vector<T> &operator-=(const VectorExpression<E> &expression) {
+    Evaluate_(expression.derived(), [](T &out, T value) { out -= value; });
+    return *this;
+  }
+  T &operator[](unsigned int i) {
+    assert(i < length);
+    return data_[i];
+  }
+  const T &operator[](unsigned int i) const {
+    assert(i < length);
+    return data_[i];
+  }
   /**
    * @brief      Outer product.
    *
@@ -178,10 +614,13 @@ public:
    *
    * @return     The outer product of this vector and the other vector
    */
-  Matrix<T> OuterProduct(const Vector<T> &other) {
+  Matrix<T> OuterProduct(const Vector<T> &other) const {
     Matrix<T> out_matrix(length, other.length);
     for (unsigned int i = 0; i < out_matrix.height; i++) {
-      out_matrix.rows[i] = elements[i] * other.elements;
+      T *out_row = out_matrix.data() + i * out_matrix.stride;
+      for (unsigned int j = 0; j < other.length; j++) {
+        out_row[j] = data_[i] * other.data_[j];
+      }
     }
     return out_matrix;
   }
@@ -197,8 +636,8 @@ public:
   static Vector<T> Random(unsigned int length, T mean, T stddev) {
     std::normal_distribution<T> distribution(mean, stddev);
     Vector<T> vector(length);
-    for (unsigned int i = 0; i < length; i++) {
-      vector.elements[i] = distribution(generator);
+    for (auto &element : vector) {
+      element = distribution(generator);
     }
     return vector;
   }
@@ -209,16 +648,34 @@ public:
    *
    * @return     A zero vector
    */
-  static Vector<T> Zeros(unsigned int length) {
-    Vector<T> vector(length);
+  static Vector<T> Zeros(unsigned int length) { return Vector<T>(length); }
+  VectorView<T> View() { return VectorView<T>(data(), length); }
+  VectorView<const T> View() const {
+    return VectorView<const T>(data(), length);
+  }
+  T *data() { return data_.get(); }
+  const T *data() const { return data_.get(); }
+  T *begin() { return data(); }
+  T *end() { return data() + length; }
+  const T *begin() const { return data(); }
+  const T *end() const { return data() + length; }
+
+  const unsigned int length;
+
+private:
+  // Combine every element of an expression into this vector
+  template <typename E, typename Combine>
+  void Evaluate_(const E &expression, Combine combine) {
+    static_assert(std::is_same_v<T, typename E::value_type>,
+                  "an expression is evaluated into its own data type");
+    assert(length == expression.length());
+    T *out = data();
     for (unsigned int i = 0; i < length; i++) {
-      vector.elements[i] = static_cast<T>(0);
+      combine(out[i], expression[i]);
     }
-    return vector;
   }
 
-  const unsigned int length;
-  std::valarray<T> elements;
+  AlignedBuffer<T> data_;
 };
 
 /**
@@ -241,9 +698,9 @@ std::ostream &operator<<(std::ostream &os, const Matrix<T> &matrix) {
   // First row
   os << "[[";
   for (unsigned int j = 0; j < width - 1; j++) {
-    os << matrix.rows[0][j] << ", ";
+    os << matrix(0, j) << ", ";
   }
-  os << matrix.rows[0][width - 1] << "]";
+  os << matrix(0, width - 1) << "]";
   if (height == 1) {
     os << "]";
     return os;
@@ -255,18 +712,18 @@ std::ostream &operator<<(std::ostream &os, const Matrix<T> &matrix) {
     for (unsigned int i = 1; i < height - 1; i++) {
       os << " [";
       for (unsigned int j = 0; j < width - 1; j++) {
-        os << matrix.rows[i][j] << ", ";
+        os << matrix(i, j) << ", ";
       }
-      os << matrix.rows[i][width - 1] << "]," << std::endl;
+      os << matrix(i, width - 1) << "]," << std::endl;
     }
   }
 
   // Last row
   os << " [";
   for (unsigned int j = 0; j < width - 1; j++) {
-    os << matrix.rows[height - 1][j] << ", ";
+    os << matrix(height - 1, j) << ", ";
   }
-  os << matrix.rows[height - 1][width - 1] << "]]";
+  os << matrix(height - 1, width - 1) << "]]";
   return os;
 }
 
@@ -286,9 +743,9 @@ std::ostream &operator<<(std::ostream &os, const Vector<T> &vector) {
 
   os << "[";
   for (unsigned int i = 0; i < vector.length - 1; i++) {
-    os << vector.elements[i] << ", ";
+    os << vector[i] << ", ";
   }
-  os << vector.elements[vector.length - 1] << "]";
+  os << vector[vector.length - 1] << "]";
   return os;
 }
 
@@ -306,122 +763,374 @@ template <typename T>
 Vector<T> operator*(const Matrix<T> &matrix, const Vector<T> &vector) {
   assert(vector.length == matrix.width);
   Vector<T> out_vector(matrix.height);
+  if constexpr (std::is_same_v<T, float>) {
+    kernels::Sgemv(false, matrix.height, matrix.width, 1.f, matrix.data(),
+                   matrix.stride, vector.data(), 0.f, out_vector.data());
+    return out_vector;
+  }
   for (unsigned int i = 0; i < matrix.height; i++) {
-    out_vector.elements[i] = (matrix.rows[i] * vector.elements).sum();
+    const T *row = matrix.data() + i * matrix.stride;
+    T sum = static_cast<T>(0);
+    for (unsigned int j = 0; j < matrix.width; j++) {
+      sum += row[j] * vector[j];
+    }
+    out_vector[i] = sum;
   }
   return out_vector;
 }
 
+namespace detail {
+// Stops template argument deduction, so that a MatrixView<T> can be passed
+// where a MatrixView<const T> is expected
+template <typename T> struct Identity { using type = T; };
+template <typename T> using NonDeduced = typename Identity<T>::type;
+} // namespace detail
+
 /**
- * @brief      Elementwise vector multiplication
+ * @brief      General matrix multiply into an existing matrix,
+ * c = alpha * op(a) * op(b) + beta * c, where op transposes its argument if
+ * requested. If beta is zero, c is not read.
  *
- * @param[in]  vector1  The first vector
- * @param[in]  vector2  The second vector
+ * @param[in]  alpha        Scale of the product
+ * @param[in]  a            A
+ * @param[in]  transpose_a  Whether to transpose A
+ * @param[in]  b            B
+ * @param[in]  transpose_b  Whether to transpose B
+ * @param[in]  beta         Scale of the existing C
+ * @param[in]  c            C, the output
+ *
+ * @tparam     T            Data type
+ */
+template <typename T>
+void Gemm(T alpha, MatrixView<const detail::NonDeduced<T>> a, bool transpose_a,
+          MatrixView<const detail::NonDeduced<T>> b, bool transpose_b, T beta,
+          MatrixView<detail::NonDeduced<T>> c) {
+  const unsigned int m = transpose_a ? a.width : a.height;
+  const unsigned int k = transpose_a ? a.height : a.width;
+  const unsigned int n = transpose_b ? b.height : b.width;
+  assert(k == (transpose_b ? b.width : b.height));
+  assert(c.height == m);
+  assert(c.width == n);
+  if constexpr (std::is_same_v<T, float>) {
+    if (m == 1 && !transpose_a) {
+      // A single row: packing B for the blocked kernel would cost more than
+      // the product, so multiply B by the row directly
+      kernels::Sgemv(!transpose_b, b.height, b.width, alpha, b.data(),
+                     b.stride, a.data(), beta, c.data());
+      return;
+    }
+    kernels::Sgemm(transpose_a, transpose_b, m, n, k, alpha, a.data(), a.stride,
+                   b.data(), b.stride, beta, c.data(), c.stride);
+    return;
+  }
+  for (unsigned int i = 0; i < m; i++) {
+    for (unsigned int j = 0; j < n; j++) {
+      c(i, j) = beta == static_cast<T>(0) ? static_cast<T>(0) : beta * c(i, j);
+    }
+  }
+  // i-k-j order so the innermost loop streams through the output rows
+  for (unsigned int i = 0; i < m; i++) {
+    for (unsigned int p = 0; p < k; p++) {
+      const T scale = alpha * (transpose_a ? a(p, i) : a(i, p));
+      for (unsigned int j = 0; j < n; j++) {
+        c(i, j) += scale * (transpose_b ? b(j, p) : b(p, j));
+      }
+    }
+  }
+}
+
+namespace detail {
+template <typename Half>
+void MixedGemm(float alpha, MatrixView<const float> a, bool transpose_a,
+               MatrixView<const Half> b, bool transpose_b, float beta,
+               MatrixView<float> c) {
+  const unsigned int m = transpose_a ? a.width : a.height;
+  const unsigned int k = transpose_a ? a.height : a.width;
+  const unsigned int n = transpose_b ? b.height : b.width;
+  assert(k == (transpose_b ? b.width : b.height));
+  assert(c.height == m);
+  assert(c.width == n);
+  if (m <= 4 && !transpose_a) {
+    // A few rows: streaming B once per row, converting it in registers, costs
+    // less than converting and packing it for the blocked kernel
+    for (unsigned int i = 0; i < m; i++) {
+      kernels::Sgemv(!transpose_b, b.height, b.width, alpha, b.data(),
+                     b.stride, a.data() + std::size_t{i} * a.stride, beta,
+                     c.data() + std::size_t{i} * c.stride);
+    }
+    return;
+  }
+  kernels::Sgemm(transpose_a, transpose_b, m, n, k, alpha, a.data(), a.stride,
+                 b.data(), b.stride, beta, c.data(), c.stride);
+}
+} // namespace detail
+
+/**
+ * @brief      Single precision general matrix multiply as above, with B
+ * stored at half precision. B is converted as it is read, and the products
+ * are computed and summed in single precision.
+ */
+inline void Gemm(float alpha, MatrixView<const float> a, bool transpose_a,
+                 MatrixView<const Float16> b, bool transpose_b, float beta,
+                 MatrixView<float> c) {
+  detail::MixedGemm(alpha, a, transpose_a, b, transpose_b, beta, c);
+}
+inline void Gemm(float alpha, MatrixView<const float> a, bool transpose_a,
+                 MatrixView<const BFloat16> b, bool transpose_b, float beta,
+                 MatrixView<float> c) {
+  detail::MixedGemm(alpha, a, transpose_a, b, transpose_b, beta, c);
+}
+
+namespace detail {
+/**
+ * @brief      Product op(A) * op(B) of two matrix views, where op transposes
+ * its argument if requested
+ *
+ * @param[in]  a            A
+ * @param[in]  transpose_a  Whether to transpose A
+ * @param[in]  b            B
+ * @param[in]  transpose_b  Whether to transpose B
+ *
+ * @tparam     T            Data type
+ *
+ * @return     The product
+ */
+template <typename T>
+Matrix<T> Multiply(MatrixView<const T> a, bool transpose_a,
+                   MatrixView<const T> b, bool transpose_b) {
+  Matrix<T> out_matrix(transpose_a ? a.width : a.height,
+                       transpose_b ? b.height : b.width);
+  Gemm(static_cast<T>(1), a, transpose_a, b, transpose_b, static_cast<T>(0),
+       out_matrix.View());
+  return out_matrix;
+}
+} // namespace detail
+
+/**
+ * @brief      Matrix matrix multiplication
+ *
+ * @param[in]  matrix1  The first matrix
+ * @param[in]  matrix2  The second matrix
  *
  * @tparam     T        Data type
  *
  * @return     The result of the multiplication
  */
 template <typename T>
-Vector<T> operator*(const Vector<T> &vector1, const Vector<T> &vector2) {
-  Vector<T> out_vector(vector1.elements * vector2.elements);
-  return out_vector;
+Matrix<T> operator*(const Matrix<T> &matrix1, const Matrix<T> &matrix2) {
+  return detail::Multiply(matrix1.View(), false, matrix2.View(), false);
 }
 
 /**
- * @brief      Scalar vector multiplication
+ * @brief      Transposed matrix by matrix multiplication, without copying the
+ * transposed matrix
  *
- * @param[in]  scalar  The scalar
- * @param[in]  vector  The vector
+ * @param[in]  matrix1  The first matrix (transposed)
+ * @param[in]  matrix2  The second matrix
  *
- * @tparam     T       Data type
+ * @tparam     T        Data type
  *
  * @return     The result of the multiplication
  */
-template <typename T> Vector<T> operator*(T scalar, const Vector<T> &vector) {
-  Vector<T> out_vector(scalar * vector.elements);
-  return out_vector;
+template <typename T>
+Matrix<T> operator*(const TransposedView<T> &matrix1,
+                    const Matrix<T> &matrix2) {
+  return detail::Multiply(matrix1.matrix, true, matrix2.View(), false);
 }
 
 /**
- * @brief      Scalar-vector broadcast subtraction
+ * @brief      Matrix by transposed matrix multiplication, without copying the
+ * transposed matrix
  *
- * @param[in]  scalar  The scalar
+ * @param[in]  matrix1  The first matrix
+ * @param[in]  matrix2  The second matrix (transposed)
+ *
+ * @tparam     T        Data type
+ *
+ * @return     The result of the multiplication
+ */
+template <typename T>
+Matrix<T> operator*(const Matrix<T> &matrix1,
+                    const TransposedView<T> &matrix2) {
+  return detail::Multiply(matrix1.View(), false, matrix2.matrix, true);
+}
+
+/**
+ * @brief      Transposed matrix vector multiplication, without copying the
+ * transposed matrix
+ *
+ * @param[in]  matrix  The matrix (transposed)
  * @param[in]  vector  The vector
  *
  * @tparam     T       Data type
  *
- * @return     The result of the subtraction
+ * @return     The result of the multiplication
  */
-template <typename T> Vector<T> operator-(T scalar, const Vector<T> &vector) {
-  Vector<T> out_vector(scalar - vector.elements);
+template <typename T>
+Vector<T> operator*(const TransposedView<T> &matrix, const Vector<T> &vector) {
+  assert(vector.length == matrix.width);
+  Vector<T> out_vector(matrix.height);
+  if constexpr (std::is_same_v<T, float>) {
+    kernels::Sgemv(true, matrix.width, matrix.height, 1.f,
+                   matrix.matrix.data(), matrix.matrix.stride, vector.data(),
+                   0.f, out_vector.data());
+    return out_vector;
+  }
+  // Accumulate scaled rows of the original matrix to read it contiguously
+  for (unsigned int i = 0; i < matrix.width; i++) {
+    for (unsigned int j = 0; j < matrix.height; j++) {
+      out_vector[j] += vector[i] * matrix(j, i);
+    }
+  }
   return out_vector;
 }
 
 /**
- * @brief      Scalar matrix multiplication.
+ * @brief      Matrix-vector multiplication by a vector expression, which is
+ * evaluated first
  *
- * @param[in]  scalar  The scalar
- * @param[in]  matrix  The matrix
+ * @param[in]  matrix      The matrix
+ * @param[in]  expression  The vector expression
  *
- * @tparam     T       Data type
+ * @tparam     T           Data type
  *
  * @return     The result of the multiplication
  */
-template <typename T> Matrix<T> operator*(T scalar, const Matrix<T> &matrix) {
-  Matrix<T> out_matrix(matrix.height, matrix.width);
-  for (unsigned int row_idx = 0; row_idx < matrix.height; row_idx++) {
-    out_matrix.rows[row_idx] = scalar * matrix.rows[row_idx];
-  }
-  return out_matrix;
+template <typename T, typename E>
+Vector<T> operator*(const Matrix<T> &matrix,
+                    const VectorExpression<E> &expression) {
+  return matrix * Vector<T>(expression);
 }
 
 /**
- * @brief      Vector addition
+ * @brief      Transposed matrix-vector multiplication by a vector expression,
+ * which is evaluated first
  *
- * @param[in]  vector1  The first vector
- * @param[in]  vector2  The second vector
+ * @param[in]  matrix      The transposed matrix
+ * @param[in]  expression  The vector expression
  *
- * @tparam     T        Data type
+ * @tparam     T           Data type
+ *
+ * @return     The result of the multiplication
+ */
+template <typename T, typename E>
+Vector<T> operator*(const TransposedView<T> &matrix,
+                    const VectorExpression<E> &expression) {
+  return matrix * Vector<T>(expression);
+}
+
+/**
+ * @brief      Multiply the transpose of a matrix by a vector, without copying
+ * the transposed matrix
+ *
+ * @param[in]  matrix  The matrix
+ * @param[in]  vector  The vector
+ *
+ * @tparam     T       Data type
  *
- * @return     The result of the addition
+ * @return     matrix^T * vector
  */
 template <typename T>
-Vector<T> operator+(const Vector<T> &vector1, const Vector<T> &vector2) {
-  assert(vector1.length == vector2.length);
-  Vector<T> out_vector(vector1.elements + vector2.elements);
-  return out_vector;
+Vector<T> MultiplyTransposed(const Matrix<T> &matrix, const Vector<T> &vector) {
+  return matrix.Transposed() * vector;
 }
 
 /**
- * @brief      Vector subtraction
+ * @brief      Multiply the transpose of a matrix by another matrix, without
+ * copying the transposed matrix. This is the batched equivalent of
+ * MultiplyTransposed(matrix, vector), with one vector per column.
  *
- * @param[in]  vector1  The first vector
- * @param[in]  vector2  The second vector
+ * @param[in]  matrix1  The matrix to transpose
+ * @param[in]  matrix2  The other matrix
  *
  * @tparam     T        Data type
  *
- * @return     The result of the subtraction
+ * @return     matrix1^T * matrix2
  */
 template <typename T>
-Vector<T> operator-(const Vector<T> &vector1, const Vector<T> &vector2) {
-  assert(vector1.length == vector2.length);
-  Vector<T> out_vector(vector1.elements - vector2.elements);
-  return out_vector;
+Matrix<T> MultiplyTransposed(const Matrix<T> &matrix1,
+                             const Matrix<T> &matrix2) {
+  return matrix1.Transposed() * matrix2;
 }
 
 /**
- * @brief      Vector negation
+ * @brief      Sum of the rows of a matrix
  *
- * @param[in]  vector  The vector
+ * @param[in]  matrix  The matrix
  *
  * @tparam     T       Data type
  *
- * @return     The result of the negation
+ * @return     Vector of length matrix.width holding the sum of every row
  */
-template <typename T> Vector<T> operator-(const Vector<T> &vector) {
-  Vector<T> out_vector(-vector.elements);
+template <typename T> Vector<T> SumRows(const Matrix<T> &matrix) {
+  Vector<T> out_vector(matrix.width);
+  for (unsigned int i = 0; i < matrix.height; i++) {
+    const T *row = matrix.data() + i * matrix.stride;
+    for (unsigned int j = 0; j < matrix.width; j++) {
+      out_vector[j] += row[j];
+    }
+  }
   return out_vector;
 }
 
+/**
+ * @brief      Sum of the rows of a matrix, written into an existing vector
+ *
+ * @param[in]  matrix      The matrix
+ * @param      out_vector  Vector of length matrix.width for the result
+ *
+ * @tparam     T           Data type
+ */
+template <typename T>
+void SumRows(MatrixView<const detail::NonDeduced<T>> matrix,
+             Vector<T> &out_vector) {
+  assert(matrix.width == out_vector.length);
+  std::fill(out_vector.begin(), out_vector.end(), static_cast<T>(0));
+  for (unsigned int i = 0; i < matrix.height; i++) {
+    const T *row = matrix.Row(i).data();
+    for (unsigned int j = 0; j < matrix.width; j++) {
+      out_vector[j] += row[j];
+    }
+  }
+}
+
+/**
+ * @brief      Add a scaled matrix to another without a temporary,
+ * matrix += scalar * other
+ *
+ * @param      matrix  The matrix to add to
+ * @param[in]  scalar  The scalar
+ * @param[in]  other   The other matrix
+ *
+ * @tparam     T       Data type
+ */
+template <typename T>
+void AddScaled(Matrix<T> &matrix, T scalar, const Matrix<T> &other) {
+  assert(matrix.height == other.height);
+  assert(matrix.width == other.width);
+  T *data = matrix.data();
+  const T *other_data = other.data();
+  for (std::size_t i = 0; i < matrix.size(); i++) {
+    data[i] += scalar * other_data[i];
+  }
+}
+
+/**
+ * @brief      Add a scaled vector to another without a temporary,
+ * vector += scalar * other
+ *
+ * @param      vector  The vector to add to
+ * @param[in]  scalar  The scalar
+ * @param[in]  other   The other vector
+ *
+ * @tparam     T       Data type
+ */
+template <typename T>
+void AddScaled(Vector<T> &vector, T scalar, const Vector<T> &other) {
+  assert(vector.length == other.length);
+  for (unsigned int i = 0; i < vector.length; i++) {
+    vector[i] += scalar * other[i];
+  }
+}
+
 } // namespace nn
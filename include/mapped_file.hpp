@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nn {
+
+/**
+ * @brief      This class describes a whole file mapped read-only into memory.
+ * Nothing is read until it is touched, and the pages are shared with the
+ * operating system's file cache. The mapping starts on a page boundary, so
+ * data at an aligned offset in the file is aligned in memory too.
+ *
+ * Throws std::runtime_error if the file can't be opened or mapped.
+ */
+class MappedFile {
+public:
+  /**
+   * @brief      Map a file
+   *
+   * @param[in]  path  The path of the file
+   */
+  explicit MappedFile(const std::string &path);
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile &operator=(MappedFile &&) = delete;
+  ~MappedFile();
+  /**
+   * @brief      The contents of the file
+   */
+  const std::uint8_t *data() const {
+    return static_cast<const std::uint8_t *>(mapping_);
+  }
+  /**
+   * @brief      The size of the file in bytes
+   */
+  std::size_t size() const { return size_; }
+
+private:
+  void *mapping_;
+  std::size_t size_;
+};
+
+/**
+ * @brief      Write a file from a sequence of blocks of bytes, through a
+ * temporary file which is then renamed over the path, so that a process
+ * opening the path sees either the old file or the whole new one. Throws
+ * std::runtime_error if the file can't be written.
+ *
+ * @param[in]  path    The path of the file
+ * @param[in]  blocks  The blocks, as pointers and sizes in bytes
+ */
+void WriteFileAtomically(
+    const std::string &path,
+    const std::vector<std::pair<const void *, std::size_t>> &blocks);
+
+} // namespace nn
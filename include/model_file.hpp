@@ -0,0 +1,103 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dataset.hpp"
+#include "kernels.hpp"
+#include "linear_algebra.hpp"
+#include "mapped_file.hpp"
+
+namespace nn {
+
+// Version of the model file format, incremented on incompatible changes
+constexpr std::uint32_t kModelFileVersion = 1;
+
+/**
+ * @brief      Fixed-size header at the start of a model file. Every field is
+ * stored in the byte order of the machine that wrote the file, which
+ * byte_order identifies.
+ */
+struct ModelFileHeader {
+  char magic[8];              // "NNMODEL" and a zero byte
+  std::uint32_t version;      // kModelFileVersion
+  std::uint32_t byte_order;   // 0x01020304 as written
+  std::uint32_t dtype;        // Element type of the parameters, 0 for float32
+  std::uint32_t n_layers;     // Number of weight layers
+  std::uint64_t parameters_offset; // In bytes, a multiple of kAlignment
+  std::uint64_t n_parameters;      // In elements
+  // 64-bit FNV-1a hash of the rest of the file, after the header
+  std::uint64_t checksum;
+  std::uint8_t reserved[16];
+};
+static_assert(sizeof(ModelFileHeader) == kAlignment,
+              "the layer table starts on a cache line");
+
+/**
+ * @brief      Description of a weight layer in a model file, which follows
+ * the header once per layer. The weights are n_outputs rows of n_inputs
+ * elements, stride elements apart, and the biases are n_outputs elements.
+ * Offsets are in elements from the start of the parameters, and multiples of
+ * a cache line.
+ */
+struct ModelFileLayer {
+  std::uint32_t n_inputs;
+  std::uint32_t n_outputs;
+  std::uint32_t stride;
+  std::uint32_t activation; // kernels::Activation
+  std::uint64_t weights_offset;
+  std::uint64_t biases_offset;
+};
+static_assert(sizeof(ModelFileLayer) == 32, "the layer table is packed");
+
+/**
+ * @brief      This class describes a memory-mapped model file: a
+ * ModelFileHeader, the table of layers, and the parameters, which start on a
+ * cache line. The file is validated once when it is opened, and the
+ * parameters are then used in place, with no parsing or copying: opening a
+ * model costs little more than the page faults of its first use.
+ *
+ * Throws std::runtime_error if the file can't be mapped or isn't a valid
+ * model file for this machine.
+ */
+class ModelFile {
+public:
+  /**
+   * @brief      Map and validate a file
+   *
+   * @param[in]  path             The path of the file
+   * @param[in]  verify_checksum  Whether to check the checksum, which reads
+   * the whole file
+   */
+  explicit ModelFile(const std::string &path, bool verify_checksum = true);
+  /**
+   * @brief      Write a model file
+   *
+   * @param[in]  path          The path of the file
+   * @param[in]  layers        The layers
+   * @param[in]  parameters    The parameters, laid out as the layers describe
+   * @param[in]  n_parameters  The number of parameters
+   */
+  static void Write(const std::string &path,
+                    const std::vector<ModelFileLayer> &layers,
+                    const NNType *parameters, std::size_t n_parameters);
+  const std::vector<ModelFileLayer> &layers() const { return layers_; }
+  /**
+   * @brief      The size of every layer, the inputs first
+   */
+  std::vector<unsigned int> layer_sizes() const;
+  /**
+   * @brief      The parameters, aligned to kAlignment bytes
+   */
+  const NNType *parameters() const { return parameters_; }
+  std::size_t n_parameters() const { return n_parameters_; }
+
+private:
+  MappedFile file_;
+  std::vector<ModelFileLayer> layers_;
+  const NNType *parameters_;
+  std::size_t n_parameters_;
+};
+
+} // namespace nn
@@ -1,20 +1,27 @@
 #pragma once
+#include <cassert>
+#include <functional>
+#include <cstddef>
+#include <memory>
 #include <optional>
+#include <random>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include "dataset.hpp"
 #include "linear_algebra.hpp"
+#include "optimizer.hpp"
+#include "prefetcher.hpp"
+#include "sparse_matrix.hpp"
+#include "telemetry.hpp"
+#include "transfer_functions.hpp"
+#include "transport.hpp"
 
 namespace nn {
 
-using NNType = float;
-
-// input and ground truth (one-hot) output
-using Example = std::pair<Vector<NNType>, Vector<NNType>>;
-using AnnotatedData = std::vector<Example>;
 using Weights = std::vector<Matrix<NNType>>;
 using Biases = std::vector<Vector<NNType>>;
-using DeltaNablaBAndW = std::pair<Biases, Weights>;
 
 /**
  * @brief      Convert index value to "one-hot" vector
@@ -32,7 +39,7 @@ Vector<NNType> IndexToOneHot(unsigned int index, unsigned int n_indexes);
  *
  * @return     Index
  */
-unsigned int OneHotToIndex(Vector<NNType> one_hot_vector);
+unsigned int OneHotToIndex(const Vector<NNType> &one_hot_vector);
 /**
  * @brief      Gets the index of the maximum element.
  *
@@ -40,7 +47,137 @@ unsigned int OneHotToIndex(Vector<NNType> one_hot_vector);
  *
  * @return     The index of the maximum element.
  */
-unsigned int GetMaxIndex(Vector<NNType> vector);
+unsigned int GetMaxIndex(const Vector<NNType> &vector);
+
+/**
+ * @brief      Storage format of the weights read by the forward and backward
+ * passes. Training always updates a single precision master copy of the
+ * weights, which is converted after every update. The half precision formats
+ * halve the memory traffic of reading the weights, while the products are
+ * still computed and summed in single precision.
+ */
+enum class WeightStorage { kFloat32, kFloat16, kBFloat16 };
+
+// Default of Network::SetSparseInputDensity, below which the sparse first
+// layer kernels beat the blocked dense products on the weight gradients
+constexpr double kDefaultSparseInputDensity = 0.05;
+
+class CheckpointWriter;
+class InferenceModel;
+class QuantizedModel;
+class ThreadPool;
+struct TrainingState;
+
+/**
+ * @brief      This class describes the buffers needed to train on, or feed
+ * forward, a batch of examples. Everything is allocated once, sized from the
+ * layer sizes and the largest batch, and reused for every batch, so that a
+ * training step makes no heap allocations. Each matrix has one row per
+ * example, and a batch smaller than max_batch_size uses the top rows.
+ */
+class Workspace {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  layer_sizes     The layer sizes of the network
+   * @param[in]  max_batch_size  The maximum number of examples in a batch
+   */
+  Workspace(const std::vector<unsigned int> &layer_sizes,
+            unsigned int max_batch_size);
+
+  const unsigned int max_batch_size;
+  // Examples assembled from a data set, when they don't come from elsewhere
+  // (such as a Prefetcher)
+  Batch batch;
+  // Activations of every layer after the first (the inputs)
+  std::vector<Matrix<NNType>> activations;
+  // Errors (dC/dz) of every layer after the first
+  std::vector<Matrix<NNType>> deltas;
+  // The inputs of the batch being fed forward in CSR format, if they are
+  // sparse enough for the sparse first layer kernels (see
+  // Network::SetSparseInputDensity)
+  CsrMatrix<NNType> sparse_inputs;
+  bool inputs_are_sparse = false;
+  // Gradients, summed over the batch
+  Biases nabla_b;
+  Weights nabla_w;
+  // Quadratic cost summed over the last batch trained on, and the number of
+  // its examples classified correctly (or, after an evaluation, the number
+  // of the examples this workspace evaluated that were)
+  double loss = 0;
+  unsigned int n_correct = 0;
+  // The same, summed over the mini-batches of an epoch of Hogwild training
+  double epoch_loss = 0;
+  unsigned int epoch_n_correct = 0;
+  // Time spent in each phase, added to by the scoped timers
+  PhaseTimes phase_times;
+};
+
+/**
+ * @brief      Options for training with Network::Sgd
+ */
+struct TrainingOptions {
+  // Number of threads each mini-batch is split across, 0 meaning one per
+  // hardware thread. Every thread computes the gradients of its share of the
+  // mini-batch, and these are summed with a tree reduction, so the result
+  // matches single-threaded training to within floating point rounding.
+  unsigned int n_threads = 1;
+  // Asynchronous "Hogwild!" training (Niu et al., 2011): instead of
+  // splitting each mini-batch, every thread takes whole mini-batches from a
+  // shared lock-free queue and applies its update straight to the shared
+  // weights and biases with no locking. Updates from different threads can
+  // interleave and overwrite each other, and this data race is deliberate;
+  // with sparse enough gradients it costs little accuracy and removes all
+  // synchronisation between mini-batches. Results are not reproducible.
+  bool hogwild = false;
+  // Seed for shuffling the training data each epoch (time-based if unset)
+  std::optional<unsigned int> seed;
+  // Number of mini-batches assembled ahead of training by background
+  // producer threads (see Prefetcher), e.g. 2 for double buffering. 0
+  // assembles every mini-batch on the training threads when it is needed.
+  // The mini-batches and the results are the same either way.
+  unsigned int prefetch_depth = 2;
+  // Number of producer threads, if prefetch_depth isn't 0
+  unsigned int n_prefetch_threads = 1;
+  // If not null, set to the prefetcher's counters when training finishes,
+  // to show whether training was waiting for its input
+  PrefetchStats *prefetch_stats = nullptr;
+  // If not empty, a checkpoint file (see SaveCheckpoint) that training
+  // overwrites at the end of every epoch and every checkpoint_interval
+  // mini-batches, for Network::ResumeSgd to continue from if the job is
+  // stopped. The state is copied between mini-batches and written by a
+  // background thread; a mid-epoch checkpoint is skipped if the previous one
+  // is still being written.
+  std::string checkpoint_path;
+  // Number of mini-batches between checkpoints, 0 meaning only at the end of
+  // every epoch. Hogwild training only checkpoints at the end of epochs.
+  unsigned int checkpoint_interval = 0;
+  // If set, called after every training step with its progress, on the
+  // thread that called Sgd. Hogwild training doesn't call it, as its steps
+  // run concurrently.
+  std::function<void(const MiniBatchReport &)> on_mini_batch;
+  // If set, called after every epoch with its progress. Otherwise the test
+  // accuracy (or the end of the epoch) is logged, see SetLogSink.
+  std::function<void(const EpochReport &)> on_epoch;
+  // Rule applying the gradients of every mini-batch, plain gradient descent
+  // by default. Its state is allocated once per job, updated in place, and
+  // saved in checkpoints.
+  OptimizerOptions optimizer;
+  // If not null, synchronous data parallel training over the processes of
+  // the transport's ring. Every process calls Sgd with the same arguments
+  // and training data, and its own rank's transport. A step then trains on
+  // size * mini_batch_size examples, each process taking mini_batch_size of
+  // them, and their gradients are summed with AllReduceSum before every
+  // process applies the same update. This matches single-process training
+  // with the larger mini-batch, to within floating point rounding, and the
+  // number of examples must be a multiple of it. Rank 0's weights, biases
+  // and shuffle seed are broadcast to the others at the start, so they don't
+  // have to be initialised alike. Only rank 0 writes checkpoints, and every
+  // rank resumes from the same one. Sgd throws std::invalid_argument if
+  // hogwild is also set, as Hogwild updates aren't synchronised.
+  Transport *transport = nullptr;
+};
 
 /**
  * @brief      This interface class describes a network. It contains pure
@@ -54,6 +191,7 @@ public:
    * @param[in]  layer_sizes  The layer sizes
    */
   Network(std::vector<unsigned int> layer_sizes);
+  virtual ~Network();
   /**
    * @brief      Feed forward
    *
@@ -62,6 +200,69 @@ public:
    * @return     The network output
    */
   Vector<NNType> FeedForward(Vector<NNType> input);
+  /**
+   * @brief      Feed forward a batch of inputs with matrix-matrix products,
+   * in chunks split across threads. The threads are kept for later calls
+   * with the same number of threads (and shared with Evaluate).
+   *
+   * @param[in]  inputs     The inputs, one per row
+   * @param[in]  n_threads  The number of threads, 0 meaning one per hardware
+   * thread
+   *
+   * @return     The network outputs, one per row
+   */
+  Matrix<NNType> FeedForwardBatch(MatrixView<const NNType> inputs,
+                                  unsigned int n_threads = 1);
+  /**
+   * @brief      Count the examples of a data set that the network classifies
+   * correctly, i.e. whose largest output is at the label (or the largest
+   * ground truth value). The data set is fed forward in chunks split across
+   * threads, which are kept as for FeedForwardBatch.
+   *
+   * @param[in]  test_data  The test data
+   * @param[in]  n_threads  The number of threads, 0 meaning one per hardware
+   * thread
+   *
+   * @return     The number of correctly classified examples
+   */
+  unsigned int Evaluate(const Dataset &test_data, unsigned int n_threads = 1);
+  /**
+   * @brief      Choose the storage format of the weights used by
+   * FeedForward, FeedForwardBatch, Evaluate and Sgd (see WeightStorage)
+   *
+   * @param[in]  storage  The storage format
+   */
+  void SetWeightStorage(WeightStorage storage);
+  WeightStorage weight_storage() const { return weight_storage_; }
+  /**
+   * @brief      Choose when the first layer uses the sparse kernels: the
+   * inputs of a batch with at most max_density of its values non-zero are
+   * converted to CSR format, and the first layer's forward product and
+   * weight gradients then only touch the columns of its weights at non-zero
+   * inputs. The sparse forward product reads the single precision weights,
+   * whatever the WeightStorage. 0 always uses the dense products.
+   *
+   * @param[in]  max_density  The largest fraction of non-zero inputs
+   */
+  void SetSparseInputDensity(double max_density);
+  double sparse_input_density() const { return sparse_input_density_; }
+  /**
+   * @brief      Save the weights and biases to a model file (see ModelFile),
+   * which InferenceModel can serve straight from the mapped file. Throws
+   * std::runtime_error if the file can't be written.
+   *
+   * @param[in]  path  The path of the file
+   */
+  void Save(const std::string &path) const;
+  /**
+   * @brief      Load the weights and biases from a model file saved from a
+   * network with the same layer sizes and activations, e.g. to continue
+   * training. Throws std::runtime_error if the file isn't a valid model file
+   * or is for a different network.
+   *
+   * @param[in]  path  The path of the file
+   */
+  void Load(const std::string &path);
   /**
    * @brief      Stochastic gradient descent
    *
@@ -70,45 +271,397 @@ public:
    * @param[in]  mini_batch_size  The mini batch size
    * @param[in]  eta              The learning rate, eta
    * @param[in]  test_data        The optional test data
+   * @param[in]  options          The training options
+   */
+  void Sgd(const AnnotatedData &training_data, unsigned int epochs,
+           unsigned int mini_batch_size, NNType eta,
+           std::optional<std::reference_wrapper<const AnnotatedData>>
+               test_data = std::nullopt,
+           const TrainingOptions &options = TrainingOptions());
+  /**
+   * @brief      Stochastic gradient descent on data sets in any storage
+   * format. Examples are read from the data sets as mini-batches are
+   * assembled.
+   *
+   * @param[in]  training_data    The training data
+   * @param[in]  epochs           The number of epochs
+   * @param[in]  mini_batch_size  The mini batch size
+   * @param[in]  eta              The learning rate, eta
+   * @param[in]  test_data        The optional test data (may be nullptr)
+   * @param[in]  options          The training options
    */
-  void Sgd(AnnotatedData training_data, unsigned int epochs,
+  void Sgd(const Dataset &training_data, unsigned int epochs,
            unsigned int mini_batch_size, NNType eta,
-           std::optional<AnnotatedData> test_data = std::nullopt);
+           const Dataset *test_data = nullptr,
+           const TrainingOptions &options = TrainingOptions());
+  /**
+   * @brief      Continue stochastic gradient descent from a checkpoint written
+   * by Sgd (see TrainingOptions::checkpoint_path), restoring the weights,
+   * biases, shuffle order and position in the epoch. Given the same training
+   * data, learning rate and number of threads as the interrupted job, and
+   * synchronous training, the result is bit-identical to a job that was
+   * never stopped. Throws std::runtime_error if the checkpoint isn't valid or
+   * is for a different network, training set or optimizer type.
+   *
+   * @param[in]  checkpoint_path  The path of the checkpoint file
+   * @param[in]  training_data    The training data
+   * @param[in]  epochs           The total number of epochs of the job,
+   * including those done before the checkpoint
+   * @param[in]  eta              The learning rate, eta
+   * @param[in]  test_data        The optional test data (may be nullptr)
+   * @param[in]  options          The training options (the seed is unused)
+   */
+  void ResumeSgd(const std::string &checkpoint_path,
+                 const Dataset &training_data, unsigned int epochs,
+                 NNType eta, const Dataset *test_data = nullptr,
+                 const TrainingOptions &options = TrainingOptions());
 
 private:
-  void UpdateMiniBatch_(AnnotatedData mini_batch, NNType eta);
-  DeltaNablaBAndW Backprop_(Example example);
-  static Vector<NNType> CostDerivative_(Vector<NNType> output,
-                                        Vector<NNType> ground_truth);
-  unsigned int Evaluate_(AnnotatedData test_data);
-  virtual Vector<NNType> Nonlinearity_(Vector<NNType> weighted_inputs) = 0;
-  virtual Vector<NNType> NonlinearityPrime_(Vector<NNType> weighted_inputs) = 0;
+  /**
+   * @brief      Stochastic gradient descent, from the start or from a
+   * training state
+   *
+   * @param[in]  resume  The state to continue from, or nullptr to start
+   * from the current weights and biases
+   */
+  void Sgd_(const Dataset &training_data, unsigned int epochs,
+            unsigned int mini_batch_size, NNType eta,
+            const Dataset *test_data, const TrainingOptions &options,
+            const TrainingState *resume);
+  /**
+   * @brief      Copy the training state to a checkpoint writer, unless it is
+   * busy writing the previous checkpoint
+   */
+  void Checkpoint_(CheckpointWriter &writer, unsigned int mini_batch_size,
+                   unsigned int epoch_idx, unsigned int mini_batch_idx,
+                   const std::vector<unsigned int> &permutation,
+                   const std::default_random_engine &shuffle_engine,
+                   const Optimizer &optimizer) const;
+  void UpdateMiniBatch_(const MiniBatch &mini_batch, NNType eta,
+                        Optimizer &optimizer, Transport *transport,
+                        ThreadPool &thread_pool, MiniBatchReport &report);
+  void UpdateMiniBatch_(const BatchView &batch, NNType eta,
+                        Optimizer &optimizer, Transport *transport,
+                        ThreadPool &thread_pool, MiniBatchReport &report);
+  /**
+   * @brief      Split a mini-batch into one contiguous shard per thread, run
+   * shard_gradients(begin, end, workspace) for every shard, sum the gradients
+   * (and those of the other processes, if there is a transport) and apply
+   * them. The loss, accuracy and phase times of the step are added to the
+   * report.
+   */
+  template <typename ShardGradients>
+  void UpdateShards_(unsigned int batch_size, ShardGradients &&shard_gradients,
+                     NNType eta, Optimizer &optimizer, Transport *transport,
+                     ThreadPool &thread_pool, MiniBatchReport &report);
+  /**
+   * @brief      Sum the gradients in the first workspace, the loss and the
+   * number of correct examples over the processes of a ring, packed into one
+   * array so that a step takes a single AllReduceSum
+   */
+  void AllReduceGradients_(Transport &transport, double &loss,
+                           unsigned int &n_correct);
+  /**
+   * @brief      Copy rank 0's weights and biases to the other processes of a
+   * ring
+   */
+  void BroadcastParameters_(Transport &transport);
+  /**
+   * @brief      Train on consecutive mini-batches asynchronously, see
+   * TrainingOptions::hogwild
+   *
+   * @param[in]  epoch_data       The examples of the epoch, in order
+   * @param[in]  mini_batch_size  The mini batch size
+   * @param[in]  eta              The learning rate, eta
+   * @param      optimizer        The optimizer, shared by the threads
+   * @param      thread_pool      The thread pool
+   * @param      prefetcher       The prefetcher producing the mini-batches,
+   * or nullptr to assemble them on the training threads
+   * @param      report           The report of the epoch, whose loss and
+   * accuracy the summed loss and the number of correct examples are added
+   * to, and whose phase times the mean over the threads is added to
+   */
+  void UpdateMiniBatchesHogwild_(const MiniBatch &epoch_data,
+                                 unsigned int mini_batch_size, NNType eta,
+                                 Optimizer &optimizer, ThreadPool &thread_pool,
+                                 Prefetcher *prefetcher, EpochReport &report);
+  /**
+   * @brief      Optimizer step, applying the gradients in the workspace,
+   * summed over batch_size examples, to the weights and biases
+   */
+  void ApplyGradients_(const Workspace &workspace, NNType eta,
+                       unsigned int batch_size, Optimizer &optimizer);
+  /**
+   * @brief      Convert the master weights of a layer to the half precision
+   * copy used by the passes, if the storage isn't single precision
+   */
+  void StoreWeights_(unsigned int layer_idx);
+  /**
+   * @brief      Make sure there are at least n_workspaces workspaces that fit
+   * max_batch_size examples, only allocating if the current ones don't
+   */
+  void ReserveWorkspaces_(unsigned int n_workspaces,
+                          unsigned int max_batch_size);
+  /**
+   * @brief      Gradients summed over a mini-batch, which are left in the
+   * workspace's nabla_b and nabla_w. The examples are assembled in the
+   * workspace's batch.
+   *
+   * @param[in]  mini_batch  The mini batch
+   * @param      workspace   The workspace
+   */
+  void ComputeGradients_(const MiniBatch &mini_batch, Workspace &workspace);
+  unsigned int Evaluate_(const Dataset &test_data, ThreadPool &thread_pool);
+  /**
+   * @brief      The thread pool of FeedForwardBatch and Evaluate, created on
+   * first use and again only when the number of threads changes, so that
+   * repeated calls don't start and join threads
+   *
+   * @param[in]  n_threads  The number of threads, as for ThreadPool
+   */
+  ThreadPool &InferenceThreadPool_(unsigned int n_threads);
+  /**
+   * @brief      Split n_examples into chunks that fit a workspace and run
+   * chunk(begin, end, workspace) for each, on every thread of the pool with
+   * one workspace per thread
+   */
+  template <typename Chunk>
+  void ForEachChunk_(unsigned int n_examples, Chunk &&chunk,
+                     ThreadPool &thread_pool);
+  /**
+   * @brief      Feed forward a batch of inputs, one per row, filling the
+   * activations of every layer. Each layer's weighted inputs are written
+   * straight into its activations and then activated in place, so they are
+   * never stored separately.
+   *
+   * @param[in]  inputs     The inputs
+   * @param      workspace  The workspace
+   */
+  virtual void FeedForward_(MatrixView<const NNType> inputs,
+                            Workspace &workspace) = 0;
+  /**
+   * @brief      Backpropagation of a whole batch at once, with one example
+   * per row so that every layer is computed with matrix-matrix products.
+   * The gradients summed over the batch are written to the workspace's
+   * nabla_b and nabla_w.
+   *
+   * @param[in]  batch      The batch
+   * @param      workspace  The workspace
+   */
+  virtual void Backprop_(const BatchView &batch, Workspace &workspace) = 0;
+  /**
+   * @brief      The activation function of a layer, as a fused kernel
+   *
+   * @param[in]  layer_idx  The layer index (0 is the first weight layer)
+   */
+  virtual kernels::Activation LayerActivation_(unsigned int layer_idx) const = 0;
+  std::vector<Workspace> workspaces_; // one per training thread
+  std::unique_ptr<ThreadPool> inference_thread_pool_;
+  unsigned int inference_n_threads_ = 0; // as requested, 0 or more
+  // The packed array of AllReduceGradients_, and room for a chunk of it
+  std::vector<NNType> all_reduce_data_;
+  std::vector<NNType> all_reduce_buffer_;
+  WeightStorage weight_storage_ = WeightStorage::kFloat32;
+  // The weights as stored for the passes, for half precision storage
+  std::vector<Matrix<Float16>> float16_weights_;
+  std::vector<Matrix<BFloat16>> bfloat16_weights_;
+  friend class InferenceModel;
+  friend class QuantizedModel;
+
+protected:
+  /**
+   * @brief      Derivative of the quadratic cost with respect to the outputs
+   * of a batch in the workspace, written to its last deltas. With labels,
+   * the one-hot ground truth is subtracted by decrementing one element per
+   * row. The cost itself and the number of correct examples are set in the
+   * workspace's loss and n_correct.
+   */
+  static void CostDerivative_(const BatchView &batch, Workspace &workspace);
+  /**
+   * @brief      Product of a matrix and the weights of a layer as stored (see
+   * WeightStorage), c = a * op(W)
+   *
+   * @param[in]  layer_idx          The layer index (0 is the first weight
+   * layer)
+   * @param[in]  a                  A
+   * @param[in]  transpose_weights  Whether op(W) = W^T
+   * @param[out] c                  C
+   */
+  void MultiplyByWeights_(unsigned int layer_idx, MatrixView<const NNType> a,
+                          bool transpose_weights, MatrixView<NNType> c) const;
+  /**
+   * @brief      Weighted inputs of a layer before the biases,
+   * c = inputs * W^T. The network inputs of the first layer go through the
+   * sparse kernels if they are sparse enough (see SetSparseInputDensity),
+   * and are kept in the workspace for WeightGradients_.
+   *
+   * @param[in]  layer_idx     The layer index (0 is the first weight layer)
+   * @param[in]  layer_inputs  The inputs of the layer
+   * @param      workspace     The workspace
+   * @param[out] c             C
+   */
+  void MultiplyLayerInputs_(unsigned int layer_idx,
+                            MatrixView<const NNType> layer_inputs,
+                            Workspace &workspace, MatrixView<NNType> c) const;
+  /**
+   * @brief      Gradients of the weights of a layer summed over a batch,
+   * nabla_w = delta^T * inputs, written to the workspace's nabla_w. Uses
+   * the sparse kernels for inputs MultiplyLayerInputs_ found sparse.
+   *
+   * @param[in]  layer_idx     The layer index (0 is the first weight layer)
+   * @param[in]  delta         The errors of the layer
+   * @param[in]  layer_inputs  The inputs of the layer
+   * @param      workspace     The workspace
+   */
+  static void WeightGradients_(unsigned int layer_idx,
+                               MatrixView<const NNType> delta,
+                               MatrixView<const NNType> layer_inputs,
+                               Workspace &workspace);
   const std::vector<unsigned int> layer_sizes_;
   const unsigned int num_layers_;
   Weights weights_;
   Biases biases_;
+  double sparse_input_density_ = kDefaultSparseInputDensity;
 };
 
 /**
- * @brief      This class describes a network with sigmoid nonlinearities.
+ * @brief      This class describes a network whose activation functions are
+ * chosen at compile time, so that the forward and backward passes call the
+ * fused activation kernels directly instead of through a virtual function per
+ * layer. Network is its type-erased interface.
+ *
+ * Each activation policy (e.g. SigmoidActivation, ReluActivation) is used for
+ * one layer, counting back from the output layer. Any earlier layers use the
+ * first policy, so BasicNetwork<SigmoidActivation> has sigmoids everywhere
+ * and BasicNetwork<ReluActivation, SigmoidActivation> has ReLU hidden layers
+ * and a sigmoid output layer, whatever the depth.
+ *
+ * @tparam     Activations  The activation policies
  */
-class SigmoidNetwork : public Network {
+template <typename... Activations> class BasicNetwork : public Network {
+  static_assert(sizeof...(Activations) > 0,
+                "a network needs at least one activation policy");
+
 public:
-  using Network::Network;
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  layer_sizes  The layer sizes, with at least one weight layer
+   * per activation policy
+   */
+  BasicNetwork(std::vector<unsigned int> layer_sizes)
+      : Network(std::move(layer_sizes)) {
+    assert(num_layers_ - 1 >= sizeof...(Activations));
+  }
+
 private:
-  virtual Vector<NNType> Nonlinearity_(Vector<NNType> weighted_inputs) override;
-  virtual Vector<NNType> NonlinearityPrime_(Vector<NNType> weighted_inputs) override;
+  void FeedForward_(MatrixView<const NNType> inputs,
+                    Workspace &workspace) override {
+    // A layer's weighted inputs are activations * weights^T + biases
+    const unsigned int batch_size = inputs.height;
+    for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1;
+         layer_idx++) {
+      const auto outputs = workspace.activations[layer_idx].Block(
+          0, 0, batch_size, layer_sizes_[layer_idx + 1]);
+      MultiplyLayerInputs_(layer_idx,
+                           LayerInputs_(layer_idx, inputs, workspace),
+                           workspace, outputs);
+      WithActivation_(layer_idx, [&](auto activation) {
+        decltype(activation)::Activate(biases_[layer_idx], outputs);
+      });
+    }
+  }
+
+  void Backprop_(const BatchView &batch, Workspace &workspace) override {
+    // The gradients are summed over the batch by the products
+    // delta^T * activations (weights) and the column sums of delta (biases)
+    {
+      NN_TIME_PHASE(workspace.phase_times, Phase::kForward);
+      FeedForward_(batch.inputs, workspace);
+    }
+    const auto block = [&batch](Matrix<NNType> &matrix) {
+      return matrix.Block(0, 0, batch.size, matrix.width);
+    };
+
+    // Backward pass, from the last layer to the first
+    NN_TIME_PHASE(workspace.phase_times, Phase::kBackward);
+    CostDerivative_(batch, workspace);
+    WithActivation_(num_layers_ - 2, [&](auto activation) {
+      decltype(activation)::MultiplyPrime(block(workspace.activations.back()),
+                                          block(workspace.deltas.back()));
+    });
+    for (int layer_idx = num_layers_ - 2; layer_idx >= 0; layer_idx--) {
+      const auto delta = block(workspace.deltas[layer_idx]);
+      SumRows(delta, workspace.nabla_b[layer_idx]);
+      WeightGradients_(layer_idx, delta,
+                       LayerInputs_(layer_idx, batch.inputs, workspace),
+                       workspace);
+      if (layer_idx > 0) {
+        const auto previous_delta = block(workspace.deltas[layer_idx - 1]);
+        MultiplyByWeights_(layer_idx, delta, false, previous_delta);
+        WithActivation_(layer_idx - 1, [&](auto activation) {
+          decltype(activation)::MultiplyPrime(
+              block(workspace.activations[layer_idx - 1]), previous_delta);
+        });
+      }
+    }
+  }
+
+  kernels::Activation LayerActivation_(unsigned int layer_idx) const override {
+    kernels::Activation kernel_activation{};
+    WithActivation_(layer_idx, [&](auto activation) {
+      kernel_activation = decltype(activation)::kKernel;
+    });
+    return kernel_activation;
+  }
+
+  /**
+   * @brief      The inputs of a layer: the network inputs for the first, and
+   * the activations of the one before for the others
+   */
+  MatrixView<const NNType> LayerInputs_(unsigned int layer_idx,
+                                        MatrixView<const NNType> inputs,
+                                        const Workspace &workspace) const {
+    if (layer_idx == 0) {
+      return inputs;
+    }
+    return workspace.activations[layer_idx - 1].Block(
+        0, 0, inputs.height, layer_sizes_[layer_idx]);
+  }
+
+  /**
+   * @brief      Call function with a default-constructed instance of the
+   * activation policy of a layer. Every policy gets its own instantiation of
+   * the function, so the policy is known at compile time inside it.
+   *
+   * @param[in]  layer_idx  The layer index (0 is the first weight layer)
+   * @param      function   The function
+   */
+  template <typename Function>
+  void WithActivation_(unsigned int layer_idx, Function &&function) const {
+    const unsigned int n_leading_layers =
+        num_layers_ - 1 - sizeof...(Activations);
+    const unsigned int policy_idx =
+        layer_idx < n_leading_layers ? 0 : layer_idx - n_leading_layers;
+    WithActivation_(policy_idx, function,
+                    std::index_sequence_for<Activations...>());
+  }
+  template <typename Function, std::size_t... kPolicyIdxs>
+  static void WithActivation_(unsigned int policy_idx, Function &function,
+                              std::index_sequence<kPolicyIdxs...>) {
+    ((policy_idx == kPolicyIdxs ? (function(Activations()), true) : false) ||
+     ...);
+  }
 };
 
 /**
- * @brief      This class describes a network with ReLU nonlinearities.
+ * @brief      Network with sigmoid nonlinearities.
  */
-class ReluNetwork : public Network {
-public:
-  using Network::Network;
-private:
-  virtual Vector<NNType> Nonlinearity_(Vector<NNType> weighted_inputs) override;
-  virtual Vector<NNType> NonlinearityPrime_(Vector<NNType> weighted_inputs) override;
-};
+using SigmoidNetwork = BasicNetwork<SigmoidActivation>;
+
+/**
+ * @brief      Network with ReLU nonlinearities.
+ */
+using ReluNetwork = BasicNetwork<ReluActivation>;
 
 } // namespace nn
\ No newline at end of file
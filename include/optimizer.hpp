@@ -0,0 +1,132 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "dataset.hpp"
+#include "linear_algebra.hpp"
+
+namespace nn {
+
+/**
+ * @brief      Rule that turns the gradients of a mini-batch into an update
+ * of the parameters
+ */
+enum class OptimizerType : std::uint32_t {
+  kSgd,      // plain gradient descent, P -= eta * g
+  kMomentum, // heavy ball momentum, V = mu * V - eta * g and P += V
+  kNesterov, // Nesterov momentum, as in Sutskever et al. (2013)
+  kAdam,     // Adam (Kingma and Ba, 2015), eta being the step size
+};
+
+/**
+ * @brief      Options of the optimizer used by Network::Sgd. The learning
+ * rate is Sgd's eta, where g is the mean gradient over a mini-batch.
+ */
+struct OptimizerOptions {
+  OptimizerType type = OptimizerType::kSgd;
+  // Momentum coefficient, for kMomentum and kNesterov
+  NNType momentum = 0.9f;
+  // Decay rates of the moments, and the term added to the root of the second
+  // moments, for kAdam
+  NNType beta1 = 0.9f;
+  NNType beta2 = 0.999f;
+  NNType epsilon = 1e-8f;
+};
+
+/**
+ * @brief      Buffers an optimizer keeps between steps, with the layout of
+ * the weights and biases
+ */
+struct OptimizerState {
+  // Number of steps taken
+  std::uint64_t n_steps = 0;
+  // Velocities (kMomentum, kNesterov) or first moments (kAdam) of the
+  // weights and biases of every layer, empty for kSgd
+  std::vector<Matrix<NNType>> weight_moments;
+  std::vector<Vector<NNType>> bias_moments;
+  // Second moments of the weights and biases (kAdam only)
+  std::vector<Matrix<NNType>> weight_second_moments;
+  std::vector<Vector<NNType>> bias_second_moments;
+};
+
+/**
+ * @brief      Number of state buffers an optimizer keeps per parameter
+ * buffer
+ *
+ * @param[in]  type  The optimizer type
+ *
+ * @return     0 for kSgd, 1 for momentum, 2 for Adam
+ */
+unsigned int OptimizerBuffers(OptimizerType type);
+
+/**
+ * @brief      This class describes an optimizer. Its state buffers are
+ * allocated once, and every update is a single fused, vectorised pass over
+ * a parameter buffer, its gradients and its state (see
+ * kernels::MomentumUpdate and kernels::AdamUpdate).
+ *
+ * A step is started by BeginStep, and then every layer is updated. Steps may
+ * run concurrently, as in Hogwild training, with the same deliberate races
+ * on the state as on the parameters.
+ */
+class Optimizer {
+public:
+  /**
+   * @brief      Constructs a new instance with zeroed state.
+   *
+   * @param[in]  options      The options
+   * @param[in]  layer_sizes  The layer sizes of the network
+   */
+  Optimizer(const OptimizerOptions &options,
+            const std::vector<unsigned int> &layer_sizes);
+  /**
+   * @brief      Start a step
+   *
+   * @return     The number of the step, counted from 1
+   */
+  std::uint64_t BeginStep() {
+    return n_steps_.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+  /**
+   * @brief      Update the weights and biases of a layer from their
+   * gradients, summed over a mini-batch
+   *
+   * @param[in]  layer_idx   The layer index (0 is the first weight layer)
+   * @param[in]  step        The step, as returned by BeginStep
+   * @param[in]  eta         The learning rate
+   * @param[in]  batch_size  The number of examples the gradients are summed
+   * over
+   * @param[in]  nabla_w     The gradients of the weights
+   * @param[in]  nabla_b     The gradients of the biases
+   * @param      weights     The weights
+   * @param      biases      The biases
+   */
+  void Update(unsigned int layer_idx, std::uint64_t step, NNType eta,
+              unsigned int batch_size, const Matrix<NNType> &nabla_w,
+              const Vector<NNType> &nabla_b, Matrix<NNType> &weights,
+              Vector<NNType> &biases);
+  /**
+   * @brief      Copy the state, e.g. into a checkpoint. Not to be called
+   * while steps are running.
+   *
+   * @param      state  The state, whose buffers are reused if they fit
+   */
+  void GetState(OptimizerState &state) const;
+  /**
+   * @brief      Restore a state taken by GetState, e.g. from a checkpoint.
+   * Throws std::runtime_error if it doesn't match the optimizer type and
+   * layer sizes.
+   *
+   * @param[in]  state  The state
+   */
+  void SetState(const OptimizerState &state);
+  const OptimizerOptions &options() const { return options_; }
+
+private:
+  const OptimizerOptions options_;
+  std::atomic<std::uint64_t> n_steps_{0};
+  OptimizerState state_; // n_steps_ is the step count
+};
+
+} // namespace nn
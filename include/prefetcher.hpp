@@ -0,0 +1,107 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dataset.hpp"
+
+namespace nn {
+
+/**
+ * @brief      Counters of a Prefetcher, showing which side of the pipeline
+ * waits for the other
+ */
+struct PrefetchStats {
+  // Batches handed to training
+  unsigned long n_batches = 0;
+  // Times training had to wait for a batch, and the total time it waited. If
+  // this is a significant part of the training time, training is input-bound
+  // and more producers (or a cheaper storage format) would help.
+  unsigned long n_consumer_stalls = 0;
+  double consumer_wait_seconds = 0.;
+  // Times producers found every buffer full, and the total time they waited.
+  // This is expected when training is compute-bound.
+  unsigned long n_producer_stalls = 0;
+  double producer_wait_seconds = 0.;
+};
+
+/**
+ * @brief      This class describes a pipeline stage that assembles the
+ * mini-batches of an epoch on background producer threads, ahead of
+ * training. Batches are converted from the data set into a ring of "depth"
+ * preallocated Batch buffers (2 for double buffering, 3 for triple
+ * buffering), and handed out strictly in order, so training sees exactly the
+ * same batches as without prefetching.
+ */
+class Prefetcher {
+public:
+  /**
+   * @brief      Constructs a new instance and starts the producers.
+   *
+   * @param[in]  dataset         The data set, which must outlive the
+   * prefetcher
+   * @param[in]  max_batch_size  The maximum number of examples in a batch
+   * @param[in]  depth           The number of batch buffers, at least 1
+   * @param[in]  n_producers     The number of producer threads, at least 1
+   */
+  Prefetcher(const Dataset &dataset, unsigned int max_batch_size,
+             unsigned int depth, unsigned int n_producers);
+  Prefetcher(const Prefetcher &) = delete;
+  Prefetcher &operator=(const Prefetcher &) = delete;
+  ~Prefetcher();
+  /**
+   * @brief      Start producing the mini-batches of an epoch: consecutive
+   * batch_size runs of the given indices. Every batch of the previous epoch
+   * must have been released. The indices must stay valid and unchanged until
+   * the last batch of the epoch has been returned by Next.
+   *
+   * @param[in]  indices     The indices into the data set, in order
+   * @param[in]  n_examples  The number of indices, a multiple of batch_size
+   * @param[in]  batch_size  The batch size
+   */
+  void StartEpoch(const unsigned int *indices, unsigned int n_examples,
+                  unsigned int batch_size);
+  /**
+   * @brief      Take the next batch of the epoch, waiting until it is ready.
+   * Safe to call from several threads, each of which gets a different batch.
+   *
+   * @return     The batch, or nullptr if the epoch has no batches left
+   */
+  const Batch *Next();
+  /**
+   * @brief      Give a batch returned by Next back, so that its buffer can be
+   * refilled
+   *
+   * @param[in]  batch  The batch
+   */
+  void Release(const Batch *batch);
+  /**
+   * @brief      The counters since construction
+   */
+  PrefetchStats stats() const;
+
+private:
+  enum class SlotState { kFree, kFilling, kReady, kInUse };
+  struct Slot {
+    Batch batch;
+    SlotState state = SlotState::kFree;
+    unsigned int batch_idx = 0;
+  };
+  void ProducerLoop_();
+  const Dataset &dataset_;
+  std::vector<Slot> slots_;
+  std::vector<std::thread> producers_;
+  mutable std::mutex mutex_;
+  std::condition_variable slot_freed_;
+  std::condition_variable batch_ready_;
+  const unsigned int *indices_ = nullptr;
+  unsigned int batch_size_ = 0;
+  unsigned int n_batches_ = 0;
+  unsigned int next_produced_ = 0;
+  unsigned int next_consumed_ = 0;
+  bool stopping_ = false;
+  PrefetchStats stats_;
+};
+
+} // namespace nn
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "dataset.hpp"
+#include "inference_model.hpp"
+#include "kernels.hpp"
+#include "linear_algebra.hpp"
+
+namespace nn {
+
+class Network;
+
+/**
+ * @brief      This class describes a trained network quantised to 8-bit
+ * integers after training, for inference. Every weight row (one output
+ * neuron) is scaled symmetrically to int8 with its own scale. Every layer's
+ * inputs are quantised to [0, 127] with a scale and zero point calibrated from
+ * the range they take on a sample of data, so the matrix-vector products run
+ * on the int8 kernels with exact int32 accumulation. The results are scaled
+ * back to floats, and the biases (kept as floats, with the zero point
+ * correction folded in) and activation functions are applied as usual.
+ *
+ * Like InferenceModel, Predict is thread-safe and never allocates, and the
+ * model doesn't refer to the network after construction.
+ */
+class QuantizedModel {
+public:
+  /**
+   * @brief      Constructs a new instance from a network.
+   *
+   * @param[in]  network           The network
+   * @param[in]  calibration_data  Examples representative of the inputs
+   * the model will see, fed forward to find every layer's input range
+   * @param[in]  n_calibration     The number of examples used, from the
+   * start of calibration_data, 0 meaning all of them
+   * @param[in]  n_slots           The number of scratch slots, see
+   * InferenceModel
+   */
+  QuantizedModel(const Network &network, const Dataset &calibration_data,
+                 unsigned int n_calibration = 0, unsigned int n_slots = 0);
+  /**
+   * @brief      Feed one input forward. Thread-safe, and makes no heap
+   * allocations.
+   *
+   * @param[in]  input   The input, input_size() elements
+   * @param[out] output  The output, output_size() elements
+   */
+  void Predict(const NNType *input, NNType *output) const;
+  unsigned int input_size() const { return layers_.front().n_inputs; }
+  unsigned int output_size() const { return layers_.back().n_outputs; }
+  unsigned int n_slots() const { return slots_.size(); }
+  /**
+   * @brief      The size of the quantised weights, scales and biases in bytes
+   */
+  std::size_t parameter_bytes() const;
+
+private:
+  struct Layer {
+    unsigned int n_inputs;
+    unsigned int n_outputs;
+    // Distance between weight rows, in bytes
+    unsigned int stride;
+    // Offset into weights_
+    std::size_t weights_offset;
+    // Inputs are quantised as round(x / input_scale) + zero_point, clamped
+    // to [0, 127]
+    NNType inverse_input_scale;
+    NNType zero_point;
+    // Scale of every int32 sum back to floats (input scale * row scale)
+    Vector<NNType> output_scales;
+    // The biases, minus the zero point's contribution to every sum
+    Vector<NNType> biases;
+    kernels::Activation activation;
+  };
+  std::vector<Layer> layers_;
+  AlignedBuffer<std::int8_t> weights_;
+  // Every slot has an activations buffer, a quantised inputs buffer and an
+  // int32 sums buffer, at these byte offsets
+  std::size_t quantized_offset_;
+  std::size_t sums_offset_;
+  ScratchSlots slots_;
+};
+
+} // namespace nn
@@ -0,0 +1,156 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include "kernels.hpp"
+#include "linear_algebra.hpp"
+
+namespace nn {
+
+/**
+ * @brief      This class describes a non-owning, read-only view of a sparse
+ * matrix in compressed sparse row (CSR) format: the non-zero values of row i
+ * and their column indices, in increasing order, are at
+ * [row_offsets[i], row_offsets[i + 1]) of values and columns.
+ *
+ * @tparam     T     data type
+ */
+template <typename T> struct CsrMatrixView {
+  unsigned int height = 0;
+  unsigned int width = 0;
+  const unsigned int *row_offsets = nullptr; // height + 1 of them
+  const unsigned int *columns = nullptr;
+  const T *values = nullptr;
+  /**
+   * @brief      View of rows [begin, end), sharing the values and columns
+   */
+  CsrMatrixView Slice(unsigned int begin, unsigned int end) const {
+    assert(begin <= end && end <= height);
+    return {end - begin, width, row_offsets + begin, columns, values};
+  }
+  /**
+   * @brief      The number of non-zero values
+   */
+  unsigned int n_non_zeros() const {
+    return row_offsets[height] - row_offsets[0];
+  }
+};
+
+/**
+ * @brief      This class describes a sparse matrix in compressed sparse row
+ * (CSR) format, converted from dense matrices. Its buffers only grow, so
+ * converting matrices no larger than the previous ones doesn't allocate.
+ *
+ * @tparam     T     data type
+ */
+template <typename T> class CsrMatrix {
+public:
+  /**
+   * @brief      Convert a dense matrix, unless more than max_density of its
+   * values are non-zero, in which case the conversion stops early
+   *
+   * @param[in]  dense        The dense matrix
+   * @param[in]  max_density  The largest fraction of non-zero values to
+   * convert
+   *
+   * @return     Whether the matrix was converted
+   */
+  bool Assign(MatrixView<const T> dense, double max_density) {
+    const auto max_non_zeros = static_cast<std::size_t>(
+        max_density * dense.height * dense.width);
+    // Room for a row beyond the limit, as rows are checked once compressed
+    const std::size_t capacity =
+        std::min(max_non_zeros + dense.width,
+                 std::size_t{dense.height} * dense.width);
+    if (columns_.size() < capacity) {
+      columns_.resize(capacity);
+      values_.resize(capacity);
+    }
+    row_offsets_.resize(std::max<std::size_t>(row_offsets_.size(),
+                                              dense.height + 1));
+    height_ = 0;
+    width_ = dense.width;
+    row_offsets_[0] = 0;
+    for (unsigned int i = 0; i < dense.height; i++) {
+      const unsigned int offset = row_offsets_[i];
+      row_offsets_[i + 1] =
+          offset + CompressRow_(dense.Row(i).data(), dense.width,
+                                columns_.data() + offset,
+                                values_.data() + offset);
+      if (row_offsets_[i + 1] > max_non_zeros) {
+        return false;
+      }
+    }
+    height_ = dense.height;
+    return true;
+  }
+  CsrMatrixView<T> View() const {
+    return {height_, width_, row_offsets_.data(), columns_.data(),
+            values_.data()};
+  }
+
+private:
+  static unsigned int CompressRow_(const T *row, unsigned int n,
+                                   unsigned int *columns, T *values) {
+    if constexpr (std::is_same_v<T, float>) {
+      return kernels::CompressNonZeros(n, row, columns, values);
+    }
+    unsigned int count = 0;
+    for (unsigned int j = 0; j < n; j++) {
+      if (row[j] != static_cast<T>(0)) {
+        columns[count] = j;
+        values[count] = row[j];
+        count++;
+      }
+    }
+    return count;
+  }
+  unsigned int height_ = 0;
+  unsigned int width_ = 0;
+  std::vector<unsigned int> row_offsets_;
+  std::vector<unsigned int> columns_;
+  std::vector<T> values_;
+};
+
+/**
+ * @brief      Product of a sparse matrix and a transposed dense matrix,
+ * c = a * b^T, only reading the columns of b at the non-zero values of a
+ *
+ * @param[in]  a     A
+ * @param[in]  b     B
+ * @param[out] c     C
+ */
+inline void MultiplyTransposed(CsrMatrixView<float> a,
+                               MatrixView<const float> b,
+                               MatrixView<float> c) {
+  assert(a.width == b.width);
+  assert(c.height == a.height);
+  assert(c.width == b.height);
+  kernels::SparseGemm(a.height, b.height, a.row_offsets, a.columns, a.values,
+                      b.data(), b.stride, c.data(), c.stride);
+}
+
+/**
+ * @brief      Product of a transposed dense matrix and a sparse matrix,
+ * c = d^T * a, i.e. the sum of the outer products of their rows. Only the
+ * columns of c at the non-zero values of a are computed, and the others are
+ * zeroed.
+ *
+ * @param[in]  d     D
+ * @param[in]  a     A
+ * @param[out] c     C
+ */
+inline void TransposedMultiply(MatrixView<const float> d,
+                               CsrMatrixView<float> a, MatrixView<float> c) {
+  assert(d.height == a.height);
+  assert(c.height == d.width);
+  assert(c.width == a.width);
+  kernels::SparseOuterProducts(a.height, d.width, a.width, d.data(), d.stride,
+                               a.row_offsets, a.columns, a.values, c.data(),
+                               c.stride);
+}
+
+} // namespace nn
@@ -0,0 +1,136 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace nn {
+
+/**
+ * @brief      Phases of training that time is split into
+ */
+enum class Phase {
+  kForward,   // forward pass of a batch
+  kBackward,  // backward pass, down to the gradients
+  kUpdate,    // summing the gradients of the threads, and the update step
+  kData,      // assembling mini-batches, or waiting for the prefetcher
+  kEval,      // evaluating on the test data at the end of an epoch
+  kAllReduce, // summing the gradients of the processes (data parallel)
+};
+constexpr std::size_t kNumPhases = 6;
+
+/**
+ * @brief      Time spent in every phase, in seconds. These are only measured
+ * if the library is built with NN_TELEMETRY_TIMERS, and are zero otherwise.
+ */
+struct PhaseTimes {
+  std::array<double, kNumPhases> seconds = {};
+  double &operator[](Phase phase) {
+    return seconds[static_cast<std::size_t>(phase)];
+  }
+  double operator[](Phase phase) const {
+    return seconds[static_cast<std::size_t>(phase)];
+  }
+  PhaseTimes &operator+=(const PhaseTimes &other) {
+    for (std::size_t phase_idx = 0; phase_idx < kNumPhases; phase_idx++) {
+      seconds[phase_idx] += other.seconds[phase_idx];
+    }
+    return *this;
+  }
+};
+
+/**
+ * @brief      Progress of a training step, passed to
+ * TrainingOptions::on_mini_batch after the update
+ */
+struct MiniBatchReport {
+  unsigned int epoch_idx = 0;
+  unsigned int mini_batch_idx = 0; // within the epoch
+  unsigned int n_examples = 0;
+  // Wall time of the step, and the resulting throughput
+  double seconds = 0;
+  double examples_per_second = 0;
+  // Mean quadratic cost of the examples, and the fraction of them classified
+  // correctly, from the forward pass before the update
+  double loss = 0;
+  double accuracy = 0;
+  // Forward, backward and data phases as timed on the first thread (the
+  // threads work on equal shares in parallel), the update, and the
+  // allreduce of data parallel training
+  PhaseTimes phase_times;
+};
+
+/**
+ * @brief      Progress of an epoch, passed to TrainingOptions::on_epoch after
+ * the epoch and its evaluation
+ */
+struct EpochReport {
+  unsigned int epoch_idx = 0;
+  unsigned int n_examples = 0; // trained on during the epoch
+  // Wall time of training, excluding the evaluation, and the resulting
+  // throughput
+  double seconds = 0;
+  double examples_per_second = 0;
+  // Mean training loss and accuracy over the epoch (see MiniBatchReport)
+  double loss = 0;
+  double accuracy = 0;
+  // Examples of the test data, and how many are classified correctly after
+  // the epoch, if there is test data
+  unsigned int n_test = 0;
+  unsigned int n_test_correct = 0;
+  // Sums of the phase times of the mini-batches (averaged over the threads
+  // for Hogwild training), and the evaluation
+  PhaseTimes phase_times;
+};
+
+/**
+ * @brief      Send the library's messages, such as the progress of training
+ * without an epoch callback, to a function instead of std::cout. Call it
+ * before creating networks or training, not during.
+ *
+ * @param[in]  sink  The function, called with one line at a time (without
+ * the newline), or an empty function to discard messages
+ */
+void SetLogSink(std::function<void(const std::string &)> sink);
+
+/**
+ * @brief      Write a line to the log sink (std::cout by default)
+ *
+ * @param[in]  message  The line
+ */
+void Log(const std::string &message);
+
+#ifdef NN_TELEMETRY_TIMERS
+/**
+ * @brief      This class describes a timer that adds the time from its
+ * construction to its destruction to a phase. Use it through NN_TIME_PHASE,
+ * which compiles to nothing unless NN_TELEMETRY_TIMERS is defined.
+ */
+class ScopedTimer {
+public:
+  ScopedTimer(PhaseTimes &times, Phase phase)
+      : times_(times), phase_(phase), start_(Clock::now()) {}
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+  ~ScopedTimer() {
+    times_[phase_] +=
+        std::chrono::duration<double>(Clock::now() - start_).count();
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+  PhaseTimes &times_;
+  const Phase phase_;
+  const Clock::time_point start_;
+};
+#define NN_TIME_PHASE_NAME_(line) nn_phase_timer_##line
+#define NN_TIME_PHASE_NAME(line) NN_TIME_PHASE_NAME_(line)
+// Time the rest of the enclosing scope as a phase of training
+#define NN_TIME_PHASE(times, phase)                                            \
+  ::nn::ScopedTimer NN_TIME_PHASE_NAME(__LINE__)((times), (phase))
+#else
+#define NN_TIME_PHASE(times, phase) ((void)0)
+#endif
+
+} // namespace nn
@@ -0,0 +1,72 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace nn {
+
+/**
+ * @brief      This class describes a fixed-size pool of threads that run
+ * indexed tasks in parallel. The calling thread takes part in the work, so a
+ * pool of n threads starts n - 1 workers. Every thread reserves the kernels'
+ * scratch space up front (see kernels::ReserveScratch), so that tasks don't
+ * allocate it depending on which thread happens to run them.
+ */
+class ThreadPool {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  n_threads  The number of threads, including the calling
+   * thread. 0 means one per hardware thread.
+   */
+  explicit ThreadPool(unsigned int n_threads);
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+  /**
+   * @brief      Run task(task_idx) for every task_idx in [0, n_tasks) and wait
+   * for all of them to finish. Tasks are handed out dynamically, so which
+   * thread runs which task is unspecified. Must only be called from one
+   * thread at a time, and not from inside a task.
+   *
+   * @param[in]  n_tasks  The number of tasks
+   * @param      task     The task, callable with an unsigned int
+   *
+   * @tparam     Task     The task type
+   */
+  template <typename Task> void ParallelFor(unsigned int n_tasks, Task &&task) {
+    // Type-erase without std::function so that no call allocates
+    auto invoke = [](void *context, unsigned int task_idx) {
+      (*static_cast<std::remove_reference_t<Task> *>(context))(task_idx);
+    };
+    Run_(n_tasks, invoke, &task);
+  }
+  /**
+   * @brief      The number of threads, including the calling thread
+   */
+  unsigned int size() const { return workers_.size() + 1; }
+
+private:
+  using Invoke = void (*)(void *, unsigned int);
+  void Run_(unsigned int n_tasks, Invoke invoke, void *context);
+  void RunTasks_();
+  void WorkerLoop_();
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable work_done_;
+  Invoke invoke_ = nullptr;
+  void *context_ = nullptr;
+  unsigned int n_tasks_ = 0;
+  std::atomic<unsigned int> next_task_{0};
+  unsigned int n_busy_workers_ = 0;
+  std::uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
+
+} // namespace nn
@@ -1,5 +1,6 @@
 #pragma once
 #include <cmath>
+#include <type_traits>
 
 namespace nn {
 
@@ -15,8 +16,8 @@ namespace nn {
 template <typename T> Vector<T> Sigmoid(Vector<T> input) {
   Vector<T> output(input.length);
   for (unsigned int i = 0; i < input.length; i++) {
-    output.elements[i] =
-        static_cast<T>(1) / (static_cast<T>(1) + std::exp(-input.elements[i]));
+    output[i] =
+        static_cast<T>(1) / (static_cast<T>(1) + std::exp(-input[i]));
   }
   return output;
 }
@@ -31,7 +32,12 @@ template <typename T> Vector<T> Sigmoid(Vector<T> input) {
  * @return     The sigmoid derivative of the elements of the input vector
  */
 template <typename T> Vector<T> SigmoidPrime(Vector<T> input) {
-  return Sigmoid(input) * (static_cast<T>(1) - Sigmoid(input));
+  for (auto &element : input) {
+    const T sigmoid =
+        static_cast<T>(1) / (static_cast<T>(1) + std::exp(-element));
+    element = sigmoid * (static_cast<T>(1) - sigmoid);
+  }
+  return input;
 }
 
 /**
@@ -46,7 +52,7 @@ template <typename T> Vector<T> SigmoidPrime(Vector<T> input) {
 template <typename T> Vector<T> Relu(Vector<T> input) {
   Vector<T> output(input.length);
   for (unsigned int i = 0; i < input.length; i++) {
-    output.elements[i] = input.elements[i] > 0 ? input.elements[i] : 0;
+    output[i] = input[i] > 0 ? input[i] : 0;
   }
   return output;
 }
@@ -64,8 +70,218 @@ template <typename T> Vector<T> Relu(Vector<T> input) {
 template <typename T> Vector<T> ReluPrime(Vector<T> input) {
   Vector<T> output(input.length);
   for (unsigned int i = 0; i < input.length; i++) {
-    output.elements[i] = input.elements[i] > 0 ? 1 : 0;
+    output[i] = input[i] > 0 ? 1 : 0;
   }
   return output;
 }
+
+/**
+ * @brief      Elementwise sigmoid of a vector expression
+ *
+ * @param[in]  input  The input expression, which is evaluated first
+ *
+ * @tparam     E      Expression type
+ *
+ * @return     The sigmoid of the elements of the input
+ */
+template <typename E>
+Vector<typename E::value_type> Sigmoid(const VectorExpression<E> &input) {
+  return Sigmoid(Vector<typename E::value_type>(input));
+}
+
+/**
+ * @brief      Elementwise sigmoid derivative of a vector expression
+ *
+ * @param[in]  input  The input expression, which is evaluated first
+ *
+ * @tparam     E      Expression type
+ *
+ * @return     The sigmoid derivative of the elements of the input
+ */
+template <typename E>
+Vector<typename E::value_type> SigmoidPrime(const VectorExpression<E> &input) {
+  return SigmoidPrime(Vector<typename E::value_type>(input));
+}
+
+/**
+ * @brief      Elementwise ReLU of a vector expression
+ *
+ * @param[in]  input  The input expression, which is evaluated first
+ *
+ * @tparam     E      Expression type
+ *
+ * @return     The ReLU of the elements of the input
+ */
+template <typename E>
+Vector<typename E::value_type> Relu(const VectorExpression<E> &input) {
+  return Relu(Vector<typename E::value_type>(input));
+}
+
+/**
+ * @brief      Elementwise ReLU gradient of a vector expression
+ *
+ * @param[in]  input  The input expression, which is evaluated first
+ *
+ * @tparam     E      Expression type
+ *
+ * @return     The ReLU gradient of the elements of the input
+ */
+template <typename E>
+Vector<typename E::value_type> ReluPrime(const VectorExpression<E> &input) {
+  return ReluPrime(Vector<typename E::value_type>(input));
+}
+
+namespace detail {
+
+/**
+ * @brief      Fused bias and activation for any data type, see
+ * kernels::BiasActivation
+ */
+template <typename T>
+void BiasActivation(kernels::Activation activation, const Vector<T> &biases,
+                    MatrixView<T> inputs) {
+  assert(biases.length == inputs.width);
+  if constexpr (std::is_same_v<T, float>) {
+    kernels::BiasActivation(activation, inputs.height, inputs.width,
+                            biases.data(), inputs.data(), inputs.stride);
+  } else {
+    for (unsigned int i = 0; i < inputs.height; i++) {
+      T *row = inputs.Row(i).data();
+      for (unsigned int j = 0; j < inputs.width; j++) {
+        const T z = row[j] + biases[j];
+        row[j] = activation == kernels::Activation::kSigmoid
+                     ? static_cast<T>(1) / (static_cast<T>(1) + std::exp(-z))
+                     : (z > 0 ? z : 0);
+      }
+    }
+  }
+}
+
+/**
+ * @brief      Fused multiplication by the activation derivative for any data
+ * type, see kernels::MultiplyActivationPrime
+ */
+template <typename T>
+void MultiplyActivationPrime(kernels::Activation activation,
+                             MatrixView<const NonDeduced<T>> activations,
+                             MatrixView<T> deltas) {
+  assert(activations.height == deltas.height);
+  assert(activations.width == deltas.width);
+  if constexpr (std::is_same_v<T, float>) {
+    kernels::MultiplyActivationPrime(activation, deltas.height, deltas.width,
+                                     activations.data(), activations.stride,
+                                     deltas.data(), deltas.stride);
+  } else {
+    for (unsigned int i = 0; i < deltas.height; i++) {
+      const T *activation_row = activations.Row(i).data();
+      T *delta_row = deltas.Row(i).data();
+      for (unsigned int j = 0; j < deltas.width; j++) {
+        const T a = activation_row[j];
+        delta_row[j] *= activation == kernels::Activation::kSigmoid
+                            ? a * (static_cast<T>(1) - a)
+                            : (a > 0 ? 1 : 0);
+      }
+    }
+  }
+}
+
+} // namespace detail
+
+/**
+ * @brief      Add biases to every row of a matrix view and apply the sigmoid,
+ * in place, in one pass
+ *
+ * @param[in]  biases  The biases, one per column
+ * @param[in]  inputs  The weighted inputs, overwritten with the activations
+ *
+ * @tparam     T       Data type
+ */
+template <typename T>
+void BiasSigmoid(const Vector<T> &biases, MatrixView<T> inputs) {
+  detail::BiasActivation(kernels::Activation::kSigmoid, biases, inputs);
+}
+
+/**
+ * @brief      Multiply deltas elementwise by the sigmoid derivative, taken
+ * from the sigmoid outputs of the forward pass as a (1 - a)
+ *
+ * @param[in]  activations  The sigmoid outputs
+ * @param[in]  deltas       The deltas, multiplied in place
+ *
+ * @tparam     T            Data type
+ */
+template <typename T>
+void MultiplySigmoidPrime(MatrixView<const detail::NonDeduced<T>> activations,
+                          MatrixView<T> deltas) {
+  detail::MultiplyActivationPrime(kernels::Activation::kSigmoid, activations,
+                                  deltas);
+}
+
+/**
+ * @brief      Add biases to every row of a matrix view and apply ReLU, in
+ * place, in one pass
+ *
+ * @param[in]  biases  The biases, one per column
+ * @param[in]  inputs  The weighted inputs, overwritten with the activations
+ *
+ * @tparam     T       Data type
+ */
+template <typename T>
+void BiasRelu(const Vector<T> &biases, MatrixView<T> inputs) {
+  detail::BiasActivation(kernels::Activation::kRelu, biases, inputs);
+}
+
+/**
+ * @brief      Multiply deltas elementwise by the ReLU gradient, taken from the
+ * ReLU outputs of the forward pass (0 where the output is 0, 1 elsewhere)
+ *
+ * @param[in]  activations  The ReLU outputs
+ * @param[in]  deltas       The deltas, multiplied in place
+ *
+ * @tparam     T            Data type
+ */
+template <typename T>
+void MultiplyReluPrime(MatrixView<const detail::NonDeduced<T>> activations,
+                       MatrixView<T> deltas) {
+  detail::MultiplyActivationPrime(kernels::Activation::kRelu, activations,
+                                  deltas);
+}
+
+/**
+ * @brief      Activation policy for BasicNetwork: sigmoid
+ */
+struct SigmoidActivation {
+  // The same function as a fused kernel, for code that runs layers without
+  // the policy (see InferenceModel)
+  static constexpr kernels::Activation kKernel = kernels::Activation::kSigmoid;
+  template <typename T>
+  static void Activate(const Vector<T> &biases, MatrixView<T> inputs) {
+    BiasSigmoid(biases, inputs);
+  }
+  template <typename T>
+  static void
+  MultiplyPrime(MatrixView<const detail::NonDeduced<T>> activations,
+                MatrixView<T> deltas) {
+    MultiplySigmoidPrime(activations, deltas);
+  }
+};
+
+/**
+ * @brief      Activation policy for BasicNetwork: ReLU
+ */
+struct ReluActivation {
+  // The same function as a fused kernel, for code that runs layers without
+  // the policy (see InferenceModel)
+  static constexpr kernels::Activation kKernel = kernels::Activation::kRelu;
+  template <typename T>
+  static void Activate(const Vector<T> &biases, MatrixView<T> inputs) {
+    BiasRelu(biases, inputs);
+  }
+  template <typename T>
+  static void
+  MultiplyPrime(MatrixView<const detail::NonDeduced<T>> activations,
+                MatrixView<T> deltas) {
+    MultiplyReluPrime(activations, deltas);
+  }
+};
 } // namespace nn
\ No newline at end of file
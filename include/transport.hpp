@@ -0,0 +1,151 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace nn {
+
+/**
+ * @brief      This interface class describes the links of a ring of worker
+ * processes, numbered from 0 to size() - 1, that data parallel training
+ * combines its gradients over (see AllReduceSum). Every rank is linked to
+ * the next one, (rank + 1) % size, and from the previous one. Child classes
+ * are declared below.
+ */
+class Transport {
+public:
+  virtual ~Transport() = default;
+  /**
+   * @brief      The rank of this process
+   */
+  virtual unsigned int rank() const = 0;
+  /**
+   * @brief      The number of processes
+   */
+  virtual unsigned int size() const = 0;
+  /**
+   * @brief      Send bytes to the next rank while receiving bytes from the
+   * previous one. Every rank of the ring must call it, with send_bytes equal
+   * to the receive_bytes of the next rank, and it returns once both
+   * transfers are done. The two run concurrently, so transfers larger than
+   * the buffers of the links can't deadlock the ring. Throws
+   * std::runtime_error if a link fails.
+   *
+   * @param[in]  send           The bytes to send
+   * @param[in]  send_bytes     The number of bytes to send
+   * @param[out] receive        The bytes received, which mustn't overlap
+   * send
+   * @param[in]  receive_bytes  The number of bytes to receive
+   */
+  virtual void Exchange(const void *send, std::size_t send_bytes,
+                        void *receive, std::size_t receive_bytes) = 0;
+};
+
+/**
+ * @brief      This class describes a ring of processes on one machine linked
+ * through a POSIX shared memory segment, with one single-producer,
+ * single-consumer ring buffer from every rank to the next. Bytes are copied
+ * straight between the processes' memory and the segment, and waiting ranks
+ * spin briefly before yielding.
+ *
+ * Every rank constructs one with the same name and size. The constructor
+ * waits for all the ranks to attach, and then the name is removed, so it
+ * only has to be unique among the jobs running at the same time. A job that
+ * crashes before every rank attached leaves the segment in /dev/shm.
+ *
+ * A rank can't tell from the segment that a peer has exited, so Exchange
+ * throws std::runtime_error if it makes no progress for the timeout. A rank
+ * that crashes mid-job then fails the others, after the timeout, rather
+ * than leaving them waiting forever.
+ */
+class SharedMemoryTransport : public Transport {
+public:
+  /**
+   * @brief      Attach to the segment of a ring, creating it if this is the
+   * first rank. Throws std::runtime_error if the segment can't be created or
+   * mapped, or if the other ranks don't attach within the timeout.
+   *
+   * @param[in]  name          The name of the segment, e.g. "/nn-job42"
+   * @param[in]  rank          The rank of this process
+   * @param[in]  size          The number of processes
+   * @param[in]  buffer_bytes  The capacity of each ring buffer
+   * @param[in]  timeout       How long to wait for the other ranks, here and
+   * without progress in Exchange
+   */
+  SharedMemoryTransport(
+      const std::string &name, unsigned int rank, unsigned int size,
+      std::size_t buffer_bytes = std::size_t{1} << 20,
+      std::chrono::milliseconds timeout = std::chrono::seconds(60));
+  SharedMemoryTransport(const SharedMemoryTransport &) = delete;
+  SharedMemoryTransport &operator=(const SharedMemoryTransport &) = delete;
+  ~SharedMemoryTransport() override;
+  unsigned int rank() const override { return rank_; }
+  unsigned int size() const override { return size_; }
+  void Exchange(const void *send, std::size_t send_bytes, void *receive,
+                std::size_t receive_bytes) override;
+
+private:
+  /**
+   * @brief      Ring buffer from a rank to the next. The counters are the
+   * total numbers of bytes written and read, each only advanced by one side,
+   * and on separate cache lines.
+   */
+  struct Channel {
+    alignas(64) std::atomic<std::uint64_t> n_written;
+    alignas(64) std::atomic<std::uint64_t> n_read;
+  };
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                "Counters shared between processes must be lock-free");
+  Channel &Channel_(unsigned int channel_idx) const;
+  std::uint8_t *Buffer_(unsigned int channel_idx) const;
+  const unsigned int rank_;
+  const unsigned int size_;
+  const std::size_t buffer_bytes_;
+  const std::chrono::milliseconds timeout_;
+  void *mapping_;
+  std::size_t mapping_bytes_;
+};
+
+/**
+ * @brief      This class describes a ring of processes on one machine linked
+ * through Unix domain stream sockets. Rank r listens on the path
+ * prefix + std::to_string(r), connects to the next rank and accepts the
+ * previous one, and then the path is removed.
+ *
+ * Every rank constructs one with the same prefix and size. A rank whose
+ * peer exits or closes its socket gets a std::runtime_error rather than
+ * waiting forever.
+ */
+class SocketTransport : public Transport {
+public:
+  /**
+   * @brief      Connect the ring. Throws std::runtime_error if a socket
+   * can't be set up or the neighbours don't connect within the timeout.
+   *
+   * @param[in]  path_prefix  The prefix of the socket paths, e.g.
+   * "/tmp/nn-job42-"
+   * @param[in]  rank         The rank of this process
+   * @param[in]  size         The number of processes
+   * @param[in]  timeout      How long to wait for the neighbours
+   */
+  SocketTransport(const std::string &path_prefix, unsigned int rank,
+                  unsigned int size,
+                  std::chrono::milliseconds timeout = std::chrono::seconds(60));
+  SocketTransport(const SocketTransport &) = delete;
+  SocketTransport &operator=(const SocketTransport &) = delete;
+  ~SocketTransport() override;
+  unsigned int rank() const override { return rank_; }
+  unsigned int size() const override { return size_; }
+  void Exchange(const void *send, std::size_t send_bytes, void *receive,
+                std::size_t receive_bytes) override;
+
+private:
+  const unsigned int rank_;
+  const unsigned int size_;
+  int next_fd_ = -1;     // connected to the next rank
+  int previous_fd_ = -1; // accepted from the previous rank
+};
+
+} // namespace nn
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "inference_model.hpp"
+#include "network.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief      Print the median, 99th percentile and worst of latencies, in
+ * microseconds
+ */
+void PrintLatencies(const std::string &name, std::vector<double> latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  const auto percentile = [&latencies](double fraction) {
+    return latencies[static_cast<std::size_t>(fraction *
+                                              (latencies.size() - 1))];
+  };
+  std::cout << name << ": p50 " << percentile(0.5) << " us, p99 "
+            << percentile(0.99) << " us, max " << latencies.back() << " us"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 3) {
+    std::cout << "Inference latency benchmark of NNLib" << std::endl;
+    std::cout << "Takes two optional arguments: the number of threads calling "
+                 "at once (default 1) and the number of calls per thread "
+                 "(default 10000)"
+              << std::endl;
+    return 0;
+  }
+  const unsigned int n_threads = argc > 1 ? std::stoul(argv[1]) : 1;
+  const unsigned int n_calls = argc > 2 ? std::stoul(argv[2]) : 10000;
+
+  // An MNIST-sized network
+  nn::BasicNetwork<nn::ReluActivation, nn::SigmoidActivation> network(
+      {784, 100, 10});
+  std::default_random_engine generator;
+  std::uniform_real_distribution<nn::NNType> distribution(0.f, 1.f);
+  nn::Vector<nn::NNType> input(784);
+  for (auto &element : input) {
+    element = distribution(generator);
+  }
+
+  std::vector<double> latencies(n_calls);
+  const auto time_calls = [&input, n_calls](std::vector<double> &latencies,
+                                            auto &&call) {
+    for (unsigned int call_idx = 0; call_idx < n_calls; call_idx++) {
+      const auto start = Clock::now();
+      call(input);
+      latencies[call_idx] =
+          std::chrono::duration<double, std::micro>(Clock::now() - start)
+              .count();
+    }
+  };
+
+  // Network::FeedForward isn't thread-safe, so it is timed on its own
+  time_calls(latencies, [&network](const nn::Vector<nn::NNType> &input) {
+    network.FeedForward(input);
+  });
+  PrintLatencies("Network::FeedForward, 1 thread", latencies);
+
+  const nn::InferenceModel model(network, n_threads);
+  std::vector<std::vector<double>> thread_latencies(
+      n_threads, std::vector<double>(n_calls));
+  std::vector<std::thread> threads;
+  for (unsigned int thread_idx = 0; thread_idx < n_threads; thread_idx++) {
+    threads.emplace_back([&, thread_idx] {
+      std::vector<nn::NNType> output(model.output_size());
+      time_calls(thread_latencies[thread_idx],
+                 [&model, &output](const nn::Vector<nn::NNType> &input) {
+                   model.Predict(input.data(), output.data());
+                 });
+    });
+  }
+  latencies.clear();
+  for (unsigned int thread_idx = 0; thread_idx < n_threads; thread_idx++) {
+    threads[thread_idx].join();
+    latencies.insert(latencies.end(), thread_latencies[thread_idx].begin(),
+                     thread_latencies[thread_idx].end());
+  }
+  PrintLatencies("InferenceModel::Predict, " + std::to_string(n_threads) +
+                     " thread(s)",
+                 latencies);
+  return 0;
+}
@@ -1,6 +1,7 @@
+#include <cassert>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
-#include <iterator>
 #include <memory>
 #include <optional>
 #include <random>
@@ -8,57 +9,28 @@
 #include <utility>
 #include <vector>
 
+#include "idx.hpp"
 #include "network.hpp"
 
-typedef unsigned char BYTE;
-
-/**
- * @brief      Reads a file.
- *
- * @param[in]  path  The path to read
- *
- * @return     Vector of bytes contained in the file
- */
-std::vector<BYTE> ReadFile(const std::string path) {
-  std::cout << "Reading " << path << std::endl;
-  std::ifstream input(path, std::ios::binary);
-  std::vector<BYTE> bytes(std::istreambuf_iterator<char>(input), {});
-  return bytes;
-}
-
-/**
- * @brief      Convert four bytes from iterator into a number
- *
- * @param[in]  bytes  The bytes
- *
- * @return     The number
- */
-unsigned int FourBytesToNumber(std::vector<BYTE>::iterator bytes) {
-  return (static_cast<unsigned int>(bytes[0]) << 24) +
-         (static_cast<unsigned int>(bytes[1]) << 16) +
-         (static_cast<unsigned int>(bytes[2]) << 8) +
-         (static_cast<unsigned int>(bytes[3]));
-}
-
 /**
  * @brief      Draws an image to the console output.
  *
- * @param[in]  image  The matrix representing the image to draw
+ * @param[in]  image  The image to draw, as bytes
  */
-void DrawImage(nn::Matrix<nn::NNType> image) {
+void DrawImage(nn::MatrixView<const std::uint8_t> image) {
   assert(image.height % 2 == 0);
 
   // Iterate over even rows
   for (unsigned int row_idx = 0; row_idx < image.height; row_idx += 2) {
     for (unsigned int col_idx = 0; col_idx < image.width; col_idx++) {
-      if (image.rows[row_idx][col_idx] < 0.5) {
-        if (image.rows[row_idx + 1][col_idx] < 0.5) {
+      if (image(row_idx, col_idx) < 128) {
+        if (image(row_idx + 1, col_idx) < 128) {
           std::cout << " "; // Black and black
         } else {
           std::cout << "▄"; // Black and white
         }
       } else {
-        if (image.rows[row_idx + 1][col_idx] < 0.5) {
+        if (image(row_idx + 1, col_idx) < 128) {
           std::cout << "▀"; // White and black
         } else {
           std::cout << "█"; // White and white
@@ -69,93 +41,6 @@ void DrawImage(nn::Matrix<nn::NNType> image) {
   }
 }
 
-/**
- * @brief      Reads an index matrix file.
- *
- * @param[in]  path  The path to read
- *
- * @return     The images stored in the file
- */
-std::vector<nn::Matrix<nn::NNType>> ReadIdxMatrixFile(const std::string path) {
-  auto bytes = ReadFile(path);
-  assert(bytes[0] == 0);
-  assert(bytes[1] == 0);
-  assert(bytes[2] == 8); // unsigned char identifier
-  assert(bytes[3] == 3); // dims of file
-  auto iterator = bytes.begin() + 4;
-  const auto n_images = FourBytesToNumber(iterator);
-  iterator += 4;
-  const auto n_rows = FourBytesToNumber(iterator);
-  iterator += 4;
-  const auto n_cols = FourBytesToNumber(iterator);
-  iterator += 4;
-  assert(n_images * n_rows * n_cols + std::distance(bytes.begin(), iterator) ==
-         bytes.size());
-  std::vector<nn::Matrix<nn::NNType>> images;
-  for (unsigned int image_idx = 0; image_idx < n_images; image_idx++) {
-    nn::Matrix<nn::NNType> image(n_rows, n_cols);
-    for (unsigned int row_idx = 0; row_idx < n_rows; row_idx++) {
-      for (unsigned int col_idx = 0; col_idx < n_cols; col_idx++) {
-        image.rows[row_idx][col_idx] =
-            static_cast<nn::NNType>(*iterator) / 255.f;
-        iterator++;
-      }
-    }
-    images.push_back(image);
-  }
-  return images;
-}
-
-/**
- * @brief      Reads an index label file.
- *
- * @param[in]  path  The path to read
- *
- * @return     The labels stored in the file
- */
-std::vector<BYTE> ReadIdxLabelFile(const std::string path) {
-  auto bytes = ReadFile(path);
-  assert(bytes[0] == 0);
-  assert(bytes[1] == 0);
-  assert(bytes[2] == 8); // unsigned char identifier
-  assert(bytes[3] == 1); // dims of file
-  auto iterator = bytes.begin() + 4;
-  const auto n_labels = FourBytesToNumber(iterator);
-  iterator += 4;
-  assert(n_labels + std::distance(bytes.begin(), iterator) == bytes.size());
-  return std::vector<BYTE>(iterator, bytes.end());
-}
-
-/**
- * @brief      Generate annotated data from images and labels
- *
- * @param[in]  images  The images
- * @param[in]  labels  The labels
- *
- * @return     The vectors representing the input and output of the matrix
- * corresponding to the images and labels
- */
-nn::AnnotatedData
-GenerateAnnotatedData(std::vector<nn::Matrix<nn::NNType>> images,
-                      std::vector<BYTE> labels) {
-  assert(images.size() == labels.size());
-  nn::AnnotatedData annotated_data;
-  for (unsigned int image_idx = 0; image_idx < images.size(); image_idx++) {
-    const auto image = images[image_idx];
-    nn::Vector<nn::NNType> input_vector(image.width * image.height);
-    for (unsigned int row_idx = 0; row_idx < image.height; row_idx++) {
-      for (unsigned int col_idx = 0; col_idx < image.width; col_idx++) {
-        input_vector.elements[row_idx * image.width + col_idx] =
-            image.rows[row_idx][col_idx];
-      }
-    }
-    const auto output_vector = nn::IndexToOneHot(labels[image_idx], 10);
-    const auto example = std::make_pair(input_vector, output_vector);
-    annotated_data.push_back(example);
-  }
-  return annotated_data;
-}
-
 /**
  * @brief      Run MNIST demo of NNLib
  *
@@ -165,7 +50,7 @@ GenerateAnnotatedData(std::vector<nn::Matrix<nn::NNType>> images,
  * @return     0 if successful
  */
 int main(int argc, char **argv) {
-  if (argc != 6) {
+  if (argc != 6 && argc != 7) {
     std::cout << "MNIST demo of NNLib" << std::endl;
     std::cout << "Arguments are 'relu' or 'sigmoid', then the paths to the "
                  "following files, in this order"
@@ -175,6 +60,10 @@ int main(int argc, char **argv) {
     std::cout << "3. t10k-images.idx3-ubyte:  test set images" << std::endl;
     std::cout << "4. t10k-labels.idx1-ubyte:  test set labels" << std::endl;
     std::cout << "Download from http://yann.lecun.com/exdb/mnist/" << std::endl;
+    std::cout << "Optionally followed by the path of a model file: the network "
+                 "is loaded from it if it exists, and otherwise trained and "
+                 "saved to it"
+              << std::endl;
     return 0;
   }
   const std::string nonlinearity = argv[1];
@@ -182,17 +71,19 @@ int main(int argc, char **argv) {
   const std::string train_labels_path = argv[3];
   const std::string test_images_path = argv[4];
   const std::string test_labels_path = argv[5];
+  const std::string model_path = argc == 7 ? argv[6] : "";
 
-  const auto train_images = ReadIdxMatrixFile(train_images_path);
-  const auto train_labels = ReadIdxLabelFile(train_labels_path);
-  const auto training_data = GenerateAnnotatedData(train_images, train_labels);
-
-  const auto test_images = ReadIdxMatrixFile(test_images_path);
-  const auto test_labels = ReadIdxLabelFile(test_labels_path);
-  const auto test_data = GenerateAnnotatedData(test_images, test_labels);
+  // The files are memory-mapped, and images are only converted to floats
+  // as they are fed to the network
+  std::cout << "Reading " << train_images_path << std::endl;
+  std::cout << "Reading " << train_labels_path << std::endl;
+  const nn::IdxDataset training_data(train_images_path, train_labels_path);
+  std::cout << "Reading " << test_images_path << std::endl;
+  std::cout << "Reading " << test_labels_path << std::endl;
+  const nn::IdxDataset test_data(test_images_path, test_labels_path);
 
   std::vector<unsigned int> layer_sizes(
-      {training_data[0].first.length, 16, 16, training_data[0].second.length});
+      {training_data.input_size(), 16, 16, training_data.output_size()});
   std::unique_ptr<nn::Network> network;
   if (nonlinearity == "relu") {
     network.reset(new nn::SigmoidNetwork(layer_sizes));
@@ -205,13 +96,22 @@ int main(int argc, char **argv) {
   }
   constexpr unsigned int epochs = 30, mini_batch_size = 10;
   constexpr float eta = 3.f;
-  network->Sgd(training_data, epochs, mini_batch_size, eta, test_data);
-  for (unsigned int image_idx = 0; image_idx < test_images.size();
-       image_idx++) {
-    DrawImage(test_images[image_idx]);
-    std::cout << "Actual: "
-              << static_cast<unsigned int>(test_labels[image_idx]);
-    const auto output = network->FeedForward(test_data[image_idx].first);
+  if (!model_path.empty() && std::ifstream(model_path).good()) {
+    std::cout << "Loading " << model_path << std::endl;
+    network->Load(model_path);
+  } else {
+    network->Sgd(training_data, epochs, mini_batch_size, eta, &test_data);
+    if (!model_path.empty()) {
+      std::cout << "Saving " << model_path << std::endl;
+      network->Save(model_path);
+    }
+  }
+  nn::Vector<nn::NNType> input(test_data.input_size());
+  for (unsigned int image_idx = 0; image_idx < test_data.size(); image_idx++) {
+    DrawImage(test_data.Image(image_idx));
+    std::cout << "Actual: " << test_data.Label(image_idx);
+    test_data.GetInput(image_idx, input.data());
+    const auto output = network->FeedForward(input);
     std::cout << ", Network: " << nn::GetMaxIndex(output) << std::endl;
   }
 
@@ -0,0 +1,382 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "allocation_counter.hpp"
+#include "dataset.hpp"
+#include "linear_algebra.hpp"
+#include "network.hpp"
+#include "telemetry.hpp"
+#include "transfer_functions.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Vector = nn::Vector<nn::NNType>;
+
+// Number of timed samples per benchmark, of which the median is reported
+constexpr unsigned int kSamples = 5;
+
+// Results are read through this so the compiler can't drop the work
+volatile nn::NNType sink;
+
+struct Result {
+  std::string name;
+  std::uint64_t iterations; // operations per sample
+  double ns_per_op;
+  double gflops;
+  double bytes_per_op;
+};
+
+/**
+ * @brief      This class describes a runner that times benchmarks. Each one
+ * is repeated until a sample takes long enough to time, and the median of
+ * several samples is kept, which is robust to the odd interruption.
+ */
+class Runner {
+public:
+  /**
+   * @brief      Constructs a new instance.
+   *
+   * @param[in]  min_seconds  The minimum time of all samples of a benchmark
+   * @param[in]  filter       Only benchmarks whose name contains this run
+   */
+  Runner(double min_seconds, std::string filter)
+      : min_seconds_(min_seconds), filter_(std::move(filter)) {}
+  /**
+   * @brief      Time a benchmark
+   *
+   * @param[in]  name          The name
+   * @param[in]  flops_per_op  The floating point operations per operation
+   * @param[in]  call          The function to time, which performs
+   * ops_per_call operations
+   * @param[in]  ops_per_call  The number of operations per call
+   */
+  template <typename Call>
+  void Run(const std::string &name, double flops_per_op, Call &&call,
+           unsigned int ops_per_call = 1) {
+    if (name.find(filter_) == std::string::npos) {
+      return;
+    }
+    // Warm up caches and lazily allocated buffers, then find how many calls
+    // a sample needs
+    call();
+    std::uint64_t n_calls = 1;
+    while (TimeCalls_(call, n_calls) < min_seconds_ / kSamples) {
+      n_calls *= 2;
+    }
+    std::vector<double> ns_per_op;
+    const std::size_t bytes_before = BytesAllocated();
+    for (unsigned int sample_idx = 0; sample_idx < kSamples; sample_idx++) {
+      ns_per_op.push_back(TimeCalls_(call, n_calls) * 1e9 /
+                          (n_calls * ops_per_call));
+    }
+    const double total_ops =
+        static_cast<double>(n_calls) * ops_per_call * kSamples;
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    const double median = ns_per_op[kSamples / 2];
+    results_.push_back(Result{name, n_calls * ops_per_call, median,
+                              flops_per_op / median,
+                              (BytesAllocated() - bytes_before) /
+                                  total_ops});
+    std::cerr << "." << std::flush;
+  }
+  const std::vector<Result> &results() const { return results_; }
+
+private:
+  template <typename Call>
+  static double TimeCalls_(Call &call, std::uint64_t n_calls) {
+    const auto start = Clock::now();
+    for (std::uint64_t call_idx = 0; call_idx < n_calls; call_idx++) {
+      call();
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  const double min_seconds_;
+  const std::string filter_;
+  std::vector<Result> results_;
+};
+
+Vector RandomVector(unsigned int length) {
+  return Vector::Random(length, 0.f, 1.f);
+}
+
+void RunMicroBenchmarks(Runner &runner) {
+  for (const unsigned int n : {64u, 256u, 1024u}) {
+    const std::string size = "/" + std::to_string(n);
+    const auto matrix = nn::Matrix<nn::NNType>::Random(n, n, 0.f, 1.f);
+    const auto vector = RandomVector(n);
+    runner.Run("Matrix*Vector" + size, 2. * n * n,
+               [&] { sink = (matrix * vector)[0]; });
+    runner.Run("OuterProduct" + size, 1. * n * n,
+               [&] { sink = vector.OuterProduct(vector)(0, 0); });
+    runner.Run("Transpose" + size, 0.,
+               [&] { sink = matrix.Transpose()(0, 0); });
+  }
+  for (const unsigned int n : {256u, 4096u, 65536u, 1048576u}) {
+    const std::string size = "/" + std::to_string(n);
+    const auto vector1 = RandomVector(n);
+    const auto vector2 = RandomVector(n);
+    runner.Run("Sigmoid" + size, n, [&] { sink = nn::Sigmoid(vector1)[0]; });
+    runner.Run("Relu" + size, n, [&] { sink = nn::Relu(vector1)[0]; });
+    // Expressions are lazy, so evaluate them into a new vector like the
+    // operators used to, and into an existing one for the fused compound
+    runner.Run("Vector+Vector" + size, n,
+               [&] { sink = Vector(vector1 + vector2)[0]; });
+    runner.Run("Vector-Vector" + size, n,
+               [&] { sink = Vector(vector1 - vector2)[0]; });
+    runner.Run("Vector*Vector" + size, n,
+               [&] { sink = Vector(vector1 * vector2)[0]; });
+    runner.Run("Scalar*Vector" + size, n,
+               [&] { sink = Vector(2.f * vector1)[0]; });
+    Vector out(n);
+    runner.Run("Scalar*Vector+Vector" + size, 2. * n, [&] {
+      out = 2.f * vector1 + vector2;
+      sink = out[0];
+    });
+  }
+}
+
+/**
+ * @brief      A data set shaped like MNIST: 28x28 byte images, mostly
+ * background, in 10 classes that each have a template image plus noise, so
+ * that training learns something
+ */
+nn::CompactDataset SyntheticMnist(unsigned int n_examples) {
+  constexpr unsigned int kInputSize = 784;
+  nn::CompactDataset dataset(kInputSize, 10, nn::InputFormat::kUint8,
+                             1.f / 255);
+  dataset.Reserve(n_examples);
+  std::default_random_engine generator(1);
+  std::uniform_real_distribution<nn::NNType> distribution(0.f, 1.f);
+  std::vector<std::vector<nn::NNType>> templates(
+      10, std::vector<nn::NNType>(kInputSize));
+  for (auto &image : templates) {
+    for (auto &value : image) {
+      value = distribution(generator) < 0.2f ? distribution(generator) : 0.f;
+    }
+  }
+  std::vector<nn::NNType> input(kInputSize);
+  for (unsigned int example_idx = 0; example_idx < n_examples; example_idx++) {
+    const auto &image = templates[example_idx % 10];
+    for (unsigned int i = 0; i < kInputSize; i++) {
+      const nn::NNType noise = 0.3f * (distribution(generator) - 0.5f);
+      input[i] = image[i] > 0 ? std::clamp(image[i] + noise, 0.f, 1.f) : 0.f;
+    }
+    dataset.Add(input.data(), example_idx % 10);
+  }
+  return dataset;
+}
+
+void RunMacroBenchmarks(Runner &runner) {
+  const std::vector<unsigned int> layer_sizes = {784, 100, 10};
+  const std::string shape = "/784-100-10";
+  double multiply_adds = 0;
+  for (std::size_t layer_idx = 0; layer_idx + 1 < layer_sizes.size();
+       layer_idx++) {
+    multiply_adds += 1. * layer_sizes[layer_idx] * layer_sizes[layer_idx + 1];
+  }
+  nn::generator.seed(1);
+  nn::BasicNetwork<nn::ReluActivation, nn::SigmoidActivation> network(
+      layer_sizes);
+  const auto input = RandomVector(784);
+  runner.Run("FeedForward" + shape, 2 * multiply_adds,
+             [&] { sink = network.FeedForward(input)[0]; });
+  constexpr unsigned int kBatchSize = 256;
+  const auto inputs =
+      nn::Matrix<nn::NNType>::Random(kBatchSize, 784, 0.f, 1.f);
+  runner.Run("FeedForwardBatch" + shape + "/" + std::to_string(kBatchSize),
+             2 * multiply_adds * kBatchSize,
+             [&] { sink = network.FeedForwardBatch(inputs.View())(0, 0); });
+
+  // Training is timed from the same initial weights every time, reloaded
+  // from a model file: the cost of a step depends on the weights (as
+  // training goes on, more of the arithmetic is on denormal numbers)
+  const std::string initial_weights_path =
+      (std::filesystem::temp_directory_path() / "nn_bench_initial.model")
+          .string();
+  network.Save(initial_weights_path);
+  // A training step is the forward and backward passes (Backprop_) of a
+  // mini-batch and the update, at about three times the work of the forward
+  // pass alone
+  constexpr unsigned int kMiniBatchSize = 10;
+  constexpr unsigned int kStepsPerCall = 100;
+  const auto steps = SyntheticMnist(kMiniBatchSize * kStepsPerCall);
+  nn::TrainingOptions options;
+  options.seed = 1;
+  options.prefetch_depth = 0;
+  runner.Run(
+      "Backprop" + shape + "/" + std::to_string(kMiniBatchSize),
+      6 * multiply_adds * kMiniBatchSize,
+      [&] {
+        network.Load(initial_weights_path);
+        network.Sgd(steps, 1, kMiniBatchSize, 0.1f, nullptr, options);
+      },
+      kStepsPerCall);
+  const auto epoch = SyntheticMnist(60000);
+  options.prefetch_depth = 2;
+  runner.Run("SgdEpoch" + shape + "/60000", 6 * multiply_adds * epoch.size(),
+             [&] {
+               network.Load(initial_weights_path);
+               network.Sgd(epoch, 1, kMiniBatchSize, 0.1f, nullptr, options);
+             });
+  std::filesystem::remove(initial_weights_path);
+}
+
+void WriteJson(std::ostream &out, const std::vector<Result> &results) {
+  out << "{\n  \"benchmarks\": [\n";
+  for (std::size_t result_idx = 0; result_idx < results.size();
+       result_idx++) {
+    const auto &result = results[result_idx];
+    // One benchmark per line, which ReadBaseline relies on
+    out << "    {\"name\": \"" << result.name
+        << "\", \"iterations\": " << result.iterations
+        << ", \"ns_per_op\": " << result.ns_per_op
+        << ", \"gflops\": " << result.gflops
+        << ", \"bytes_allocated_per_op\": " << result.bytes_per_op << "}"
+        << (result_idx + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+}
+
+/**
+ * @brief      Read the ns/op of every benchmark from a file written by
+ * WriteJson
+ */
+std::map<std::string, double> ReadBaseline(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Can't open " + path);
+  }
+  std::map<std::string, double> ns_per_op;
+  const std::string name_key = "\"name\": \"";
+  const std::string time_key = "\"ns_per_op\": ";
+  std::string line;
+  while (std::getline(file, line)) {
+    const auto name_pos = line.find(name_key);
+    const auto time_pos = line.find(time_key);
+    if (name_pos == std::string::npos || time_pos == std::string::npos) {
+      continue;
+    }
+    const auto name_start = name_pos + name_key.size();
+    const auto name = line.substr(name_start, line.find('"', name_start) -
+                                                  name_start);
+    ns_per_op[name] = std::stod(line.substr(time_pos + time_key.size()));
+  }
+  return ns_per_op;
+}
+
+void PrintUsage() {
+  std::cerr
+      << "Micro- and macro-benchmarks of NNLib. Writes JSON results to "
+         "stdout, or to a file.\n"
+         "Options:\n"
+         "  --out <path>         write the JSON results to a file\n"
+         "  --compare <path>     compare with baseline results, and exit "
+         "with status 1 if any benchmark is slower by more than the "
+         "threshold\n"
+         "  --threshold <ratio>  allowed slowdown when comparing (default "
+         "0.1, i.e. 10%)\n"
+         "  --filter <text>      only run benchmarks whose name contains "
+         "the text\n"
+         "  --min-time <s>       minimum time per benchmark (default 0.5)"
+      << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string out_path;
+  std::string baseline_path;
+  std::string filter;
+  double threshold = 0.1;
+  double min_seconds = 0.5;
+  for (int arg_idx = 1; arg_idx < argc; arg_idx++) {
+    const std::string arg = argv[arg_idx];
+    if (arg == "--help") {
+      PrintUsage();
+      return 0;
+    }
+    if (arg_idx + 1 == argc) {
+      PrintUsage();
+      return 2;
+    }
+    const std::string value = argv[++arg_idx];
+    if (arg == "--out") {
+      out_path = value;
+    } else if (arg == "--compare") {
+      baseline_path = value;
+    } else if (arg == "--threshold") {
+      threshold = std::stod(value);
+    } else if (arg == "--filter") {
+      filter = value;
+    } else if (arg == "--min-time") {
+      min_seconds = std::stod(value);
+    } else {
+      PrintUsage();
+      return 2;
+    }
+  }
+  std::map<std::string, double> baseline;
+  if (!baseline_path.empty()) {
+    baseline = ReadBaseline(baseline_path);
+  }
+
+  // The network's messages are discarded, so that stdout only has the
+  // results
+  nn::SetLogSink(nullptr);
+  Runner runner(min_seconds, filter);
+  RunMicroBenchmarks(runner);
+  RunMacroBenchmarks(runner);
+  std::cerr << std::endl;
+
+  unsigned int n_regressions = 0;
+  std::cerr << std::left << std::setw(34) << "benchmark" << std::right
+            << std::setw(14) << "ns/op" << std::setw(10) << "GFLOP/s"
+            << std::setw(14) << "bytes/op"
+            << (baseline.empty() ? "" : "   vs baseline") << "\n";
+  for (const auto &result : runner.results()) {
+    std::cerr << std::left << std::setw(34) << result.name << std::right
+              << std::fixed << std::setprecision(1) << std::setw(14)
+              << result.ns_per_op << std::setprecision(2) << std::setw(10)
+              << result.gflops << std::setprecision(0) << std::setw(14)
+              << result.bytes_per_op;
+    const auto baseline_result = baseline.find(result.name);
+    if (baseline_result != baseline.end()) {
+      const double change = result.ns_per_op / baseline_result->second - 1;
+      std::cerr << std::showpos << std::setprecision(1) << std::setw(10)
+                << change * 100 << "%" << std::noshowpos;
+      if (change > threshold) {
+        std::cerr << "  REGRESSION";
+        n_regressions++;
+      }
+    }
+    std::cerr << "\n";
+  }
+  std::cerr << std::defaultfloat << std::setprecision(6);
+  if (!baseline.empty()) {
+    std::cerr << n_regressions << " regression(s) over "
+              << threshold * 100 << "%" << std::endl;
+  }
+
+  if (out_path.empty()) {
+    WriteJson(std::cout, runner.results());
+  } else {
+    std::ofstream file(out_path);
+    WriteJson(file, runner.results());
+    if (!file) {
+      std::cerr << "Can't write " << out_path << std::endl;
+      return 2;
+    }
+  }
+  return n_regressions > 0 ? 1 : 0;
+}
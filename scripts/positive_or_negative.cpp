@@ -13,12 +13,12 @@ nn::AnnotatedData GenerateAnnotatedData(unsigned int n_examples) {
   std::normal_distribution<nn::NNType> distribution(0.f, 1.f);
   nn::AnnotatedData examples;
   for (unsigned int example_idx = 0; example_idx < n_examples; example_idx++) {
-    nn::Vector input(std::valarray<nn::NNType>({distribution(generator)}));
+    nn::Vector<nn::NNType> input{distribution(generator)};
     nn::Vector<nn::NNType> output(2);
-    if (input.elements[0] > 0) {
-      output = nn::Vector(std::valarray<nn::NNType>({1, 0}));
+    if (input[0] > 0) {
+      output = nn::Vector<nn::NNType>{1, 0};
     } else {
-      output = nn::Vector(std::valarray<nn::NNType>({0, 1}));
+      output = nn::Vector<nn::NNType>{0, 1};
     }
     examples.push_back(std::make_pair(input, output));
   }
@@ -62,11 +62,11 @@ int main(int argc, char **argv) {
     nn::Vector<nn::NNType> input(1);
     std::cout << "Ctrl+C to quit, or enter a float to try out the network: "
               << std::flush;
-    std::cin >> input.elements[0];
+    std::cin >> input[0];
     std::cout << "Input: " << input << std::endl;
     const auto output = network->FeedForward(input);
     std::cout << "Output: " << output << std::endl;
-    if (output.elements[0] > output.elements[1]) {
+    if (output[0] > output[1]) {
       std::cout << "Prediction: positive!" << std::endl;
     } else {
       std::cout << "Prediction: negative!" << std::endl;
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "idx.hpp"
+#include "inference_model.hpp"
+#include "network.hpp"
+#include "quantized_model.hpp"
+
+/**
+ * @brief      Classify every example of a data set with a model, one
+ * Predict call at a time
+ *
+ * @param[in]  model      The model (InferenceModel or QuantizedModel)
+ * @param[in]  test_data  The test data, with labels
+ * @param[out] seconds    The time taken by the Predict calls
+ *
+ * @tparam     Model      The model type
+ *
+ * @return     The number of correctly classified examples
+ */
+template <typename Model>
+unsigned int Evaluate(const Model &model, const nn::Dataset &test_data,
+                      double &seconds) {
+  std::vector<nn::NNType> input(model.input_size());
+  std::vector<nn::NNType> output(model.output_size());
+  unsigned int n_correct = 0;
+  seconds = 0.;
+  for (unsigned int idx = 0; idx < test_data.size(); idx++) {
+    test_data.GetInput(idx, input.data());
+    const auto start = std::chrono::steady_clock::now();
+    model.Predict(input.data(), output.data());
+    seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count();
+    const auto result_idx =
+        std::max_element(output.begin(), output.end()) - output.begin();
+    if (static_cast<unsigned int>(result_idx) == test_data.Label(idx)) {
+      n_correct++;
+    }
+  }
+  return n_correct;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 5 && argc != 6) {
+    std::cout << "INT8 quantisation accuracy report of NNLib" << std::endl;
+    std::cout << "Trains a network on MNIST, quantises it and compares the "
+                 "accuracy and speed of the float and int8 models on the "
+                 "test set. Arguments are the paths to the following files, "
+                 "in this order, then optionally the number of epochs "
+                 "(default 10)"
+              << std::endl;
+    std::cout << "1. train-images.idx3-ubyte: training set images" << std::endl;
+    std::cout << "2. train-labels.idx1-ubyte: training set labels" << std::endl;
+    std::cout << "3. t10k-images.idx3-ubyte:  test set images" << std::endl;
+    std::cout << "4. t10k-labels.idx1-ubyte:  test set labels" << std::endl;
+    return 0;
+  }
+  const nn::IdxDataset training_data(argv[1], argv[2]);
+  const nn::IdxDataset test_data(argv[3], argv[4]);
+  const unsigned int epochs = argc == 6 ? std::stoul(argv[5]) : 10;
+
+  const std::vector<unsigned int> layer_sizes(
+      {training_data.input_size(), 100, training_data.output_size()});
+  nn::SigmoidNetwork network(layer_sizes);
+  constexpr unsigned int mini_batch_size = 10;
+  constexpr float eta = 3.f;
+  network.Sgd(training_data, epochs, mini_batch_size, eta, &test_data);
+
+  // Calibrate on part of the training set, never on the test set
+  constexpr unsigned int n_calibration = 1000;
+  const nn::InferenceModel float_model(network, 1);
+  const nn::QuantizedModel int8_model(network, training_data, n_calibration,
+                                      1);
+
+  double float_seconds, int8_seconds;
+  const unsigned int float_correct =
+      Evaluate(float_model, test_data, float_seconds);
+  const unsigned int int8_correct =
+      Evaluate(int8_model, test_data, int8_seconds);
+  const auto percent = [&test_data](unsigned int n_correct) {
+    return 100. * n_correct / test_data.size();
+  };
+  // Weights and biases
+  std::size_t float_bytes = 0;
+  for (unsigned int layer_idx = 0; layer_idx + 1 < layer_sizes.size();
+       layer_idx++) {
+    float_bytes += sizeof(nn::NNType) * (layer_sizes[layer_idx] + 1) *
+                   layer_sizes[layer_idx + 1];
+  }
+
+  std::cout << "Float: " << float_correct << " / " << test_data.size() << " ("
+            << percent(float_correct) << "%), " << float_bytes << " bytes, "
+            << 1e6 * float_seconds / test_data.size() << " us per example"
+            << std::endl;
+  std::cout << "Int8:  " << int8_correct << " / " << test_data.size() << " ("
+            << percent(int8_correct) << "%), " << int8_model.parameter_bytes()
+            << " bytes, " << 1e6 * int8_seconds / test_data.size()
+            << " us per example" << std::endl;
+  std::cout << "Accuracy delta: "
+            << percent(int8_correct) - percent(float_correct)
+            << " percentage points, kernels: "
+            << nn::kernels::IsaName(nn::kernels::ActiveIsa()) << std::endl;
+  return 0;
+}
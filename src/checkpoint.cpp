@@ -0,0 +1,293 @@
+#include "checkpoint.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "checksum.hpp"
+#include "mapped_file.hpp"
+
+namespace nn {
+
+namespace {
+
+constexpr char kMagic[8] = "NNCKPT";
+constexpr std::uint32_t kByteOrder = 0x01020304;
+
+/**
+ * @brief      The first 64 bytes of a checkpoint file. The rest of the file
+ * is, with no padding: the layer sizes and the activations (as uint32), the
+ * shuffle engine's state, the permutation (as uint32), and then the weights
+ * (row-major) and biases of every layer, each followed by the optimizer's
+ * buffers for it (none in version 1, which only had plain SGD).
+ */
+struct CheckpointHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint32_t n_layers;
+  std::uint32_t mini_batch_size;
+  std::uint32_t epoch_idx;
+  std::uint32_t mini_batch_idx;
+  std::uint32_t n_training;
+  std::uint32_t engine_size;
+  // FNV-1a hash of everything after the header
+  std::uint64_t checksum;
+  // Number of optimizer steps taken, and the OptimizerType (version 2)
+  std::uint64_t optimizer_steps;
+  std::uint32_t optimizer;
+  std::uint8_t reserved[4];
+};
+static_assert(sizeof(CheckpointHeader) == 64);
+
+/**
+ * @brief      Reads consecutive arrays from a mapped file, checking that
+ * they fit
+ */
+class Reader {
+public:
+  Reader(const MappedFile &file, const std::string &path)
+      : file_(file), path_(path), offset_(sizeof(CheckpointHeader)) {}
+  template <typename T> void Read(T *data, std::size_t n) {
+    const std::size_t size = n * sizeof(T);
+    if (size / sizeof(T) != n || size > file_.size() - offset_) {
+      throw std::runtime_error(path_ + " is truncated");
+    }
+    std::memcpy(data, file_.data() + offset_, size);
+    offset_ += size;
+  }
+  bool at_end() const { return offset_ == file_.size(); }
+
+private:
+  const MappedFile &file_;
+  const std::string &path_;
+  std::size_t offset_;
+};
+
+} // namespace
+
+void SaveCheckpoint(const std::string &path, const TrainingState &state) {
+  const std::size_t n_weight_layers = state.weights.size();
+  assert(state.layer_sizes.size() == n_weight_layers + 1);
+  assert(state.activations.size() == n_weight_layers);
+  assert(state.biases.size() == n_weight_layers);
+  CheckpointHeader header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kCheckpointVersion;
+  header.byte_order = kByteOrder;
+  header.n_layers = state.layer_sizes.size();
+  header.mini_batch_size = state.mini_batch_size;
+  header.epoch_idx = state.epoch_idx;
+  header.mini_batch_idx = state.mini_batch_idx;
+  header.n_training = state.permutation.size();
+  header.engine_size = state.shuffle_engine.size();
+  header.optimizer_steps = state.optimizer_state.n_steps;
+  header.optimizer = state.optimizer;
+  const OptimizerState &optimizer_state = state.optimizer_state;
+  const unsigned int n_buffers =
+      OptimizerBuffers(static_cast<OptimizerType>(state.optimizer));
+  assert(optimizer_state.weight_moments.size() ==
+         (n_buffers >= 1 ? n_weight_layers : 0));
+  assert(optimizer_state.weight_second_moments.size() ==
+         (n_buffers >= 2 ? n_weight_layers : 0));
+  std::vector<std::pair<const void *, std::size_t>> blocks = {
+      {&header, sizeof(header)},
+      {state.layer_sizes.data(),
+       state.layer_sizes.size() * sizeof(unsigned int)},
+      {state.activations.data(),
+       state.activations.size() * sizeof(std::uint32_t)},
+      {state.shuffle_engine.data(), state.shuffle_engine.size()},
+      {state.permutation.data(),
+       state.permutation.size() * sizeof(unsigned int)}};
+  for (std::size_t layer_idx = 0; layer_idx < n_weight_layers; layer_idx++) {
+    const auto &weights = state.weights[layer_idx];
+    const auto &biases = state.biases[layer_idx];
+    assert(weights.height == state.layer_sizes[layer_idx + 1]);
+    assert(weights.width == state.layer_sizes[layer_idx]);
+    assert(weights.stride == weights.width);
+    assert(biases.length == weights.height);
+    blocks.emplace_back(weights.data(), weights.size() * sizeof(NNType));
+    blocks.emplace_back(biases.begin(), biases.length * sizeof(NNType));
+    if (n_buffers >= 1) {
+      blocks.emplace_back(optimizer_state.weight_moments[layer_idx].data(),
+                          weights.size() * sizeof(NNType));
+      blocks.emplace_back(optimizer_state.bias_moments[layer_idx].begin(),
+                          biases.length * sizeof(NNType));
+    }
+    if (n_buffers >= 2) {
+      blocks.emplace_back(
+          optimizer_state.weight_second_moments[layer_idx].data(),
+          weights.size() * sizeof(NNType));
+      blocks.emplace_back(
+          optimizer_state.bias_second_moments[layer_idx].begin(),
+          biases.length * sizeof(NNType));
+    }
+  }
+  Fnv1aHash hash;
+  for (std::size_t block_idx = 1; block_idx < blocks.size(); block_idx++) {
+    hash.Update(blocks[block_idx].first, blocks[block_idx].second);
+  }
+  header.checksum = hash.value();
+  WriteFileAtomically(path, blocks);
+}
+
+TrainingState LoadCheckpoint(const std::string &path) {
+  const MappedFile file(path);
+  if (file.size() < sizeof(CheckpointHeader)) {
+    throw std::runtime_error(path + " isn't a checkpoint file");
+  }
+  CheckpointHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error(path + " isn't a checkpoint file");
+  }
+  if (header.byte_order != kByteOrder) {
+    throw std::runtime_error(path + " was written with another byte order");
+  }
+  if (header.version != 1 && header.version != kCheckpointVersion) {
+    throw std::runtime_error(path + " has unsupported format version " +
+                             std::to_string(header.version));
+  }
+  Fnv1aHash hash;
+  hash.Update(file.data() + sizeof(CheckpointHeader),
+              file.size() - sizeof(CheckpointHeader));
+  if (hash.value() != header.checksum) {
+    throw std::runtime_error(path + " is corrupt: its checksum doesn't match");
+  }
+  if (header.n_layers < 2 || header.mini_batch_size == 0 ||
+      header.n_training % header.mini_batch_size != 0 ||
+      (header.mini_batch_idx > 0 &&
+       header.mini_batch_idx >= header.n_training / header.mini_batch_size)) {
+    throw std::runtime_error(path + " has an invalid header");
+  }
+  if (header.version == 1) {
+    header.optimizer_steps = 0;
+    header.optimizer = static_cast<std::uint32_t>(OptimizerType::kSgd);
+  } else if (header.optimizer >
+             static_cast<std::uint32_t>(OptimizerType::kAdam)) {
+    throw std::runtime_error(path + " has an unknown optimizer " +
+                             std::to_string(header.optimizer));
+  }
+  const unsigned int n_buffers =
+      OptimizerBuffers(static_cast<OptimizerType>(header.optimizer));
+  TrainingState state;
+  state.optimizer = header.optimizer;
+  state.optimizer_state.n_steps = header.optimizer_steps;
+  state.mini_batch_size = header.mini_batch_size;
+  state.epoch_idx = header.epoch_idx;
+  state.mini_batch_idx = header.mini_batch_idx;
+  Reader reader(file, path);
+  state.layer_sizes.resize(header.n_layers);
+  reader.Read(state.layer_sizes.data(), state.layer_sizes.size());
+  state.activations.resize(header.n_layers - 1);
+  reader.Read(state.activations.data(), state.activations.size());
+  state.shuffle_engine.resize(header.engine_size);
+  reader.Read(state.shuffle_engine.data(), state.shuffle_engine.size());
+  state.permutation.resize(header.n_training);
+  reader.Read(state.permutation.data(), state.permutation.size());
+  for (const unsigned int example_idx : state.permutation) {
+    if (example_idx >= header.n_training) {
+      throw std::runtime_error(path + " has an invalid permutation");
+    }
+  }
+  for (unsigned int layer_idx = 0; layer_idx + 1 < header.n_layers;
+       layer_idx++) {
+    const unsigned int n_inputs = state.layer_sizes[layer_idx];
+    const unsigned int n_outputs = state.layer_sizes[layer_idx + 1];
+    if (n_inputs == 0 || n_outputs == 0 ||
+        static_cast<std::uint64_t>(n_inputs) * n_outputs > file.size()) {
+      throw std::runtime_error(path + " has an invalid layer " +
+                               std::to_string(layer_idx));
+    }
+    state.weights.emplace_back(n_outputs, n_inputs);
+    reader.Read(state.weights.back().data(), state.weights.back().size());
+    state.biases.emplace_back(n_outputs);
+    reader.Read(state.biases.back().begin(), n_outputs);
+    OptimizerState &optimizer_state = state.optimizer_state;
+    if (n_buffers >= 1) {
+      optimizer_state.weight_moments.emplace_back(n_outputs, n_inputs);
+      reader.Read(optimizer_state.weight_moments.back().data(),
+                  optimizer_state.weight_moments.back().size());
+      optimizer_state.bias_moments.emplace_back(n_outputs);
+      reader.Read(optimizer_state.bias_moments.back().begin(), n_outputs);
+    }
+    if (n_buffers >= 2) {
+      optimizer_state.weight_second_moments.emplace_back(n_outputs, n_inputs);
+      reader.Read(optimizer_state.weight_second_moments.back().data(),
+                  optimizer_state.weight_second_moments.back().size());
+      optimizer_state.bias_second_moments.emplace_back(n_outputs);
+      reader.Read(optimizer_state.bias_second_moments.back().begin(),
+                  n_outputs);
+    }
+  }
+  if (!reader.at_end()) {
+    throw std::runtime_error(path + " has the wrong size for its header");
+  }
+  return state;
+}
+
+CheckpointWriter::CheckpointWriter(std::string path)
+    : path_(std::move(path)), writer_(&CheckpointWriter::WriterLoop_, this) {}
+
+CheckpointWriter::~CheckpointWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  committed_.notify_one();
+  writer_.join();
+}
+
+TrainingState *CheckpointWriter::Begin() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RethrowError_();
+  // The writer thread only reads the state while a checkpoint is pending
+  return pending_ ? nullptr : &state_;
+}
+
+void CheckpointWriter::Commit() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(!pending_);
+    pending_ = true;
+  }
+  committed_.notify_one();
+}
+
+void CheckpointWriter::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  written_.wait(lock, [this] { return !pending_; });
+  RethrowError_();
+}
+
+void CheckpointWriter::WriterLoop_() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    committed_.wait(lock, [this] { return pending_ || stopping_; });
+    if (!pending_) {
+      return;
+    }
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      SaveCheckpoint(path_, state_);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    if (error) {
+      error_ = error;
+    }
+    pending_ = false;
+    written_.notify_all();
+  }
+}
+
+void CheckpointWriter::RethrowError_() {
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+}
+
+} // namespace nn
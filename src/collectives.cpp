@@ -0,0 +1,69 @@
+#include "collectives.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace nn {
+
+void AllReduceSum(Transport &transport, NNType *data, std::size_t n,
+                  std::vector<NNType> &buffer) {
+  const unsigned int size = transport.size();
+  const unsigned int rank = transport.rank();
+  if (size == 1) {
+    return;
+  }
+  // Chunk c is [chunk_start(c), chunk_start(c + 1)) of the array
+  const auto chunk_start = [&](unsigned int chunk_idx) {
+    return chunk_idx * n / size;
+  };
+  const auto chunk_bytes = [&](unsigned int chunk_idx) {
+    return (chunk_start(chunk_idx + 1) - chunk_start(chunk_idx)) *
+           sizeof(NNType);
+  };
+  buffer.resize(std::max(buffer.size(), (n + size - 1) / size));
+  // At every step, each rank adds the partial sum of a chunk from the
+  // previous rank to its own, and passes it on. After size - 1 steps, rank r
+  // has the whole sum of chunk r + 1.
+  for (unsigned int step = 0; step + 1 < size; step++) {
+    const unsigned int send_idx = (rank + size - step) % size;
+    const unsigned int receive_idx = (rank + 2 * size - step - 1) % size;
+    transport.Exchange(data + chunk_start(send_idx), chunk_bytes(send_idx),
+                       buffer.data(), chunk_bytes(receive_idx));
+    NNType *chunk = data + chunk_start(receive_idx);
+    const std::size_t length = chunk_bytes(receive_idx) / sizeof(NNType);
+    for (std::size_t i = 0; i < length; i++) {
+      chunk[i] += buffer[i];
+    }
+  }
+  // Then every whole sum goes around the ring, straight into place
+  for (unsigned int step = 0; step + 1 < size; step++) {
+    const unsigned int send_idx = (rank + 1 + size - step) % size;
+    const unsigned int receive_idx = (rank + size - step) % size;
+    transport.Exchange(data + chunk_start(send_idx), chunk_bytes(send_idx),
+                       data + chunk_start(receive_idx),
+                       chunk_bytes(receive_idx));
+  }
+}
+
+void Broadcast(Transport &transport, void *data, std::size_t n_bytes,
+               unsigned int root) {
+  const unsigned int size = transport.size();
+  assert(root < size);
+  if (size == 1) {
+    return;
+  }
+  // The rank at distance d from the root gets the bytes at exchange d, and
+  // what the other ranks receive is dropped
+  const unsigned int distance = (transport.rank() + size - root) % size;
+  std::vector<std::uint8_t> buffer(n_bytes);
+  for (unsigned int exchange_idx = 1; exchange_idx < size; exchange_idx++) {
+    transport.Exchange(data, n_bytes, buffer.data(), n_bytes);
+    if (exchange_idx == distance) {
+      std::memcpy(data, buffer.data(), n_bytes);
+    }
+  }
+}
+
+} // namespace nn
@@ -0,0 +1,93 @@
+#include "dataset.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include "float16.hpp"
+
+namespace nn {
+
+CompactDataset::CompactDataset(unsigned int input_size, unsigned int n_classes,
+                               InputFormat format, NNType scale)
+    : input_size_(input_size), n_classes_(n_classes), format_(format),
+      scale_(scale) {
+  assert(n_classes <= 65536);
+  assert(scale > 0);
+}
+
+CompactDataset CompactDataset::FromDataset(const Dataset &source,
+                                           InputFormat format, NNType scale) {
+  CompactDataset dataset(source.input_size(), source.output_size(), format,
+                         scale);
+  dataset.Reserve(source.size());
+  std::vector<NNType> input(source.input_size());
+  std::vector<NNType> ground_truth(source.output_size());
+  for (unsigned int idx = 0; idx < source.size(); idx++) {
+    source.GetInput(idx, input.data());
+    unsigned int label;
+    if (source.has_labels()) {
+      label = source.Label(idx);
+    } else {
+      source.GetGroundTruth(idx, ground_truth.data());
+      label = std::max_element(ground_truth.begin(), ground_truth.end()) -
+              ground_truth.begin();
+    }
+    dataset.Add(input.data(), label);
+  }
+  return dataset;
+}
+
+void CompactDataset::Reserve(unsigned int n_examples) {
+  inputs_.reserve(n_examples * BytesPerInput_());
+  labels_.reserve(n_examples);
+}
+
+void CompactDataset::Add(const NNType *input, unsigned int label) {
+  assert(label < n_classes_);
+  const std::size_t offset = inputs_.size();
+  inputs_.resize(offset + BytesPerInput_());
+  if (format_ == InputFormat::kUint8) {
+    std::uint8_t *bytes = inputs_.data() + offset;
+    for (unsigned int i = 0; i < input_size_; i++) {
+      const NNType units = std::round(input[i] / scale_);
+      bytes[i] = static_cast<std::uint8_t>(
+          std::min(std::max(units, static_cast<NNType>(0)),
+                   static_cast<NNType>(255)));
+    }
+  } else {
+    for (unsigned int i = 0; i < input_size_; i++) {
+      const std::uint16_t half = FloatToHalf(input[i] / scale_);
+      std::memcpy(inputs_.data() + offset + 2 * i, &half, sizeof(half));
+    }
+  }
+  labels_.push_back(label);
+}
+
+void CompactDataset::GetInput(unsigned int idx, NNType *input) const {
+  assert(idx < size());
+  const std::uint8_t *bytes = inputs_.data() + idx * BytesPerInput_();
+  if (format_ == InputFormat::kUint8) {
+    for (unsigned int i = 0; i < input_size_; i++) {
+      input[i] = static_cast<NNType>(bytes[i]) * scale_;
+    }
+  } else {
+    for (unsigned int i = 0; i < input_size_; i++) {
+      std::uint16_t half;
+      std::memcpy(&half, bytes + 2 * i, sizeof(half));
+      input[i] = HalfToFloat(half) * scale_;
+    }
+  }
+}
+
+void CompactDataset::GetGroundTruth(unsigned int idx,
+                                    NNType *ground_truth) const {
+  std::fill(ground_truth, ground_truth + n_classes_, static_cast<NNType>(0));
+  ground_truth[Label(idx)] = static_cast<NNType>(1);
+}
+
+std::size_t CompactDataset::BytesPerInput_() const {
+  return static_cast<std::size_t>(input_size_) *
+         (format_ == InputFormat::kUint8 ? 1 : 2);
+}
+
+} // namespace nn
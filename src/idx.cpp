@@ -0,0 +1,97 @@
+#include "idx.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace nn {
+
+namespace {
+
+/**
+ * @brief      Convert four big-endian bytes into a number
+ */
+unsigned int FourBytesToNumber(const std::uint8_t *bytes) {
+  return (static_cast<unsigned int>(bytes[0]) << 24) +
+         (static_cast<unsigned int>(bytes[1]) << 16) +
+         (static_cast<unsigned int>(bytes[2]) << 8) +
+         (static_cast<unsigned int>(bytes[3]));
+}
+
+} // namespace
+
+IdxFile::IdxFile(const std::string &path) : file_(path), data_(nullptr) {
+  // Header: two zero bytes, the element type, the number of dimensions and
+  // then the size of each dimension
+  const auto *bytes = file_.data();
+  const unsigned int n_dims = file_.size() >= 4 ? bytes[3] : 0;
+  const std::size_t header_size = 4 + 4 * static_cast<std::size_t>(n_dims);
+  if (n_dims == 0 || bytes[0] != 0 || bytes[1] != 0 || bytes[2] != 0x08 ||
+      header_size > file_.size()) {
+    throw std::runtime_error(path + " isn't an unsigned byte IDX file");
+  }
+  for (unsigned int dim_idx = 0; dim_idx < n_dims; dim_idx++) {
+    dims_.push_back(FourBytesToNumber(bytes + 4 + 4 * dim_idx));
+  }
+  data_ = bytes + header_size;
+  if (header_size + size() != file_.size()) {
+    throw std::runtime_error(path + " has the wrong size for its header");
+  }
+}
+
+std::size_t IdxFile::size() const {
+  std::size_t size = 1;
+  for (const auto dim : dims_) {
+    size *= dim;
+  }
+  return size;
+}
+
+MatrixView<const std::uint8_t> IdxFile::Items() const {
+  unsigned int item_size = 1;
+  for (unsigned int dim_idx = 1; dim_idx < dims_.size(); dim_idx++) {
+    item_size *= dims_[dim_idx];
+  }
+  return MatrixView<const std::uint8_t>(data_, dims_.front(), item_size,
+                                        item_size);
+}
+
+IdxDataset::IdxDataset(const std::string &images_path,
+                       const std::string &labels_path, unsigned int n_classes,
+                       NNType scale)
+    : images_(images_path), labels_(labels_path), n_classes_(n_classes),
+      scale_(scale) {
+  if (labels_.dims().size() != 1 ||
+      labels_.dims().front() != images_.dims().front()) {
+    throw std::runtime_error(labels_path + " doesn't have one label per image");
+  }
+  const auto *labels = labels_.data();
+  const auto out_of_range = [n_classes](std::uint8_t label) {
+    return label >= n_classes;
+  };
+  if (std::any_of(labels, labels + labels_.size(), out_of_range)) {
+    throw std::runtime_error(labels_path + " has labels out of range");
+  }
+}
+
+void IdxDataset::GetInput(unsigned int idx, NNType *input) const {
+  const auto image = images_.Items().Row(idx);
+  const std::uint8_t *pixels = image.data();
+  for (unsigned int pixel_idx = 0; pixel_idx < image.length; pixel_idx++) {
+    input[pixel_idx] = static_cast<NNType>(pixels[pixel_idx]) * scale_;
+  }
+}
+
+void IdxDataset::GetGroundTruth(unsigned int idx, NNType *ground_truth) const {
+  std::fill(ground_truth, ground_truth + n_classes_, static_cast<NNType>(0));
+  ground_truth[Label(idx)] = static_cast<NNType>(1);
+}
+
+MatrixView<const std::uint8_t> IdxDataset::Image(unsigned int idx) const {
+  const auto &dims = images_.dims();
+  assert(dims.size() == 3);
+  return MatrixView<const std::uint8_t>(images_.Items().Row(idx).data(),
+                                        dims[1], dims[2], dims[2]);
+}
+
+} // namespace nn
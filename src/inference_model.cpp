@@ -0,0 +1,157 @@
+#include "inference_model.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+#include <type_traits>
+
+#include "network.hpp"
+
+namespace nn {
+
+namespace {
+
+static_assert(std::is_same_v<NNType, float>,
+              "InferenceModel runs on the single precision kernels");
+
+// Elements per cache line
+constexpr unsigned int kLineElements = kAlignment / sizeof(NNType);
+
+unsigned int RoundUpToLine(unsigned int n_elements) {
+  return (n_elements + kLineElements - 1) / kLineElements * kLineElements;
+}
+
+/**
+ * @brief      Elements of a scratch buffer, enough for any layer's outputs
+ */
+unsigned int ScratchStride(const std::vector<unsigned int> &layer_sizes) {
+  return RoundUpToLine(
+      *std::max_element(layer_sizes.begin() + 1, layer_sizes.end()));
+}
+
+} // namespace
+
+ScratchSlots::ScratchSlots(unsigned int n_slots, std::size_t slot_size)
+    : n_slots_(n_slots > 0 ? n_slots
+                           : std::max(std::thread::hardware_concurrency(), 1u)),
+      slot_size_((slot_size + kAlignment - 1) / kAlignment * kAlignment),
+      buffer_(AllocateAligned<unsigned char>(n_slots_ * slot_size_)),
+      flags_(new Flag[n_slots_]) {}
+
+unsigned int ScratchSlots::Acquire() const {
+  // Every thread starts looking from its own slot, so that up to n_slots_
+  // threads calling repeatedly each keep finding their slot free
+  static std::atomic<unsigned int> n_threads_seen{0};
+  thread_local const unsigned int thread_idx =
+      n_threads_seen.fetch_add(1, std::memory_order_relaxed);
+  for (unsigned int attempt = 0;; attempt++) {
+    const unsigned int slot_idx = (thread_idx + attempt) % n_slots_;
+    auto &busy = flags_[slot_idx].busy;
+    if (!busy.load(std::memory_order_relaxed) &&
+        !busy.exchange(true, std::memory_order_acquire)) {
+      return slot_idx;
+    }
+    if ((attempt + 1) % n_slots_ == 0) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+InferenceModel::InferenceModel(const Network &network, unsigned int n_slots)
+    : parameters_(nullptr), n_parameters_(0),
+      scratch_stride_(ScratchStride(network.layer_sizes_)),
+      slots_(n_slots, 2 * sizeof(NNType) * scratch_stride_) {
+  // Lay out every layer's weights then biases, each starting on a cache line
+  std::size_t n_parameters = 0;
+  for (unsigned int layer_idx = 0; layer_idx < network.num_layers_ - 1;
+       layer_idx++) {
+    Layer layer;
+    layer.n_inputs = network.layer_sizes_[layer_idx];
+    layer.n_outputs = network.layer_sizes_[layer_idx + 1];
+    layer.stride = RoundUpToLine(layer.n_inputs);
+    layer.weights_offset = n_parameters;
+    n_parameters += static_cast<std::size_t>(layer.n_outputs) * layer.stride;
+    layer.biases_offset = n_parameters;
+    n_parameters += RoundUpToLine(layer.n_outputs);
+    layer.activation = network.LayerActivation_(layer_idx);
+    layers_.push_back(layer);
+  }
+  owned_parameters_ = AllocateAligned<NNType>(n_parameters);
+  NNType *parameters = owned_parameters_.get();
+  std::fill(parameters, parameters + n_parameters, 0.f);
+  for (unsigned int layer_idx = 0; layer_idx < layers_.size(); layer_idx++) {
+    const auto &layer = layers_[layer_idx];
+    const auto &weights = network.weights_[layer_idx];
+    for (unsigned int row_idx = 0; row_idx < layer.n_outputs; row_idx++) {
+      const auto row = weights.Row(row_idx);
+      std::copy(row.data(), row.data() + layer.n_inputs,
+                parameters + layer.weights_offset +
+                    static_cast<std::size_t>(row_idx) * layer.stride);
+    }
+    const auto &biases = network.biases_[layer_idx];
+    std::copy(biases.begin(), biases.end(),
+              parameters + layer.biases_offset);
+  }
+  parameters_ = parameters;
+  n_parameters_ = n_parameters;
+}
+
+InferenceModel::InferenceModel(const std::string &path, unsigned int n_slots,
+                               bool verify_checksum)
+    : InferenceModel(ModelFile(path, verify_checksum), n_slots) {}
+
+InferenceModel::InferenceModel(ModelFile &&file, unsigned int n_slots)
+    : file_(std::move(file)), parameters_(file_->parameters()),
+      n_parameters_(file_->n_parameters()),
+      scratch_stride_(ScratchStride(file_->layer_sizes())),
+      slots_(n_slots, 2 * sizeof(NNType) * scratch_stride_) {
+  // The file has the same layout as the constructor from a network makes
+  for (const auto &file_layer : file_->layers()) {
+    Layer layer;
+    layer.n_inputs = file_layer.n_inputs;
+    layer.n_outputs = file_layer.n_outputs;
+    layer.stride = file_layer.stride;
+    layer.weights_offset = file_layer.weights_offset;
+    layer.biases_offset = file_layer.biases_offset;
+    layer.activation = static_cast<kernels::Activation>(file_layer.activation);
+    layers_.push_back(layer);
+  }
+}
+
+void InferenceModel::Save(const std::string &path) const {
+  std::vector<ModelFileLayer> file_layers;
+  for (const auto &layer : layers_) {
+    ModelFileLayer file_layer;
+    file_layer.n_inputs = layer.n_inputs;
+    file_layer.n_outputs = layer.n_outputs;
+    file_layer.stride = layer.stride;
+    file_layer.activation = static_cast<std::uint32_t>(layer.activation);
+    file_layer.weights_offset = layer.weights_offset;
+    file_layer.biases_offset = layer.biases_offset;
+    file_layers.push_back(file_layer);
+  }
+  ModelFile::Write(path, file_layers, parameters_, n_parameters_);
+}
+
+void InferenceModel::Predict(const NNType *input, NNType *output) const {
+  const unsigned int slot_idx = slots_.Acquire();
+  auto *scratch = static_cast<NNType *>(slots_.data(slot_idx));
+  const NNType *layer_input = input;
+  for (unsigned int layer_idx = 0; layer_idx < layers_.size(); layer_idx++) {
+    const auto &layer = layers_[layer_idx];
+    // The last layer writes straight to the output
+    NNType *layer_output = layer_idx + 1 == layers_.size()
+                               ? output
+                               : scratch + (layer_idx % 2) * scratch_stride_;
+    kernels::Sgemv(false, layer.n_outputs, layer.n_inputs, 1.f,
+                   parameters_ + layer.weights_offset, layer.stride,
+                   layer_input, 0.f, layer_output);
+    kernels::BiasActivation(layer.activation, 1, layer.n_outputs,
+                            parameters_ + layer.biases_offset,
+                            layer_output, layer.n_outputs);
+    layer_input = layer_output;
+  }
+  slots_.Release(slot_idx);
+}
+
+} // namespace nn
@@ -0,0 +1,579 @@
+#include "kernels.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "kernels_internal.hpp"
+#include "linear_algebra.hpp"
+
+namespace nn {
+namespace kernels {
+
+float *PackingBuffer(unsigned int index, std::size_t size) {
+  struct Buffer {
+    AlignedBuffer<float> data;
+    std::size_t size = 0;
+  };
+  thread_local std::vector<Buffer> buffers;
+  if (buffers.size() <= index) {
+    buffers.resize(index + 1);
+  }
+  auto &buffer = buffers[index];
+  if (buffer.size < size) {
+    buffer.data = AllocateAligned<float>(size);
+    buffer.size = size;
+  }
+  return buffer.data.get();
+}
+
+void ReserveScratch() {
+  // The panels of GemmDriver, which are whole register tiles of every
+  // instruction set (kMr of 4, 6 or 8 and kNr of 16 or 32) without rounding
+  static_assert(kMc % 24 == 0 && kNc % 32 == 0,
+                "Panels must be whole register tiles");
+  PackingBuffer(0, static_cast<std::size_t>(kMc) * kKc);
+  PackingBuffer(1, static_cast<std::size_t>(kKc) * kNc);
+}
+
+namespace generic {
+
+namespace {
+
+/**
+ * @brief      Portable micro-kernel, written so that the compiler can keep the
+ * tile in registers and auto-vectorise the inner loop
+ */
+struct Kernel {
+  static constexpr unsigned int kMr = 4;
+  static constexpr unsigned int kNr = 16;
+  static void Run(unsigned int kc, const float *a, const float *b, float *c,
+                  unsigned int ldc) {
+    float accumulators[kMr][kNr] = {};
+    for (unsigned int p = 0; p < kc; p++) {
+      for (unsigned int r = 0; r < kMr; r++) {
+        const float scale = a[r];
+        for (unsigned int col = 0; col < kNr; col++) {
+          accumulators[r][col] += scale * b[col];
+        }
+      }
+      a += kMr;
+      b += kNr;
+    }
+    for (unsigned int r = 0; r < kMr; r++) {
+      float *row = c + static_cast<std::size_t>(r) * ldc;
+      for (unsigned int col = 0; col < kNr; col++) {
+        row[col] += accumulators[r][col];
+      }
+    }
+  }
+};
+
+} // namespace
+
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+void SgemmFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                  unsigned int n, unsigned int k, float alpha, const float *a,
+                  unsigned int lda, const Float16 *b, unsigned int ldb,
+                  float beta, float *c, unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+void SgemmBFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                   unsigned int n, unsigned int k, float alpha, const float *a,
+                   unsigned int lda, const BFloat16 *b, unsigned int ldb,
+                   float beta, float *c, unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+namespace {
+
+template <typename Element>
+void SgemvImpl(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+               const Element *a, unsigned int lda, const float *x, float beta,
+               float *y) {
+  if (!transpose_a) {
+    // One dot product per row
+    for (unsigned int i = 0; i < m; i++) {
+      const Element *row = a + static_cast<std::size_t>(i) * lda;
+      float sum = 0.f;
+      for (unsigned int j = 0; j < n; j++) {
+        sum += ToFloat(row[j]) * x[j];
+      }
+      y[i] = alpha * sum + (beta == 0.f ? 0.f : beta * y[i]);
+    }
+    return;
+  }
+  // Accumulate scaled rows, so A is still read contiguously
+  for (unsigned int j = 0; j < n; j++) {
+    y[j] = beta == 0.f ? 0.f : beta * y[j];
+  }
+  for (unsigned int i = 0; i < m; i++) {
+    const Element *row = a + static_cast<std::size_t>(i) * lda;
+    const float scale = alpha * x[i];
+    for (unsigned int j = 0; j < n; j++) {
+      y[j] += scale * ToFloat(row[j]);
+    }
+  }
+}
+
+} // namespace
+
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void SgemvFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                  float alpha, const Float16 *a, unsigned int lda,
+                  const float *x, float beta, float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void SgemvBFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                   float alpha, const BFloat16 *a, unsigned int lda,
+                   const float *x, float beta, float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx) {
+  for (unsigned int i = 0; i < m; i++) {
+    float *row = x + static_cast<std::size_t>(i) * ldx;
+    if (activation == Activation::kSigmoid) {
+      for (unsigned int j = 0; j < n; j++) {
+        row[j] = 1.f / (1.f + std::exp(-(row[j] + bias[j])));
+      }
+    } else {
+      for (unsigned int j = 0; j < n; j++) {
+        row[j] = std::max(row[j] + bias[j], 0.f);
+      }
+    }
+  }
+}
+
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd) {
+  for (unsigned int i = 0; i < m; i++) {
+    const float *a_row = activations + static_cast<std::size_t>(i) * lda;
+    float *d_row = d + static_cast<std::size_t>(i) * ldd;
+    if (activation == Activation::kSigmoid) {
+      for (unsigned int j = 0; j < n; j++) {
+        d_row[j] *= a_row[j] * (1.f - a_row[j]);
+      }
+    } else {
+      for (unsigned int j = 0; j < n; j++) {
+        d_row[j] = a_row[j] > 0.f ? d_row[j] : 0.f;
+      }
+    }
+  }
+}
+
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y) {
+  for (unsigned int i = 0; i < m; i++) {
+    const std::int8_t *row = a + static_cast<std::size_t>(i) * lda;
+    std::int32_t sum = 0;
+    for (unsigned int j = 0; j < n; j++) {
+      sum += static_cast<std::int32_t>(row[j]) * x[j];
+    }
+    y[i] = sum;
+  }
+}
+
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q) {
+  for (unsigned int i = 0; i < n; i++) {
+    const float value = x[i] * scale + offset;
+    q[i] = static_cast<std::uint8_t>(std::min(std::max(value, 0.f), 127.f));
+  }
+}
+
+void ConvertToFloat16(unsigned int n, const float *x, Float16 *y) {
+  for (unsigned int i = 0; i < n; i++) {
+    y[i].bits = FloatToHalf(x[i]);
+  }
+}
+
+void ConvertToBFloat16(unsigned int n, const float *x, BFloat16 *y) {
+  for (unsigned int i = 0; i < n; i++) {
+    y[i].bits = FloatToBfloat16(x[i]);
+  }
+}
+
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters) {
+  for (unsigned int i = 0; i < n; i++) {
+    MomentumUpdate1(learning_rate, momentum, nesterov, gradients[i],
+                    velocities[i], parameters[i]);
+  }
+}
+
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters) {
+  for (unsigned int i = 0; i < n; i++) {
+    AdamUpdate1(gradient_scale, beta1, beta2, step_size, epsilon, gradients[i],
+                moments[i], second_moments[i], parameters[i]);
+  }
+}
+
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values) {
+  unsigned int count = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    if (x[i] != 0.f) {
+      indices[count] = i;
+      values[count] = x[i];
+      count++;
+    }
+  }
+  return count;
+}
+
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc) {
+  // One sparse dot product per element of C, gathering from a row of B
+  for (unsigned int i = 0; i < m; i++) {
+    for (unsigned int j = 0; j < n; j++) {
+      const float *b_row = b + std::size_t{j} * ldb;
+      float sum = 0.f;
+      for (unsigned int p = row_offsets[i]; p < row_offsets[i + 1]; p++) {
+        sum += values[p] * b_row[columns[p]];
+      }
+      c[std::size_t{i} * ldc + j] = sum;
+    }
+  }
+}
+
+void SparseOuterProducts(unsigned int m, unsigned int n, unsigned int k,
+                         const float *d, unsigned int ldd,
+                         const unsigned int *row_offsets,
+                         const unsigned int *columns, const float *values,
+                         float *c, unsigned int ldc) {
+  // Row by row of C, so the scattered updates stay within one row
+  for (unsigned int j = 0; j < n; j++) {
+    float *c_row = c + std::size_t{j} * ldc;
+    std::fill(c_row, c_row + k, 0.f);
+    for (unsigned int i = 0; i < m; i++) {
+      const float scale = d[std::size_t{i} * ldd + j];
+      for (unsigned int p = row_offsets[i]; p < row_offsets[i + 1]; p++) {
+        c_row[columns[p]] += values[p] * scale;
+      }
+    }
+  }
+}
+
+} // namespace generic
+
+namespace {
+
+struct Dispatch {
+  decltype(&generic::Sgemm) sgemm;
+  decltype(&generic::Sgemv) sgemv;
+  decltype(&generic::BiasActivation) bias_activation;
+  decltype(&generic::MultiplyActivationPrime) multiply_activation_prime;
+  decltype(&generic::Int8Gemv) int8_gemv;
+  decltype(&generic::QuantizeInputs) quantize_inputs;
+  decltype(&generic::SgemmFloat16) sgemm_float16;
+  decltype(&generic::SgemmBFloat16) sgemm_bfloat16;
+  decltype(&generic::SgemvFloat16) sgemv_float16;
+  decltype(&generic::SgemvBFloat16) sgemv_bfloat16;
+  decltype(&generic::ConvertToFloat16) convert_to_float16;
+  decltype(&generic::ConvertToBFloat16) convert_to_bfloat16;
+  decltype(&generic::MomentumUpdate) momentum_update;
+  decltype(&generic::AdamUpdate) adam_update;
+  decltype(&generic::CompressNonZeros) compress_non_zeros;
+  decltype(&generic::SparseGemm) sparse_gemm;
+  decltype(&generic::SparseOuterProducts) sparse_outer_products;
+  Isa isa;
+};
+
+/**
+ * @brief      Whether the CPU and operating system support the AVX-512 BW and
+ * VNNI extensions used by the avx512_vnni integer kernels
+ */
+bool HasAvx512Vnni() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+    return false;
+  }
+  unsigned int xcr0_low, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  if ((xcr0_low & 0xe6) != 0xe6 ||
+      !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (ebx & bit_AVX512BW) && (ecx & bit_AVX512VNNI);
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief      The integer kernel of the AVX-512 tier: VNNI if the CPU has it,
+ * and otherwise the AVX2 one, as DetectIsa only picks the tier on CPUs with
+ * AVX2
+ */
+decltype(&generic::Int8Gemv) Avx512Int8Gemv() {
+#ifdef NN_HAVE_AVX512_VNNI_KERNELS
+  if (HasAvx512Vnni()) {
+    return avx512_vnni::Int8Gemv;
+  }
+#endif
+#ifdef NN_HAVE_AVX2_KERNELS
+  return avx2::Int8Gemv;
+#else
+  return generic::Int8Gemv;
+#endif
+}
+
+Dispatch MakeDispatch(Isa isa) {
+  switch (isa) {
+#ifdef NN_HAVE_AVX512_KERNELS
+  case Isa::kAvx512:
+    return {avx512::Sgemm, avx512::Sgemv, avx512::BiasActivation,
+            avx512::MultiplyActivationPrime, Avx512Int8Gemv(),
+            avx512::QuantizeInputs, avx512::SgemmFloat16,
+            avx512::SgemmBFloat16, avx512::SgemvFloat16,
+            avx512::SgemvBFloat16, avx512::ConvertToFloat16,
+            avx512::ConvertToBFloat16, avx512::MomentumUpdate,
+            avx512::AdamUpdate, avx512::CompressNonZeros,
+            avx512::SparseGemm, avx512::SparseOuterProducts, isa};
+#endif
+#ifdef NN_HAVE_AVX2_KERNELS
+  case Isa::kAvx2:
+    return {avx2::Sgemm, avx2::Sgemv, avx2::BiasActivation,
+            avx2::MultiplyActivationPrime, avx2::Int8Gemv,
+            avx2::QuantizeInputs, avx2::SgemmFloat16,
+            avx2::SgemmBFloat16, avx2::SgemvFloat16,
+            avx2::SgemvBFloat16, avx2::ConvertToFloat16,
+            avx2::ConvertToBFloat16, avx2::MomentumUpdate,
+            avx2::AdamUpdate, avx2::CompressNonZeros, avx2::SparseGemm,
+            // AVX2 has no scatter, so updating scattered columns gains nothing
+            generic::SparseOuterProducts, isa};
+#endif
+  default:
+    return {generic::Sgemm, generic::Sgemv, generic::BiasActivation,
+            generic::MultiplyActivationPrime, generic::Int8Gemv,
+            generic::QuantizeInputs, generic::SgemmFloat16,
+            generic::SgemmBFloat16, generic::SgemvFloat16,
+            generic::SgemvBFloat16, generic::ConvertToFloat16,
+            generic::ConvertToBFloat16, generic::MomentumUpdate,
+            generic::AdamUpdate, generic::CompressNonZeros,
+            generic::SparseGemm, generic::SparseOuterProducts, Isa::kGeneric};
+  }
+}
+
+Dispatch &ActiveDispatch() {
+  static Dispatch dispatch = [] {
+    Isa isa = DetectIsa();
+    // Allow forcing a less capable instruction set, e.g. for debugging
+    if (const char *name = std::getenv("NN_KERNEL_ISA")) {
+      for (const auto candidate : {Isa::kGeneric, Isa::kAvx2, Isa::kAvx512}) {
+        if (std::strcmp(name, IsaName(candidate)) == 0 && candidate <= isa) {
+          isa = candidate;
+        }
+      }
+    }
+    return MakeDispatch(isa);
+  }();
+  return dispatch;
+}
+
+} // namespace
+
+Isa DetectIsa() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return Isa::kGeneric;
+  }
+  const bool has_fma = ecx & bit_FMA;
+  // Half precision conversions, used by the mixed precision kernels
+  const bool has_f16c = ecx & bit_F16C;
+  const bool has_osxsave = ecx & bit_OSXSAVE;
+  if (!has_osxsave) {
+    return Isa::kGeneric;
+  }
+  // Which register states the operating system saves on context switches
+  unsigned int xcr0_low, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  const bool os_saves_ymm = (xcr0_low & 0x6) == 0x6;
+  const bool os_saves_zmm = (xcr0_low & 0xe6) == 0xe6;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return Isa::kGeneric;
+  }
+  const bool has_avx2 = ebx & bit_AVX2;
+  const bool has_avx512f = ebx & bit_AVX512F;
+#ifdef NN_HAVE_AVX512_KERNELS
+  // The AVX-512 kernels are also built with FMA, and fall back on the AVX2
+  // integer kernel
+  if (has_avx512f && has_avx2 && has_fma && has_f16c && os_saves_zmm) {
+    return Isa::kAvx512;
+  }
+#endif
+#ifdef NN_HAVE_AVX2_KERNELS
+  if (has_avx2 && has_fma && has_f16c && os_saves_ymm) {
+    return Isa::kAvx2;
+  }
+#endif
+  (void)has_fma, (void)has_f16c, (void)has_avx2, (void)has_avx512f;
+  (void)os_saves_ymm, (void)os_saves_zmm;
+#endif
+  return Isa::kGeneric;
+}
+
+Isa ActiveIsa() { return ActiveDispatch().isa; }
+
+bool SetIsa(Isa isa) {
+  if (isa > DetectIsa()) {
+    return false;
+  }
+  ActiveDispatch() = MakeDispatch(isa);
+  return true;
+}
+
+const char *IsaName(Isa isa) {
+  switch (isa) {
+  case Isa::kAvx512:
+    return "avx512";
+  case Isa::kAvx2:
+    return "avx2";
+  default:
+    return "generic";
+  }
+}
+
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc) {
+  ActiveDispatch().sgemm(transpose_a, transpose_b, m, n, k, alpha, a, lda, b,
+                         ldb, beta, c, ldc);
+}
+
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y) {
+  ActiveDispatch().sgemv(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx) {
+  ActiveDispatch().bias_activation(activation, m, n, bias, x, ldx);
+}
+
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd) {
+  ActiveDispatch().multiply_activation_prime(activation, m, n, activations,
+                                             lda, d, ldd);
+}
+
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const Float16 *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc) {
+  ActiveDispatch().sgemm_float16(transpose_a, transpose_b, m, n, k, alpha, a,
+                                 lda, b, ldb, beta, c, ldc);
+}
+
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const BFloat16 *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc) {
+  ActiveDispatch().sgemm_bfloat16(transpose_a, transpose_b, m, n, k, alpha, a,
+                                  lda, b, ldb, beta, c, ldc);
+}
+
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const Float16 *a, unsigned int lda, const float *x, float beta,
+           float *y) {
+  ActiveDispatch().sgemv_float16(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const BFloat16 *a, unsigned int lda, const float *x, float beta,
+           float *y) {
+  ActiveDispatch().sgemv_bfloat16(transpose_a, m, n, alpha, a, lda, x, beta,
+                                  y);
+}
+
+void ConvertToHalf(unsigned int n, const float *x, Float16 *y) {
+  ActiveDispatch().convert_to_float16(n, x, y);
+}
+
+void ConvertToHalf(unsigned int n, const float *x, BFloat16 *y) {
+  ActiveDispatch().convert_to_bfloat16(n, x, y);
+}
+
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y) {
+  ActiveDispatch().int8_gemv(m, n, a, lda, x, y);
+}
+
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q) {
+  ActiveDispatch().quantize_inputs(n, x, scale, offset, q);
+}
+
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters) {
+  ActiveDispatch().momentum_update(n, learning_rate, momentum, nesterov,
+                                   gradients, velocities, parameters);
+}
+
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters) {
+  ActiveDispatch().adam_update(n, gradient_scale, beta1, beta2, step_size,
+                               epsilon, gradients, moments, second_moments,
+                               parameters);
+}
+
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values) {
+  return ActiveDispatch().compress_non_zeros(n, x, indices, values);
+}
+
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc) {
+  ActiveDispatch().sparse_gemm(m, n, row_offsets, columns, values, b, ldb, c,
+                               ldc);
+}
+
+void SparseOuterProducts(unsigned int m, unsigned int n, unsigned int k,
+                         const float *d, unsigned int ldd,
+                         const unsigned int *row_offsets,
+                         const unsigned int *columns, const float *values,
+                         float *c, unsigned int ldc) {
+  ActiveDispatch().sparse_outer_products(m, n, k, d, ldd, row_offsets, columns,
+                                         values, c, ldc);
+}
+
+} // namespace kernels
+} // namespace nn
@@ -0,0 +1,611 @@
+// AVX2 + FMA kernels. Compiled with -mavx2 -mfma -mf16c, and only called after
+// DetectIsa has checked the CPU supports them.
+#include <immintrin.h>
+
+#include "kernels_internal.hpp"
+
+namespace nn {
+namespace kernels {
+namespace avx2 {
+
+namespace {
+
+/**
+ * @brief      Sum of the eight lanes of a register
+ */
+inline float HorizontalSum(__m256 x) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+  return _mm_cvtss_f32(sum);
+}
+
+/**
+ * @brief      Sum of the eight lanes of an integer register
+ */
+inline std::int32_t HorizontalSum(__m256i x) {
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(x),
+                              _mm256_extracti128_si256(x, 1));
+  sum = _mm_add_epi32(sum, _mm_unpackhi_epi64(sum, sum));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 1));
+  return _mm_cvtsi128_si32(sum);
+}
+
+/**
+ * @brief      Add the products of 32 unsigned and signed bytes to eight int32
+ * sums, in groups of four consecutive bytes. Adjacent products are first
+ * added in 16 bits, which is exact for x <= 127.
+ */
+inline __m256i DotProductAccumulate(__m256i sums, __m256i x, __m256i a) {
+  const __m256i pairs = _mm256_maddubs_epi16(x, a);
+  return _mm256_add_epi32(sums, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+}
+
+/**
+ * @brief      Vectorised exp, approximated as described in kernels_internal.hpp
+ */
+inline __m256 Exp(__m256 x) {
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(kExpMin)),
+                    _mm256_set1_ps(kExpMax));
+  const __m256 k = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(kLog2e)),
+                                   _MM_FROUND_TO_NEAREST_INT |
+                                       _MM_FROUND_NO_EXC);
+  __m256 r = _mm256_fnmadd_ps(k, _mm256_set1_ps(kLn2Hi), x);
+  r = _mm256_fnmadd_ps(k, _mm256_set1_ps(kLn2Lo), r);
+  __m256 p = _mm256_set1_ps(kExpP0);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP1));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP2));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP3));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP4));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP5));
+  p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r),
+                      _mm256_add_ps(r, _mm256_set1_ps(1.f)));
+  // 2^k, built directly in the exponent bits
+  const __m256i exponent = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+/**
+ * @brief      f(x + bias) for eight lanes
+ */
+inline __m256 BiasActivation8(Activation activation, __m256 x, __m256 bias) {
+  x = _mm256_add_ps(x, bias);
+  if (activation == Activation::kSigmoid) {
+    const __m256 one = _mm256_set1_ps(1.f);
+    return _mm256_div_ps(
+        one, _mm256_add_ps(one, Exp(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+  }
+  return _mm256_max_ps(x, _mm256_setzero_ps());
+}
+
+/**
+ * @brief      d * f'(z) for eight lanes, from the activations a = f(z)
+ */
+inline __m256 MultiplyActivationPrime8(Activation activation, __m256 a,
+                                       __m256 d) {
+  if (activation == Activation::kSigmoid) {
+    return _mm256_mul_ps(d, _mm256_mul_ps(a, _mm256_sub_ps(_mm256_set1_ps(1.f),
+                                                           a)));
+  }
+  return _mm256_and_ps(d, _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ));
+}
+
+/**
+ * @brief      Mask loading/storing the first "count" (< 8) lanes
+ */
+inline __m256i TailMask(unsigned int count) {
+  return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(count)),
+                            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+/**
+ * @brief      6 x 16 micro-kernel: 12 accumulator registers, two loads of B
+ * and one broadcast of A per row per step
+ */
+struct Kernel {
+  static constexpr unsigned int kMr = 6;
+  static constexpr unsigned int kNr = 16;
+  static void Run(unsigned int kc, const float *a, const float *b, float *c,
+                  unsigned int ldc) {
+    __m256 accumulators[kMr][2];
+    for (unsigned int r = 0; r < kMr; r++) {
+      accumulators[r][0] = _mm256_setzero_ps();
+      accumulators[r][1] = _mm256_setzero_ps();
+    }
+    for (unsigned int p = 0; p < kc; p++) {
+      const __m256 b0 = _mm256_load_ps(b);
+      const __m256 b1 = _mm256_load_ps(b + 8);
+      for (unsigned int r = 0; r < kMr; r++) {
+        const __m256 scale = _mm256_broadcast_ss(a + r);
+        accumulators[r][0] = _mm256_fmadd_ps(scale, b0, accumulators[r][0]);
+        accumulators[r][1] = _mm256_fmadd_ps(scale, b1, accumulators[r][1]);
+      }
+      a += kMr;
+      b += kNr;
+    }
+    for (unsigned int r = 0; r < kMr; r++) {
+      float *row = c + static_cast<std::size_t>(r) * ldc;
+      _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row),
+                                          accumulators[r][0]));
+      _mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8),
+                                              accumulators[r][1]));
+    }
+  }
+};
+
+} // namespace
+
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+void SgemmFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                  unsigned int n, unsigned int k, float alpha, const float *a,
+                  unsigned int lda, const Float16 *b, unsigned int ldb,
+                  float beta, float *c, unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+void SgemmBFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                   unsigned int n, unsigned int k, float alpha, const float *a,
+                   unsigned int lda, const BFloat16 *b, unsigned int ldb,
+                   float beta, float *c, unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+namespace {
+
+/**
+ * @brief      Load eight elements of a matrix as floats
+ */
+inline __m256 Load8(const float *a) { return _mm256_loadu_ps(a); }
+inline __m256 Load8(const Float16 *a) {
+  return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)));
+}
+inline __m256 Load8(const BFloat16 *a) {
+  const __m256i bits = _mm256_cvtepu16_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(a)));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 16));
+}
+
+template <typename Element>
+void SgemvImpl(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+               const Element *a, unsigned int lda, const float *x, float beta,
+               float *y) {
+  if (!transpose_a) {
+    // Four rows at a time so that every load of x is used four times
+    unsigned int i = 0;
+    for (; i + 4 <= m; i += 4) {
+      const Element *rows[4];
+      __m256 sums[4];
+      for (unsigned int r = 0; r < 4; r++) {
+        rows[r] = a + static_cast<std::size_t>(i + r) * lda;
+        sums[r] = _mm256_setzero_ps();
+      }
+      unsigned int j = 0;
+      for (; j + 8 <= n; j += 8) {
+        const __m256 xs = _mm256_loadu_ps(x + j);
+        for (unsigned int r = 0; r < 4; r++) {
+          sums[r] = _mm256_fmadd_ps(Load8(rows[r] + j), xs, sums[r]);
+        }
+      }
+      for (unsigned int r = 0; r < 4; r++) {
+        float sum = HorizontalSum(sums[r]);
+        for (unsigned int tail = j; tail < n; tail++) {
+          sum += ToFloat(rows[r][tail]) * x[tail];
+        }
+        y[i + r] = alpha * sum + (beta == 0.f ? 0.f : beta * y[i + r]);
+      }
+    }
+    for (; i < m; i++) {
+      const Element *row = a + static_cast<std::size_t>(i) * lda;
+      __m256 sums = _mm256_setzero_ps();
+      unsigned int j = 0;
+      for (; j + 8 <= n; j += 8) {
+        sums = _mm256_fmadd_ps(Load8(row + j), _mm256_loadu_ps(x + j), sums);
+      }
+      float sum = HorizontalSum(sums);
+      for (; j < n; j++) {
+        sum += ToFloat(row[j]) * x[j];
+      }
+      y[i] = alpha * sum + (beta == 0.f ? 0.f : beta * y[i]);
+    }
+    return;
+  }
+  // Transposed: y += (alpha * x[i]) * row i, reading A contiguously
+  for (unsigned int j = 0; j < n; j++) {
+    y[j] = beta == 0.f ? 0.f : beta * y[j];
+  }
+  for (unsigned int i = 0; i < m; i++) {
+    const Element *row = a + static_cast<std::size_t>(i) * lda;
+    const float scale = alpha * x[i];
+    const __m256 scales = _mm256_set1_ps(scale);
+    unsigned int j = 0;
+    for (; j + 8 <= n; j += 8) {
+      _mm256_storeu_ps(y + j, _mm256_fmadd_ps(scales, Load8(row + j),
+                                              _mm256_loadu_ps(y + j)));
+    }
+    for (; j < n; j++) {
+      y[j] += scale * ToFloat(row[j]);
+    }
+  }
+}
+
+} // namespace
+
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void SgemvFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                  float alpha, const Float16 *a, unsigned int lda,
+                  const float *x, float beta, float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void SgemvBFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                   float alpha, const BFloat16 *a, unsigned int lda,
+                   const float *x, float beta, float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx) {
+  const __m256i tail_mask = TailMask(n % 8);
+  const unsigned int n_full = n - n % 8;
+  for (unsigned int i = 0; i < m; i++) {
+    float *row = x + static_cast<std::size_t>(i) * ldx;
+    for (unsigned int j = 0; j < n_full; j += 8) {
+      _mm256_storeu_ps(row + j,
+                       BiasActivation8(activation, _mm256_loadu_ps(row + j),
+                                       _mm256_loadu_ps(bias + j)));
+    }
+    if (n_full < n) {
+      _mm256_maskstore_ps(
+          row + n_full, tail_mask,
+          BiasActivation8(activation,
+                          _mm256_maskload_ps(row + n_full, tail_mask),
+                          _mm256_maskload_ps(bias + n_full, tail_mask)));
+    }
+  }
+}
+
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd) {
+  const __m256i tail_mask = TailMask(n % 8);
+  const unsigned int n_full = n - n % 8;
+  for (unsigned int i = 0; i < m; i++) {
+    const float *a_row = activations + static_cast<std::size_t>(i) * lda;
+    float *d_row = d + static_cast<std::size_t>(i) * ldd;
+    for (unsigned int j = 0; j < n_full; j += 8) {
+      _mm256_storeu_ps(d_row + j, MultiplyActivationPrime8(
+                                      activation, _mm256_loadu_ps(a_row + j),
+                                      _mm256_loadu_ps(d_row + j)));
+    }
+    if (n_full < n) {
+      _mm256_maskstore_ps(
+          d_row + n_full, tail_mask,
+          MultiplyActivationPrime8(
+              activation, _mm256_maskload_ps(a_row + n_full, tail_mask),
+              _mm256_maskload_ps(d_row + n_full, tail_mask)));
+    }
+  }
+}
+
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y) {
+  // Four rows at a time so that every load of x is used four times
+  const unsigned int n_full = n - n % 32;
+  unsigned int i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const std::int8_t *rows[4];
+    __m256i sums[4];
+    for (unsigned int r = 0; r < 4; r++) {
+      rows[r] = a + static_cast<std::size_t>(i + r) * lda;
+      sums[r] = _mm256_setzero_si256();
+    }
+    for (unsigned int j = 0; j < n_full; j += 32) {
+      const __m256i xs =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + j));
+      for (unsigned int r = 0; r < 4; r++) {
+        sums[r] = DotProductAccumulate(
+            sums[r], xs,
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rows[r] + j)));
+      }
+    }
+    for (unsigned int r = 0; r < 4; r++) {
+      std::int32_t sum = HorizontalSum(sums[r]);
+      for (unsigned int tail = n_full; tail < n; tail++) {
+        sum += static_cast<std::int32_t>(rows[r][tail]) * x[tail];
+      }
+      y[i + r] = sum;
+    }
+  }
+  for (; i < m; i++) {
+    const std::int8_t *row = a + static_cast<std::size_t>(i) * lda;
+    __m256i sums = _mm256_setzero_si256();
+    for (unsigned int j = 0; j < n_full; j += 32) {
+      sums = DotProductAccumulate(
+          sums, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + j)),
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + j)));
+    }
+    std::int32_t sum = HorizontalSum(sums);
+    for (unsigned int tail = n_full; tail < n; tail++) {
+      sum += static_cast<std::int32_t>(row[tail]) * x[tail];
+    }
+    y[i] = sum;
+  }
+}
+
+namespace {
+
+/**
+ * @brief      Quantise 32 floats, see QuantizeInputs
+ */
+inline void Quantize32(const float *x, __m256 scale, __m256 offset,
+                       std::uint8_t *q) {
+  __m256i ints[4];
+  for (unsigned int r = 0; r < 4; r++) {
+    // Multiply and add separately, not fused, to round like the generic code
+    __m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x + 8 * r), scale),
+                                 offset);
+    value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()),
+                          _mm256_set1_ps(127.f));
+    ints[r] = _mm256_cvttps_epi32(value);
+  }
+  // Packing works within 128-bit lanes, so the result is put back in order
+  // with a final permutation
+  const __m256i bytes =
+      _mm256_packus_epi16(_mm256_packs_epi32(ints[0], ints[1]),
+                          _mm256_packs_epi32(ints[2], ints[3]));
+  _mm256_storeu_si256(
+      reinterpret_cast<__m256i *>(q),
+      _mm256_permutevar8x32_epi32(bytes,
+                                  _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7)));
+}
+
+} // namespace
+
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q) {
+  const __m256 scales = _mm256_set1_ps(scale);
+  const __m256 offsets = _mm256_set1_ps(offset);
+  unsigned int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    Quantize32(x + i, scales, offsets, q + i);
+  }
+  if (i < n) {
+    // The tail goes through the same code, in a padded copy
+    alignas(32) float x_tail[32] = {};
+    alignas(32) std::uint8_t q_tail[32];
+    for (unsigned int j = i; j < n; j++) {
+      x_tail[j - i] = x[j];
+    }
+    Quantize32(x_tail, scales, offsets, q_tail);
+    for (unsigned int j = i; j < n; j++) {
+      q[j] = q_tail[j - i];
+    }
+  }
+}
+
+namespace {
+
+/**
+ * @brief      Round eight floats to bfloat16 (to nearest even, keeping NaNs
+ * quiet), in the low 16 bits of each lane
+ */
+inline __m256i RoundToBFloat16(__m256 x) {
+  const __m256i bits = _mm256_castps_si256(x);
+  const __m256i lsb =
+      _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+  const __m256i rounded = _mm256_srli_epi32(
+      _mm256_add_epi32(bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff))),
+      16);
+  const __m256i quiet_nan =
+      _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+  const __m256 is_nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+  return _mm256_blendv_epi8(rounded, quiet_nan, _mm256_castps_si256(is_nan));
+}
+
+/**
+ * @brief      Convert eight floats to half precision
+ */
+inline __m128i ToFloat16x8(__m256 x) {
+  return _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+inline __m128i ToBFloat16x8(__m256 x) {
+  const __m256i rounded = RoundToBFloat16(x);
+  // Pack the low halves of the lanes, which works within 128-bit lanes
+  return _mm_packus_epi32(_mm256_castsi256_si128(rounded),
+                          _mm256_extracti128_si256(rounded, 1));
+}
+
+/**
+ * @brief      Convert n floats with a function converting eight at a time,
+ * the tail going through the same function in a padded copy
+ */
+template <typename Convert8, typename Half>
+void ConvertToHalf(unsigned int n, const float *x, Half *y,
+                   Convert8 convert8) {
+  unsigned int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y + i),
+                     convert8(_mm256_loadu_ps(x + i)));
+  }
+  if (i < n) {
+    alignas(32) float x_tail[8] = {};
+    alignas(16) Half y_tail[8];
+    for (unsigned int j = i; j < n; j++) {
+      x_tail[j - i] = x[j];
+    }
+    _mm_store_si128(reinterpret_cast<__m128i *>(y_tail),
+                    convert8(_mm256_load_ps(x_tail)));
+    for (unsigned int j = i; j < n; j++) {
+      y[j] = y_tail[j - i];
+    }
+  }
+}
+
+} // namespace
+
+void ConvertToFloat16(unsigned int n, const float *x, Float16 *y) {
+  ConvertToHalf(n, x, y, ToFloat16x8);
+}
+
+void ConvertToBFloat16(unsigned int n, const float *x, BFloat16 *y) {
+  ConvertToHalf(n, x, y, ToBFloat16x8);
+}
+
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters) {
+  const __m256 rates = _mm256_set1_ps(learning_rate);
+  const __m256 momenta = _mm256_set1_ps(momentum);
+  unsigned int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 gradient =
+        _mm256_mul_ps(rates, _mm256_loadu_ps(gradients + i));
+    const __m256 velocity = _mm256_fmsub_ps(
+        momenta, _mm256_loadu_ps(velocities + i), gradient);
+    _mm256_storeu_ps(velocities + i, velocity);
+    const __m256 step =
+        nesterov ? _mm256_fmsub_ps(momenta, velocity, gradient) : velocity;
+    _mm256_storeu_ps(parameters + i,
+                     _mm256_add_ps(_mm256_loadu_ps(parameters + i), step));
+  }
+  for (; i < n; i++) {
+    MomentumUpdate1(learning_rate, momentum, nesterov, gradients[i],
+                    velocities[i], parameters[i]);
+  }
+}
+
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters) {
+  const __m256 scales = _mm256_set1_ps(gradient_scale);
+  const __m256 beta1s = _mm256_set1_ps(beta1);
+  const __m256 beta2s = _mm256_set1_ps(beta2);
+  const __m256 one_minus_beta1s = _mm256_set1_ps(1.f - beta1);
+  const __m256 one_minus_beta2s = _mm256_set1_ps(1.f - beta2);
+  const __m256 step_sizes = _mm256_set1_ps(step_size);
+  const __m256 epsilons = _mm256_set1_ps(epsilon);
+  unsigned int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256 gradient =
+        _mm256_mul_ps(scales, _mm256_loadu_ps(gradients + i));
+    const __m256 moment =
+        _mm256_fmadd_ps(beta1s, _mm256_loadu_ps(moments + i),
+                        _mm256_mul_ps(one_minus_beta1s, gradient));
+    const __m256 second_moment = _mm256_fmadd_ps(
+        beta2s, _mm256_loadu_ps(second_moments + i),
+        _mm256_mul_ps(one_minus_beta2s, _mm256_mul_ps(gradient, gradient)));
+    _mm256_storeu_ps(moments + i, moment);
+    _mm256_storeu_ps(second_moments + i, second_moment);
+    const __m256 step = _mm256_div_ps(
+        _mm256_mul_ps(step_sizes, moment),
+        _mm256_add_ps(_mm256_sqrt_ps(second_moment), epsilons));
+    _mm256_storeu_ps(parameters + i,
+                     _mm256_sub_ps(_mm256_loadu_ps(parameters + i), step));
+  }
+  for (; i < n; i++) {
+    AdamUpdate1(gradient_scale, beta1, beta2, step_size, epsilon, gradients[i],
+                moments[i], second_moments[i], parameters[i]);
+  }
+}
+
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values) {
+  unsigned int count = 0;
+  unsigned int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    // Unordered, so NaNs are kept. AVX2 has no compress, so the non-zero
+    // lanes are picked from the bit mask.
+    unsigned int non_zero = static_cast<unsigned int>(_mm256_movemask_ps(
+        _mm256_cmp_ps(_mm256_loadu_ps(x + i), _mm256_setzero_ps(),
+                      _CMP_NEQ_UQ)));
+    while (non_zero) {
+      const unsigned int lane = __builtin_ctz(non_zero);
+      indices[count] = i + lane;
+      values[count] = x[i + lane];
+      count++;
+      non_zero &= non_zero - 1;
+    }
+  }
+  for (; i < n; i++) {
+    if (x[i] != 0.f) {
+      indices[count] = i;
+      values[count] = x[i];
+      count++;
+    }
+  }
+  return count;
+}
+
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc) {
+  for (unsigned int i = 0; i < m; i++) {
+    const unsigned int begin = row_offsets[i];
+    const unsigned int end = row_offsets[i + 1];
+    const unsigned int full_end = begin + (end - begin) / 8 * 8;
+    const __m256i tail_mask = TailMask((end - begin) % 8);
+    float *c_row = c + static_cast<std::size_t>(i) * ldc;
+    // Sparse dot products with four rows of B at a time, which share the
+    // loads of the indices and values
+    unsigned int j = 0;
+    for (; j + 4 <= n; j += 4) {
+      const float *rows[4];
+      __m256 sums[4];
+      for (unsigned int r = 0; r < 4; r++) {
+        rows[r] = b + static_cast<std::size_t>(j + r) * ldb;
+        sums[r] = _mm256_setzero_ps();
+      }
+      for (unsigned int p = begin; p < full_end; p += 8) {
+        const __m256i indices = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(columns + p));
+        const __m256 xs = _mm256_loadu_ps(values + p);
+        for (unsigned int r = 0; r < 4; r++) {
+          sums[r] = _mm256_fmadd_ps(
+              xs, _mm256_i32gather_ps(rows[r], indices, 4), sums[r]);
+        }
+      }
+      if (full_end < end) {
+        const __m256i indices = _mm256_maskload_epi32(
+            reinterpret_cast<const int *>(columns + full_end), tail_mask);
+        const __m256 xs = _mm256_maskload_ps(values + full_end, tail_mask);
+        for (unsigned int r = 0; r < 4; r++) {
+          sums[r] = _mm256_fmadd_ps(
+              xs,
+              _mm256_mask_i32gather_ps(_mm256_setzero_ps(), rows[r], indices,
+                                       _mm256_castsi256_ps(tail_mask), 4),
+              sums[r]);
+        }
+      }
+      for (unsigned int r = 0; r < 4; r++) {
+        c_row[j + r] = HorizontalSum(sums[r]);
+      }
+    }
+    for (; j < n; j++) {
+      const float *row = b + static_cast<std::size_t>(j) * ldb;
+      float sum = 0.f;
+      for (unsigned int p = begin; p < end; p++) {
+        sum += values[p] * row[columns[p]];
+      }
+      c_row[j] = sum;
+    }
+  }
+}
+
+} // namespace avx2
+} // namespace kernels
+} // namespace nn
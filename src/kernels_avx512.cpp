@@ -0,0 +1,540 @@
+// AVX-512F kernels. Compiled with -mavx512f -mfma -mf16c, and only called after
+// DetectIsa has checked the CPU supports them.
+#include <immintrin.h>
+
+#include "kernels_internal.hpp"
+
+namespace nn {
+namespace kernels {
+namespace avx512 {
+
+namespace {
+
+/**
+ * @brief      Mask selecting the first "count" (< 16) lanes
+ */
+inline __mmask16 TailMask(unsigned int count) {
+  return static_cast<__mmask16>((1u << count) - 1);
+}
+
+/**
+ * @brief      Vectorised exp, approximated as described in kernels_internal.hpp
+ */
+inline __m512 Exp(__m512 x) {
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(kExpMin)),
+                    _mm512_set1_ps(kExpMax));
+  const __m512 k = _mm512_roundscale_ps(
+      _mm512_mul_ps(x, _mm512_set1_ps(kLog2e)),
+      _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m512 r = _mm512_fnmadd_ps(k, _mm512_set1_ps(kLn2Hi), x);
+  r = _mm512_fnmadd_ps(k, _mm512_set1_ps(kLn2Lo), r);
+  __m512 p = _mm512_set1_ps(kExpP0);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP1));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP2));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP3));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP4));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP5));
+  p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r),
+                      _mm512_add_ps(r, _mm512_set1_ps(1.f)));
+  // p * 2^k
+  return _mm512_scalef_ps(p, k);
+}
+
+/**
+ * @brief      f(x + bias) for sixteen lanes
+ */
+inline __m512 BiasActivation16(Activation activation, __m512 x, __m512 bias) {
+  x = _mm512_add_ps(x, bias);
+  if (activation == Activation::kSigmoid) {
+    const __m512 one = _mm512_set1_ps(1.f);
+    return _mm512_div_ps(
+        one, _mm512_add_ps(one, Exp(_mm512_sub_ps(_mm512_setzero_ps(), x))));
+  }
+  return _mm512_max_ps(x, _mm512_setzero_ps());
+}
+
+/**
+ * @brief      d * f'(z) for sixteen lanes, from the activations a = f(z)
+ */
+inline __m512 MultiplyActivationPrime16(Activation activation, __m512 a,
+                                        __m512 d) {
+  if (activation == Activation::kSigmoid) {
+    return _mm512_mul_ps(d, _mm512_mul_ps(a, _mm512_sub_ps(_mm512_set1_ps(1.f),
+                                                           a)));
+  }
+  return _mm512_maskz_mov_ps(
+      _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_GT_OQ), d);
+}
+
+/**
+ * @brief      8 x 32 micro-kernel: 16 accumulator registers, two loads of B
+ * and one broadcast of A per row per step
+ */
+struct Kernel {
+  static constexpr unsigned int kMr = 8;
+  static constexpr unsigned int kNr = 32;
+  static void Run(unsigned int kc, const float *a, const float *b, float *c,
+                  unsigned int ldc) {
+    __m512 accumulators[kMr][2];
+    for (unsigned int r = 0; r < kMr; r++) {
+      accumulators[r][0] = _mm512_setzero_ps();
+      accumulators[r][1] = _mm512_setzero_ps();
+    }
+    for (unsigned int p = 0; p < kc; p++) {
+      const __m512 b0 = _mm512_load_ps(b);
+      const __m512 b1 = _mm512_load_ps(b + 16);
+      for (unsigned int r = 0; r < kMr; r++) {
+        const __m512 scale = _mm512_set1_ps(a[r]);
+        accumulators[r][0] = _mm512_fmadd_ps(scale, b0, accumulators[r][0]);
+        accumulators[r][1] = _mm512_fmadd_ps(scale, b1, accumulators[r][1]);
+      }
+      a += kMr;
+      b += kNr;
+    }
+    for (unsigned int r = 0; r < kMr; r++) {
+      float *row = c + static_cast<std::size_t>(r) * ldc;
+      _mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row),
+                                          accumulators[r][0]));
+      _mm512_storeu_ps(row + 16, _mm512_add_ps(_mm512_loadu_ps(row + 16),
+                                               accumulators[r][1]));
+    }
+  }
+};
+
+} // namespace
+
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+void SgemmFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                  unsigned int n, unsigned int k, float alpha, const float *a,
+                  unsigned int lda, const Float16 *b, unsigned int ldb,
+                  float beta, float *c, unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+void SgemmBFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                   unsigned int n, unsigned int k, float alpha, const float *a,
+                   unsigned int lda, const BFloat16 *b, unsigned int ldb,
+                   float beta, float *c, unsigned int ldc) {
+  GemmDriver<Kernel>(transpose_a, transpose_b, m, n, k, alpha, a, lda, b, ldb,
+                     beta, c, ldc);
+}
+
+namespace {
+
+/**
+ * @brief      Load sixteen elements of a matrix as floats
+ */
+inline __m512 Load16(const float *a) { return _mm512_loadu_ps(a); }
+inline __m512 Load16(const Float16 *a) {
+  return _mm512_cvtph_ps(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a)));
+}
+inline __m512 Load16(const BFloat16 *a) {
+  const __m512i bits = _mm512_cvtepu16_epi32(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a)));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(bits, 16));
+}
+
+/**
+ * @brief      Load the last count (< 16) elements of a row as floats, with
+ * zeros in the other lanes. Masked 16-bit loads need AVX-512 BW, so half
+ * precision elements are copied aside instead.
+ */
+inline __m512 LoadTail16(const float *a, unsigned int count) {
+  return _mm512_maskz_loadu_ps(TailMask(count), a);
+}
+template <typename Half>
+inline __m512 LoadTail16(const Half *a, unsigned int count) {
+  Half tail[16] = {};
+  std::memcpy(tail, a, count * sizeof(Half));
+  return Load16(tail);
+}
+
+template <typename Element>
+void SgemvImpl(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+               const Element *a, unsigned int lda, const float *x, float beta,
+               float *y) {
+  const __mmask16 tail_mask = TailMask(n % 16);
+  const unsigned int n_full = n - n % 16;
+  if (!transpose_a) {
+    // Four rows at a time so that every load of x is used four times
+    unsigned int i = 0;
+    for (; i + 4 <= m; i += 4) {
+      const Element *rows[4];
+      __m512 sums[4];
+      for (unsigned int r = 0; r < 4; r++) {
+        rows[r] = a + static_cast<std::size_t>(i + r) * lda;
+        sums[r] = _mm512_setzero_ps();
+      }
+      for (unsigned int j = 0; j < n_full; j += 16) {
+        const __m512 xs = _mm512_loadu_ps(x + j);
+        for (unsigned int r = 0; r < 4; r++) {
+          sums[r] = _mm512_fmadd_ps(Load16(rows[r] + j), xs, sums[r]);
+        }
+      }
+      if (tail_mask) {
+        const __m512 xs = _mm512_maskz_loadu_ps(tail_mask, x + n_full);
+        for (unsigned int r = 0; r < 4; r++) {
+          sums[r] = _mm512_fmadd_ps(LoadTail16(rows[r] + n_full, n % 16), xs,
+                                    sums[r]);
+        }
+      }
+      for (unsigned int r = 0; r < 4; r++) {
+        const float sum = _mm512_reduce_add_ps(sums[r]);
+        y[i + r] = alpha * sum + (beta == 0.f ? 0.f : beta * y[i + r]);
+      }
+    }
+    for (; i < m; i++) {
+      const Element *row = a + static_cast<std::size_t>(i) * lda;
+      __m512 sums = _mm512_setzero_ps();
+      for (unsigned int j = 0; j < n_full; j += 16) {
+        sums = _mm512_fmadd_ps(Load16(row + j), _mm512_loadu_ps(x + j), sums);
+      }
+      if (tail_mask) {
+        sums = _mm512_fmadd_ps(LoadTail16(row + n_full, n % 16),
+                               _mm512_maskz_loadu_ps(tail_mask, x + n_full),
+                               sums);
+      }
+      const float sum = _mm512_reduce_add_ps(sums);
+      y[i] = alpha * sum + (beta == 0.f ? 0.f : beta * y[i]);
+    }
+    return;
+  }
+  // Transposed: y += (alpha * x[i]) * row i, reading A contiguously
+  for (unsigned int j = 0; j < n; j++) {
+    y[j] = beta == 0.f ? 0.f : beta * y[j];
+  }
+  for (unsigned int i = 0; i < m; i++) {
+    const Element *row = a + static_cast<std::size_t>(i) * lda;
+    const __m512 scales = _mm512_set1_ps(alpha * x[i]);
+    for (unsigned int j = 0; j < n_full; j += 16) {
+      _mm512_storeu_ps(y + j, _mm512_fmadd_ps(scales, Load16(row + j),
+                                              _mm512_loadu_ps(y + j)));
+    }
+    if (tail_mask) {
+      _mm512_mask_storeu_ps(
+          y + n_full, tail_mask,
+          _mm512_fmadd_ps(scales, LoadTail16(row + n_full, n % 16),
+                          _mm512_maskz_loadu_ps(tail_mask, y + n_full)));
+    }
+  }
+}
+
+} // namespace
+
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void SgemvFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                  float alpha, const Float16 *a, unsigned int lda,
+                  const float *x, float beta, float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void SgemvBFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                   float alpha, const BFloat16 *a, unsigned int lda,
+                   const float *x, float beta, float *y) {
+  SgemvImpl(transpose_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx) {
+  const __mmask16 tail_mask = TailMask(n % 16);
+  const unsigned int n_full = n - n % 16;
+  for (unsigned int i = 0; i < m; i++) {
+    float *row = x + static_cast<std::size_t>(i) * ldx;
+    for (unsigned int j = 0; j < n_full; j += 16) {
+      _mm512_storeu_ps(row + j,
+                       BiasActivation16(activation, _mm512_loadu_ps(row + j),
+                                        _mm512_loadu_ps(bias + j)));
+    }
+    if (tail_mask) {
+      _mm512_mask_storeu_ps(
+          row + n_full, tail_mask,
+          BiasActivation16(activation,
+                           _mm512_maskz_loadu_ps(tail_mask, row + n_full),
+                           _mm512_maskz_loadu_ps(tail_mask, bias + n_full)));
+    }
+  }
+}
+
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd) {
+  const __mmask16 tail_mask = TailMask(n % 16);
+  const unsigned int n_full = n - n % 16;
+  for (unsigned int i = 0; i < m; i++) {
+    const float *a_row = activations + static_cast<std::size_t>(i) * lda;
+    float *d_row = d + static_cast<std::size_t>(i) * ldd;
+    for (unsigned int j = 0; j < n_full; j += 16) {
+      _mm512_storeu_ps(d_row + j, MultiplyActivationPrime16(
+                                      activation, _mm512_loadu_ps(a_row + j),
+                                      _mm512_loadu_ps(d_row + j)));
+    }
+    if (tail_mask) {
+      _mm512_mask_storeu_ps(
+          d_row + n_full, tail_mask,
+          MultiplyActivationPrime16(
+              activation, _mm512_maskz_loadu_ps(tail_mask, a_row + n_full),
+              _mm512_maskz_loadu_ps(tail_mask, d_row + n_full)));
+    }
+  }
+}
+
+namespace {
+
+/**
+ * @brief      Quantise 16 floats to int32, see QuantizeInputs
+ */
+inline __m512i Quantize16(__m512 x, __m512 scale, __m512 offset) {
+  // Multiply and add separately, not fused, to round like the generic code
+  const __m512 value = _mm512_add_ps(_mm512_mul_ps(x, scale), offset);
+  return _mm512_cvttps_epi32(_mm512_min_ps(
+      _mm512_max_ps(value, _mm512_setzero_ps()), _mm512_set1_ps(127.f)));
+}
+
+} // namespace
+
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q) {
+  const __m512 scales = _mm512_set1_ps(scale);
+  const __m512 offsets = _mm512_set1_ps(offset);
+  unsigned int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i *>(q + i),
+        _mm512_cvtepi32_epi8(Quantize16(_mm512_loadu_ps(x + i), scales, offsets)));
+  }
+  if (i < n) {
+    const __mmask16 mask = TailMask(n - i);
+    _mm512_mask_cvtepi32_storeu_epi8(
+        q + i, mask,
+        Quantize16(_mm512_maskz_loadu_ps(mask, x + i), scales, offsets));
+  }
+}
+
+namespace {
+
+/**
+ * @brief      Convert 16 floats to half precision
+ */
+inline __m256i ToFloat16x16(__m512 x) {
+  return _mm512_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+/**
+ * @brief      Convert 16 floats to bfloat16 (rounding to nearest even, keeping
+ * NaNs quiet)
+ */
+inline __m256i ToBFloat16x16(__m512 x) {
+  const __m512i bits = _mm512_castps_si512(x);
+  const __m512i high = _mm512_srli_epi32(bits, 16);
+  const __m512i lsb = _mm512_and_si512(high, _mm512_set1_epi32(1));
+  __m512i result = _mm512_srli_epi32(
+      _mm512_add_epi32(bits, _mm512_add_epi32(lsb, _mm512_set1_epi32(0x7fff))),
+      16);
+  const __mmask16 is_nan = _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q);
+  result = _mm512_mask_or_epi32(result, is_nan, high, _mm512_set1_epi32(0x40));
+  return _mm512_cvtepi32_epi16(result);
+}
+
+/**
+ * @brief      Convert n floats with a function converting 16 at a time, the
+ * tail going through the same function in a padded copy
+ */
+template <typename Convert16, typename Half>
+void ConvertToHalf(unsigned int n, const float *x, Half *y,
+                   Convert16 convert16) {
+  unsigned int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(y + i),
+                        convert16(_mm512_loadu_ps(x + i)));
+  }
+  if (i < n) {
+    alignas(64) Half y_tail[16];
+    _mm256_store_si256(
+        reinterpret_cast<__m256i *>(y_tail),
+        convert16(_mm512_maskz_loadu_ps(TailMask(n - i), x + i)));
+    for (unsigned int j = i; j < n; j++) {
+      y[j] = y_tail[j - i];
+    }
+  }
+}
+
+} // namespace
+
+void ConvertToFloat16(unsigned int n, const float *x, Float16 *y) {
+  ConvertToHalf(n, x, y, ToFloat16x16);
+}
+
+void ConvertToBFloat16(unsigned int n, const float *x, BFloat16 *y) {
+  ConvertToHalf(n, x, y, ToBFloat16x16);
+}
+
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters) {
+  const __m512 rates = _mm512_set1_ps(learning_rate);
+  const __m512 momenta = _mm512_set1_ps(momentum);
+  // The tail is the last iteration, with masked loads and stores
+  for (unsigned int i = 0; i < n; i += 16) {
+    const __mmask16 mask = n - i >= 16 ? 0xffff : TailMask(n - i);
+    const __m512 gradient =
+        _mm512_mul_ps(rates, _mm512_maskz_loadu_ps(mask, gradients + i));
+    const __m512 velocity = _mm512_fmsub_ps(
+        momenta, _mm512_maskz_loadu_ps(mask, velocities + i), gradient);
+    _mm512_mask_storeu_ps(velocities + i, mask, velocity);
+    const __m512 step =
+        nesterov ? _mm512_fmsub_ps(momenta, velocity, gradient) : velocity;
+    _mm512_mask_storeu_ps(
+        parameters + i, mask,
+        _mm512_add_ps(_mm512_maskz_loadu_ps(mask, parameters + i), step));
+  }
+}
+
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters) {
+  const __m512 scales = _mm512_set1_ps(gradient_scale);
+  const __m512 beta1s = _mm512_set1_ps(beta1);
+  const __m512 beta2s = _mm512_set1_ps(beta2);
+  const __m512 one_minus_beta1s = _mm512_set1_ps(1.f - beta1);
+  const __m512 one_minus_beta2s = _mm512_set1_ps(1.f - beta2);
+  const __m512 step_sizes = _mm512_set1_ps(step_size);
+  const __m512 epsilons = _mm512_set1_ps(epsilon);
+  for (unsigned int i = 0; i < n; i += 16) {
+    const __mmask16 mask = n - i >= 16 ? 0xffff : TailMask(n - i);
+    const __m512 gradient =
+        _mm512_mul_ps(scales, _mm512_maskz_loadu_ps(mask, gradients + i));
+    const __m512 moment =
+        _mm512_fmadd_ps(beta1s, _mm512_maskz_loadu_ps(mask, moments + i),
+                        _mm512_mul_ps(one_minus_beta1s, gradient));
+    const __m512 second_moment = _mm512_fmadd_ps(
+        beta2s, _mm512_maskz_loadu_ps(mask, second_moments + i),
+        _mm512_mul_ps(one_minus_beta2s, _mm512_mul_ps(gradient, gradient)));
+    _mm512_mask_storeu_ps(moments + i, mask, moment);
+    _mm512_mask_storeu_ps(second_moments + i, mask, second_moment);
+    const __m512 step = _mm512_div_ps(
+        _mm512_mul_ps(step_sizes, moment),
+        _mm512_add_ps(_mm512_sqrt_ps(second_moment), epsilons));
+    _mm512_mask_storeu_ps(
+        parameters + i, mask,
+        _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, parameters + i), step));
+  }
+}
+
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values) {
+  const __m512i lanes =
+      _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  unsigned int count = 0;
+  for (unsigned int i = 0; i < n; i += 16) {
+    const __mmask16 mask = n - i >= 16 ? 0xffff : TailMask(n - i);
+    const __m512 xs = _mm512_maskz_loadu_ps(mask, x + i);
+    // Unordered, so NaNs are kept
+    const __mmask16 non_zero =
+        _mm512_mask_cmp_ps_mask(mask, xs, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+    _mm512_mask_compressstoreu_ps(values + count, non_zero, xs);
+    _mm512_mask_compressstoreu_epi32(
+        indices + count, non_zero,
+        _mm512_add_epi32(lanes, _mm512_set1_epi32(static_cast<int>(i))));
+    count += __builtin_popcount(non_zero);
+  }
+  return count;
+}
+
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc) {
+  for (unsigned int i = 0; i < m; i++) {
+    const unsigned int begin = row_offsets[i];
+    const unsigned int end = row_offsets[i + 1];
+    float *c_row = c + static_cast<std::size_t>(i) * ldc;
+    // Sparse dot products with four rows of B at a time, which share the
+    // loads of the indices and values
+    unsigned int j = 0;
+    for (; j + 4 <= n; j += 4) {
+      const float *rows[4];
+      __m512 sums[4];
+      for (unsigned int r = 0; r < 4; r++) {
+        rows[r] = b + static_cast<std::size_t>(j + r) * ldb;
+        sums[r] = _mm512_setzero_ps();
+      }
+      for (unsigned int p = begin; p < end; p += 16) {
+        const __mmask16 mask = end - p >= 16 ? 0xffff : TailMask(end - p);
+        const __m512i indices = _mm512_maskz_loadu_epi32(mask, columns + p);
+        const __m512 xs = _mm512_maskz_loadu_ps(mask, values + p);
+        for (unsigned int r = 0; r < 4; r++) {
+          sums[r] = _mm512_fmadd_ps(
+              xs,
+              _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices,
+                                       rows[r], 4),
+              sums[r]);
+        }
+      }
+      for (unsigned int r = 0; r < 4; r++) {
+        c_row[j + r] = _mm512_reduce_add_ps(sums[r]);
+      }
+    }
+    for (; j < n; j++) {
+      const float *row = b + static_cast<std::size_t>(j) * ldb;
+      __m512 sums = _mm512_setzero_ps();
+      for (unsigned int p = begin; p < end; p += 16) {
+        const __mmask16 mask = end - p >= 16 ? 0xffff : TailMask(end - p);
+        const __m512i indices = _mm512_maskz_loadu_epi32(mask, columns + p);
+        sums = _mm512_fmadd_ps(
+            _mm512_maskz_loadu_ps(mask, values + p),
+            _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices, row,
+                                     4),
+            sums);
+      }
+      c_row[j] = _mm512_reduce_add_ps(sums);
+    }
+  }
+}
+
+void SparseOuterProducts(unsigned int m, unsigned int n, unsigned int k,
+                         const float *d, unsigned int ldd,
+                         const unsigned int *row_offsets,
+                         const unsigned int *columns, const float *values,
+                         float *c, unsigned int ldc) {
+  // Row by row of C, so the scattered updates stay within one row
+  for (unsigned int j = 0; j < n; j++) {
+    float *c_row = c + static_cast<std::size_t>(j) * ldc;
+    for (unsigned int q = 0; q < k; q += 16) {
+      const __mmask16 mask = k - q >= 16 ? 0xffff : TailMask(k - q);
+      _mm512_mask_storeu_ps(c_row + q, mask, _mm512_setzero_ps());
+    }
+    for (unsigned int i = 0; i < m; i++) {
+      const __m512 scale =
+          _mm512_set1_ps(d[static_cast<std::size_t>(i) * ldd + j]);
+      const unsigned int end = row_offsets[i + 1];
+      for (unsigned int p = row_offsets[i]; p < end; p += 16) {
+        const __mmask16 mask = end - p >= 16 ? 0xffff : TailMask(end - p);
+        const __m512i indices = _mm512_maskz_loadu_epi32(mask, columns + p);
+        const __m512 xs = _mm512_maskz_loadu_ps(mask, values + p);
+        // The columns of a row are distinct, so no two lanes scatter to the
+        // same element
+        const __m512 sums = _mm512_fmadd_ps(
+            xs, scale,
+            _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, indices,
+                                     c_row, 4));
+        _mm512_mask_i32scatter_ps(c_row, mask, indices, sums, 4);
+      }
+    }
+  }
+}
+
+} // namespace avx512
+} // namespace kernels
+} // namespace nn
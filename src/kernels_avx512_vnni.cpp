@@ -0,0 +1,63 @@
+// AVX-512 VNNI integer kernels. Compiled with -mavx512f -mavx512bw
+// -mavx512vnni, and only called after the kernel dispatch has checked the CPU
+// supports them.
+#include <immintrin.h>
+
+#include "kernels_internal.hpp"
+
+namespace nn {
+namespace kernels {
+namespace avx512_vnni {
+
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y) {
+  // vpdpbusd adds the products of four unsigned and signed bytes straight
+  // into each int32 lane, with no 16-bit intermediate to saturate. Four rows
+  // at a time so that every load of x is used four times, and the last
+  // partial block is loaded with a byte mask.
+  const unsigned int n_full = n - n % 64;
+  const __mmask64 tail_mask =
+      n % 64 == 0 ? 0 : (static_cast<__mmask64>(1) << (n % 64)) - 1;
+  const __m512i x_tail = _mm512_maskz_loadu_epi8(tail_mask, x + n_full);
+  unsigned int i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const std::int8_t *rows[4];
+    __m512i sums[4];
+    for (unsigned int r = 0; r < 4; r++) {
+      rows[r] = a + static_cast<std::size_t>(i + r) * lda;
+      sums[r] = _mm512_setzero_si512();
+    }
+    for (unsigned int j = 0; j < n_full; j += 64) {
+      const __m512i xs = _mm512_loadu_si512(x + j);
+      for (unsigned int r = 0; r < 4; r++) {
+        sums[r] =
+            _mm512_dpbusd_epi32(sums[r], xs, _mm512_loadu_si512(rows[r] + j));
+      }
+    }
+    for (unsigned int r = 0; r < 4; r++) {
+      if (tail_mask) {
+        sums[r] = _mm512_dpbusd_epi32(
+            sums[r], x_tail,
+            _mm512_maskz_loadu_epi8(tail_mask, rows[r] + n_full));
+      }
+      y[i + r] = _mm512_reduce_add_epi32(sums[r]);
+    }
+  }
+  for (; i < m; i++) {
+    const std::int8_t *row = a + static_cast<std::size_t>(i) * lda;
+    __m512i sums = _mm512_setzero_si512();
+    for (unsigned int j = 0; j < n_full; j += 64) {
+      sums = _mm512_dpbusd_epi32(sums, _mm512_loadu_si512(x + j),
+                                 _mm512_loadu_si512(row + j));
+    }
+    if (tail_mask) {
+      sums = _mm512_dpbusd_epi32(
+          sums, x_tail, _mm512_maskz_loadu_epi8(tail_mask, row + n_full));
+    }
+    y[i] = _mm512_reduce_add_epi32(sums);
+  }
+}
+
+} // namespace avx512_vnni
+} // namespace kernels
+} // namespace nn
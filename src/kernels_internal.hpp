@@ -0,0 +1,369 @@
+#pragma once
+// Shared implementation details of the kernels. This header is included by
+// translation units compiled with different instruction set flags, so
+// everything defined here lives in an anonymous namespace: each translation
+// unit gets its own copy, and the linker can never substitute an AVX-512
+// instantiation into the generic path. For the same reason the per-ISA files
+// avoid standard library templates.
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include "kernels.hpp"
+
+namespace nn {
+namespace kernels {
+
+// Per-thread scratch space for packed panels, defined in kernels.cpp. The
+// returned buffer is 64-byte aligned, holds at least "size" floats and is
+// reused by later calls on the same thread with the same index.
+float *PackingBuffer(unsigned int index, std::size_t size);
+
+namespace generic {
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc);
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y);
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx);
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd);
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y);
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q);
+void SgemmFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                  unsigned int n, unsigned int k, float alpha, const float *a,
+                  unsigned int lda, const Float16 *b, unsigned int ldb,
+                  float beta, float *c, unsigned int ldc);
+void SgemmBFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                   unsigned int n, unsigned int k, float alpha, const float *a,
+                   unsigned int lda, const BFloat16 *b, unsigned int ldb,
+                   float beta, float *c, unsigned int ldc);
+void SgemvFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                  float alpha, const Float16 *a, unsigned int lda,
+                  const float *x, float beta, float *y);
+void SgemvBFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                   float alpha, const BFloat16 *a, unsigned int lda,
+                   const float *x, float beta, float *y);
+void ConvertToFloat16(unsigned int n, const float *x, Float16 *y);
+void ConvertToBFloat16(unsigned int n, const float *x, BFloat16 *y);
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters);
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters);
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values);
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc);
+void SparseOuterProducts(unsigned int m, unsigned int n, unsigned int k,
+                         const float *d, unsigned int ldd,
+                         const unsigned int *row_offsets,
+                         const unsigned int *columns, const float *values,
+                         float *c, unsigned int ldc);
+} // namespace generic
+
+namespace avx2 {
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc);
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y);
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx);
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd);
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y);
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q);
+void SgemmFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                  unsigned int n, unsigned int k, float alpha, const float *a,
+                  unsigned int lda, const Float16 *b, unsigned int ldb,
+                  float beta, float *c, unsigned int ldc);
+void SgemmBFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                   unsigned int n, unsigned int k, float alpha, const float *a,
+                   unsigned int lda, const BFloat16 *b, unsigned int ldb,
+                   float beta, float *c, unsigned int ldc);
+void SgemvFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                  float alpha, const Float16 *a, unsigned int lda,
+                  const float *x, float beta, float *y);
+void SgemvBFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                   float alpha, const BFloat16 *a, unsigned int lda,
+                   const float *x, float beta, float *y);
+void ConvertToFloat16(unsigned int n, const float *x, Float16 *y);
+void ConvertToBFloat16(unsigned int n, const float *x, BFloat16 *y);
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters);
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters);
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values);
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc);
+} // namespace avx2
+
+namespace avx512 {
+void Sgemm(bool transpose_a, bool transpose_b, unsigned int m, unsigned int n,
+           unsigned int k, float alpha, const float *a, unsigned int lda,
+           const float *b, unsigned int ldb, float beta, float *c,
+           unsigned int ldc);
+void Sgemv(bool transpose_a, unsigned int m, unsigned int n, float alpha,
+           const float *a, unsigned int lda, const float *x, float beta,
+           float *y);
+void BiasActivation(Activation activation, unsigned int m, unsigned int n,
+                    const float *bias, float *x, unsigned int ldx);
+void MultiplyActivationPrime(Activation activation, unsigned int m,
+                             unsigned int n, const float *activations,
+                             unsigned int lda, float *d, unsigned int ldd);
+void QuantizeInputs(unsigned int n, const float *x, float scale, float offset,
+                    std::uint8_t *q);
+void SgemmFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                  unsigned int n, unsigned int k, float alpha, const float *a,
+                  unsigned int lda, const Float16 *b, unsigned int ldb,
+                  float beta, float *c, unsigned int ldc);
+void SgemmBFloat16(bool transpose_a, bool transpose_b, unsigned int m,
+                   unsigned int n, unsigned int k, float alpha, const float *a,
+                   unsigned int lda, const BFloat16 *b, unsigned int ldb,
+                   float beta, float *c, unsigned int ldc);
+void SgemvFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                  float alpha, const Float16 *a, unsigned int lda,
+                  const float *x, float beta, float *y);
+void SgemvBFloat16(bool transpose_a, unsigned int m, unsigned int n,
+                   float alpha, const BFloat16 *a, unsigned int lda,
+                   const float *x, float beta, float *y);
+void ConvertToFloat16(unsigned int n, const float *x, Float16 *y);
+void ConvertToBFloat16(unsigned int n, const float *x, BFloat16 *y);
+void MomentumUpdate(unsigned int n, float learning_rate, float momentum,
+                    bool nesterov, const float *gradients, float *velocities,
+                    float *parameters);
+void AdamUpdate(unsigned int n, float gradient_scale, float beta1, float beta2,
+                float step_size, float epsilon, const float *gradients,
+                float *moments, float *second_moments, float *parameters);
+unsigned int CompressNonZeros(unsigned int n, const float *x,
+                              unsigned int *indices, float *values);
+void SparseGemm(unsigned int m, unsigned int n, const unsigned int *row_offsets,
+                const unsigned int *columns, const float *values,
+                const float *b, unsigned int ldb, float *c, unsigned int ldc);
+void SparseOuterProducts(unsigned int m, unsigned int n, unsigned int k,
+                         const float *d, unsigned int ldd,
+                         const unsigned int *row_offsets,
+                         const unsigned int *columns, const float *values,
+                         float *c, unsigned int ldc);
+} // namespace avx512
+
+// Integer kernels that need AVX-512 BW and VNNI on top of the AVX-512 tier
+namespace avx512_vnni {
+void Int8Gemv(unsigned int m, unsigned int n, const std::int8_t *a,
+              unsigned int lda, const std::uint8_t *x, std::int32_t *y);
+} // namespace avx512_vnni
+
+namespace {
+
+// Cache blocking: a kKc x kNc panel of B is packed to stay in L2/L3, and a
+// kMc x kKc panel of A to stay in L2, while the micro-kernel streams
+// through them from L1.
+constexpr unsigned int kKc = 256;
+constexpr unsigned int kMc = 96;
+constexpr unsigned int kNc = 2048;
+
+inline unsigned int Min(unsigned int x, unsigned int y) { return x < y ? x : y; }
+
+// Exponential approximation used by the vectorised sigmoids (as in Cephes
+// expf): exp(x) = 2^k exp(r) with k = round(x / ln 2) and |r| <= ln 2 / 2,
+// where exp(r) is a degree 7 polynomial and ln 2 is split in two so that r is
+// exact. Inputs are clamped so that 2^k stays a normal float.
+constexpr float kExpMax = 88.3762626647949f;
+constexpr float kExpMin = -87.3365447504019f;
+constexpr float kLog2e = 1.44269504088896341f;
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+constexpr float kExpP0 = 1.9875691500e-4f;
+constexpr float kExpP1 = 1.3981999507e-3f;
+constexpr float kExpP2 = 8.3334519073e-3f;
+constexpr float kExpP3 = 4.1665795894e-2f;
+constexpr float kExpP4 = 1.6666665459e-1f;
+constexpr float kExpP5 = 5.0000001201e-1f;
+
+// Conversions of half precision elements to float, e.g. as B is packed
+inline float ToFloat(float value) { return value; }
+inline float ToFloat(Float16 value) {
+#ifdef __F16C__
+  return _cvtsh_ss(value.bits);
+#else
+  // Only reached from the generic translation unit, compiled for any CPU, so
+  // calling the shared inline function is safe
+  return HalfToFloat(value.bits);
+#endif
+}
+inline float ToFloat(BFloat16 value) {
+  const std::uint32_t bits = static_cast<std::uint32_t>(value.bits) << 16;
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+/**
+ * @brief      Momentum and Adam updates of a single parameter, as in
+ * MomentumUpdate and AdamUpdate, for the generic kernels and the tails of
+ * the SIMD ones
+ */
+inline void MomentumUpdate1(float learning_rate, float momentum, bool nesterov,
+                            float gradient, float &velocity, float &parameter) {
+  velocity = momentum * velocity - learning_rate * gradient;
+  parameter += nesterov ? momentum * velocity - learning_rate * gradient
+                        : velocity;
+}
+inline void AdamUpdate1(float gradient_scale, float beta1, float beta2,
+                        float step_size, float epsilon, float gradient,
+                        float &moment, float &second_moment, float &parameter) {
+  const float g = gradient_scale * gradient;
+  moment = beta1 * moment + (1.f - beta1) * g;
+  second_moment = beta2 * second_moment + (1.f - beta2) * g * g;
+  parameter -= step_size * moment / (std::sqrt(second_moment) + epsilon);
+}
+
+/**
+ * @brief      Scale C by beta, writing zeros if beta is zero
+ */
+inline void ScaleMatrix(unsigned int m, unsigned int n, float beta, float *c,
+                        unsigned int ldc) {
+  if (beta == 1.f) {
+    return;
+  }
+  for (unsigned int i = 0; i < m; i++) {
+    float *row = c + static_cast<std::size_t>(i) * ldc;
+    for (unsigned int j = 0; j < n; j++) {
+      row[j] = beta == 0.f ? 0.f : beta * row[j];
+    }
+  }
+}
+
+/**
+ * @brief      Pack an mc x kc block of alpha * op(A) into strips of kMr rows,
+ * stored column by column, zero-padding the last strip.
+ */
+template <unsigned int kMr>
+void PackA(bool transpose_a, const float *a, unsigned int lda, unsigned int row,
+           unsigned int col, unsigned int mc, unsigned int kc, float alpha,
+           float *packed) {
+  for (unsigned int strip = 0; strip < mc; strip += kMr) {
+    const unsigned int rows = Min(kMr, mc - strip);
+    for (unsigned int p = 0; p < kc; p++) {
+      for (unsigned int r = 0; r < kMr; r++) {
+        float value = 0.f;
+        if (r < rows) {
+          const std::size_t i = row + strip + r;
+          const std::size_t j = col + p;
+          value = alpha * (transpose_a ? a[j * lda + i] : a[i * lda + j]);
+        }
+        *packed++ = value;
+      }
+    }
+  }
+}
+
+/**
+ * @brief      Pack a kc x nc block of op(B) into strips of kNr columns,
+ * stored row by row, zero-padding the last strip. B is converted to float.
+ */
+template <unsigned int kNr, typename Element>
+void PackB(bool transpose_b, const Element *b, unsigned int ldb, unsigned int row,
+           unsigned int col, unsigned int kc, unsigned int nc, float *packed) {
+  for (unsigned int strip = 0; strip < nc; strip += kNr) {
+    const unsigned int cols = Min(kNr, nc - strip);
+    for (unsigned int p = 0; p < kc; p++) {
+      const std::size_t i = row + p;
+      for (unsigned int c = 0; c < kNr; c++) {
+        float value = 0.f;
+        if (c < cols) {
+          const std::size_t j = col + strip + c;
+          value = ToFloat(transpose_b ? b[j * ldb + i] : b[i * ldb + j]);
+        }
+        *packed++ = value;
+      }
+    }
+  }
+}
+
+/**
+ * @brief      Blocked GEMM driver shared by every instruction set. Kernel
+ * provides the register tile size (kMr x kNr) and a micro-kernel
+ * Kernel::Run(kc, packed_a, packed_b, c, ldc) that adds the product of a
+ * packed kMr x kc strip and a packed kc x kNr strip to a full tile of C.
+ * B may be stored in any format with a ToFloat conversion.
+ */
+template <typename Kernel, typename Element>
+void GemmDriver(bool transpose_a, bool transpose_b, unsigned int m,
+                unsigned int n, unsigned int k, float alpha, const float *a,
+                unsigned int lda, const Element *b, unsigned int ldb, float beta,
+                float *c, unsigned int ldc) {
+  constexpr unsigned int kMr = Kernel::kMr;
+  constexpr unsigned int kNr = Kernel::kNr;
+  constexpr unsigned int kMcRounded = (kMc + kMr - 1) / kMr * kMr;
+  constexpr unsigned int kNcRounded = (kNc + kNr - 1) / kNr * kNr;
+  ScaleMatrix(m, n, beta, c, ldc);
+  if (m == 0 || n == 0 || k == 0 || alpha == 0.f) {
+    return;
+  }
+  float *packed_a = PackingBuffer(0, static_cast<std::size_t>(kMcRounded) * kKc);
+  float *packed_b = PackingBuffer(1, static_cast<std::size_t>(kKc) * kNcRounded);
+  alignas(64) float edge_tile[kMr * kNr];
+  for (unsigned int jc = 0; jc < n; jc += kNc) {
+    const unsigned int nc = Min(kNc, n - jc);
+    for (unsigned int pc = 0; pc < k; pc += kKc) {
+      const unsigned int kc = Min(kKc, k - pc);
+      PackB<kNr>(transpose_b, b, ldb, pc, jc, kc, nc, packed_b);
+      for (unsigned int ic = 0; ic < m; ic += kMc) {
+        const unsigned int mc = Min(kMc, m - ic);
+        PackA<kMr>(transpose_a, a, lda, ic, pc, mc, kc, alpha, packed_a);
+        for (unsigned int jr = 0; jr < nc; jr += kNr) {
+          const unsigned int cols = Min(kNr, nc - jr);
+          const float *strip_b = packed_b + static_cast<std::size_t>(jr) * kc;
+          for (unsigned int ir = 0; ir < mc; ir += kMr) {
+            const unsigned int rows = Min(kMr, mc - ir);
+            const float *strip_a = packed_a + static_cast<std::size_t>(ir) * kc;
+            float *tile = c + static_cast<std::size_t>(ic + ir) * ldc + jc + jr;
+            if (rows == kMr && cols == kNr) {
+              Kernel::Run(kc, strip_a, strip_b, tile, ldc);
+              continue;
+            }
+            // Partial tile: compute a full tile aside, then add the valid part
+            for (unsigned int i = 0; i < kMr * kNr; i++) {
+              edge_tile[i] = 0.f;
+            }
+            Kernel::Run(kc, strip_a, strip_b, edge_tile, kNr);
+            for (unsigned int r = 0; r < rows; r++) {
+              for (unsigned int col = 0; col < cols; col++) {
+                tile[static_cast<std::size_t>(r) * ldc + col] +=
+                    edge_tile[r * kNr + col];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+} // namespace
+} // namespace kernels
+} // namespace nn
@@ -0,0 +1,66 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace nn {
+
+MappedFile::MappedFile(const std::string &path)
+    : mapping_(MAP_FAILED), size_(0) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open " + path);
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("Can't read " + path);
+  }
+  size_ = status.st_size;
+  mapping_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open
+  close(fd);
+  if (mapping_ == MAP_FAILED) {
+    throw std::runtime_error("Can't map " + path);
+  }
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : mapping_(other.mapping_), size_(other.size_) {
+  other.mapping_ = MAP_FAILED;
+}
+
+MappedFile::~MappedFile() {
+  if (mapping_ != MAP_FAILED) {
+    munmap(mapping_, size_);
+  }
+}
+
+void WriteFileAtomically(
+    const std::string &path,
+    const std::vector<std::pair<const void *, std::size_t>> &blocks) {
+  const std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    for (const auto &[data, size] : blocks) {
+      file.write(static_cast<const char *>(data), size);
+    }
+    file.close();
+    if (!file) {
+      std::remove(temporary_path.c_str());
+      throw std::runtime_error("Can't write " + path);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Can't write " + path);
+  }
+}
+
+} // namespace nn
@@ -0,0 +1,135 @@
+#include "model_file.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "checksum.hpp"
+
+namespace nn {
+
+namespace {
+
+constexpr char kMagic[8] = "NNMODEL";
+constexpr std::uint32_t kByteOrder = 0x01020304;
+constexpr std::uint32_t kFloat32 = 0;
+// Elements per cache line
+constexpr std::size_t kLineElements = kAlignment / sizeof(NNType);
+
+std::uint64_t RoundUp(std::uint64_t size, std::uint64_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * @brief      Whether a layer fits in the parameters, with aligned rows
+ */
+bool IsValidLayer(const ModelFileLayer &layer, std::uint64_t n_parameters) {
+  if (layer.n_inputs == 0 || layer.n_outputs == 0 ||
+      layer.stride < layer.n_inputs || layer.stride % kLineElements != 0 ||
+      layer.weights_offset % kLineElements != 0 ||
+      layer.biases_offset % kLineElements != 0 ||
+      layer.activation > static_cast<std::uint32_t>(kernels::Activation::kRelu)) {
+    return false;
+  }
+  const std::uint64_t weights_size =
+      static_cast<std::uint64_t>(layer.n_outputs) * layer.stride;
+  return layer.weights_offset <= n_parameters &&
+         weights_size <= n_parameters - layer.weights_offset &&
+         layer.biases_offset <= n_parameters &&
+         layer.n_outputs <= n_parameters - layer.biases_offset;
+}
+
+} // namespace
+
+ModelFile::ModelFile(const std::string &path, bool verify_checksum)
+    : file_(path), parameters_(nullptr), n_parameters_(0) {
+  if (file_.size() < sizeof(ModelFileHeader)) {
+    throw std::runtime_error(path + " isn't a model file");
+  }
+  ModelFileHeader header;
+  std::memcpy(&header, file_.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error(path + " isn't a model file");
+  }
+  if (header.byte_order != kByteOrder) {
+    throw std::runtime_error(path + " was written with another byte order");
+  }
+  if (header.version != kModelFileVersion) {
+    throw std::runtime_error(path + " has unsupported format version " +
+                             std::to_string(header.version));
+  }
+  if (header.dtype != kFloat32) {
+    throw std::runtime_error(path + " has an unsupported element type");
+  }
+  const std::uint64_t table_end =
+      sizeof(ModelFileHeader) +
+      static_cast<std::uint64_t>(header.n_layers) * sizeof(ModelFileLayer);
+  if (header.n_layers == 0 || header.parameters_offset % kAlignment != 0 ||
+      header.parameters_offset < table_end ||
+      header.parameters_offset > file_.size() ||
+      header.n_parameters !=
+          (file_.size() - header.parameters_offset) / sizeof(NNType) ||
+      (file_.size() - header.parameters_offset) % sizeof(NNType) != 0) {
+    throw std::runtime_error(path + " has the wrong size for its header");
+  }
+  layers_.resize(header.n_layers);
+  std::memcpy(layers_.data(), file_.data() + sizeof(ModelFileHeader),
+              layers_.size() * sizeof(ModelFileLayer));
+  for (std::size_t layer_idx = 0; layer_idx < layers_.size(); layer_idx++) {
+    const auto &layer = layers_[layer_idx];
+    if (!IsValidLayer(layer, header.n_parameters) ||
+        (layer_idx > 0 && layer.n_inputs != layers_[layer_idx - 1].n_outputs)) {
+      throw std::runtime_error(path + " has an invalid layer " +
+                               std::to_string(layer_idx));
+    }
+  }
+  if (verify_checksum) {
+    Fnv1aHash hash;
+    hash.Update(file_.data() + sizeof(ModelFileHeader),
+                file_.size() - sizeof(ModelFileHeader));
+    if (hash.value() != header.checksum) {
+      throw std::runtime_error(path +
+                               " is corrupt: its checksum doesn't match");
+    }
+  }
+  parameters_ = reinterpret_cast<const NNType *>(file_.data() +
+                                                 header.parameters_offset);
+  n_parameters_ = header.n_parameters;
+}
+
+void ModelFile::Write(const std::string &path,
+                      const std::vector<ModelFileLayer> &layers,
+                      const NNType *parameters, std::size_t n_parameters) {
+  ModelFileHeader header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kModelFileVersion;
+  header.byte_order = kByteOrder;
+  header.dtype = kFloat32;
+  header.n_layers = layers.size();
+  const std::uint64_t table_size = layers.size() * sizeof(ModelFileLayer);
+  header.parameters_offset =
+      RoundUp(sizeof(ModelFileHeader) + table_size, kAlignment);
+  header.n_parameters = n_parameters;
+  // Zeros between the table and the parameters
+  const std::vector<char> padding(
+      header.parameters_offset - sizeof(ModelFileHeader) - table_size, 0);
+  const std::size_t parameters_size = n_parameters * sizeof(NNType);
+  Fnv1aHash hash;
+  hash.Update(layers.data(), table_size);
+  hash.Update(padding.data(), padding.size());
+  hash.Update(parameters, parameters_size);
+  header.checksum = hash.value();
+  WriteFileAtomically(path, {{&header, sizeof(header)},
+                             {layers.data(), table_size},
+                             {padding.data(), padding.size()},
+                             {parameters, parameters_size}});
+}
+
+std::vector<unsigned int> ModelFile::layer_sizes() const {
+  std::vector<unsigned int> layer_sizes = {layers_.front().n_inputs};
+  for (const auto &layer : layers_) {
+    layer_sizes.push_back(layer.n_outputs);
+  }
+  return layer_sizes;
+}
+
+} // namespace nn
@@ -1,44 +1,81 @@
 #include "network.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <iterator>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
 
+#include "checkpoint.hpp"
+#include "collectives.hpp"
+#include "inference_model.hpp"
 #include "linear_algebra.hpp"
+#include "model_file.hpp"
+#include "prefetcher.hpp"
+#include "telemetry.hpp"
+#include "thread_pool.hpp"
 #include "transfer_functions.hpp"
 
 namespace nn {
 
+namespace {
+
+// Number of examples fed forward at a time outside training
+constexpr unsigned int kInferenceBatchSize = 256;
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
 Vector<NNType> IndexToOneHot(unsigned int index, unsigned int n_indexes) {
   assert(index < n_indexes);
   auto one_hot = Vector<NNType>::Zeros(n_indexes);
-  one_hot.elements[index] = static_cast<NNType>(1);
+  one_hot[index] = static_cast<NNType>(1);
   return one_hot;
 }
 
-unsigned int OneHotToIndex(Vector<NNType> vector) {
+unsigned int OneHotToIndex(const Vector<NNType> &vector) {
   const auto result_it =
-      std::find(std::begin(vector.elements), std::end(vector.elements),
-                static_cast<NNType>(1));
-  assert(result_it != std::end(vector.elements));
-  const auto result_idx = std::distance(std::begin(vector.elements), result_it);
+      std::find(vector.begin(), vector.end(), static_cast<NNType>(1));
+  assert(result_it != vector.end());
+  const auto result_idx = std::distance(vector.begin(), result_it);
   return result_idx;
 }
 
-unsigned int GetMaxIndex(Vector<NNType> vector) {
-  const auto result_it =
-      std::max_element(std::begin(vector.elements), std::end(vector.elements));
-  const auto result_idx = std::distance(std::begin(vector.elements), result_it);
+unsigned int GetMaxIndex(const Vector<NNType> &vector) {
+  const auto result_it = std::max_element(vector.begin(), vector.end());
+  const auto result_idx = std::distance(vector.begin(), result_it);
   return result_idx;
 }
 
+Workspace::Workspace(const std::vector<unsigned int> &layer_sizes,
+                     unsigned int max_batch_size)
+    : max_batch_size(max_batch_size),
+      batch(layer_sizes.front(), layer_sizes.back(), max_batch_size) {
+  for (unsigned int i = 1; i < layer_sizes.size(); i++) {
+    activations.emplace_back(max_batch_size, layer_sizes[i]);
+    deltas.emplace_back(max_batch_size, layer_sizes[i]);
+    nabla_b.emplace_back(layer_sizes[i]);
+    nabla_w.emplace_back(layer_sizes[i], layer_sizes[i - 1]);
+  }
+}
+
 Network::Network(std::vector<unsigned int> layer_sizes)
     : layer_sizes_(layer_sizes), num_layers_(layer_sizes.size()) {
-  std::cout << "Randomly initialising network with layer sizes [";
+  std::ostringstream message;
+  message << "Randomly initialising network with layer sizes [";
   for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
-    std::cout << layer_sizes_[layer_idx] << ", ";
+    message << layer_sizes_[layer_idx] << ", ";
   }
-  std::cout << layer_sizes_[num_layers_ - 1] << "]" << std::endl;
+  message << layer_sizes_[num_layers_ - 1] << "]";
+  Log(message.str());
   // Random initialisation of weights and biases
   const NNType mean = 0.f;
   const NNType stddev = 1.f;
@@ -51,159 +88,790 @@ Network::Network(std::vector<unsigned int> layer_sizes)
   }
 }
 
+Network::~Network() = default;
+
 Vector<NNType> Network::FeedForward(Vector<NNType> input) {
-  std::vector<Vector<NNType>> layer_outputs({input});
-  for (unsigned int i = 1; i < num_layers_; i++) {
-    layer_outputs.push_back(
-        Nonlinearity_(weights_[i - 1] * layer_outputs.back() + biases_[i - 1]));
+  // A batch of one, through the same path as training
+  ReserveWorkspaces_(1, 1);
+  auto &workspace = workspaces_.front();
+  auto &inputs = workspace.batch.inputs;
+  std::copy(input.begin(), input.end(), inputs.Row(0).data());
+  FeedForward_(inputs.Block(0, 0, 1, inputs.width), workspace);
+  return Vector<NNType>(workspace.activations.back().Row(0));
+}
+
+Matrix<NNType> Network::FeedForwardBatch(MatrixView<const NNType> inputs,
+                                         unsigned int n_threads) {
+  assert(inputs.width == layer_sizes_.front());
+  Matrix<NNType> outputs(inputs.height, layer_sizes_.back());
+  ForEachChunk_(
+      inputs.height,
+      [&](unsigned int start_idx, unsigned int end_idx, Workspace &workspace) {
+        // The inputs are used in place
+        const unsigned int batch_size = end_idx - start_idx;
+        FeedForward_(inputs.Block(start_idx, 0, batch_size, inputs.width),
+                     workspace);
+        const auto &chunk_outputs = workspace.activations.back();
+        std::copy(chunk_outputs.data(),
+                  chunk_outputs.data() + batch_size * chunk_outputs.width,
+                  outputs.Row(start_idx).data());
+      },
+      InferenceThreadPool_(n_threads));
+  return outputs;
+}
+
+unsigned int Network::Evaluate(const Dataset &test_data,
+                               unsigned int n_threads) {
+  return Evaluate_(test_data, InferenceThreadPool_(n_threads));
+}
+
+ThreadPool &Network::InferenceThreadPool_(unsigned int n_threads) {
+  if (!inference_thread_pool_ || n_threads != inference_n_threads_) {
+    // The old threads are joined before the new ones start
+    inference_thread_pool_.reset();
+    inference_thread_pool_ = std::make_unique<ThreadPool>(n_threads);
+    inference_n_threads_ = n_threads;
+  }
+  return *inference_thread_pool_;
+}
+
+void Network::Sgd(
+    const AnnotatedData &training_data, unsigned int epochs,
+    unsigned int mini_batch_size, NNType eta,
+    std::optional<std::reference_wrapper<const AnnotatedData>> test_data,
+    const TrainingOptions &options) {
+  const AnnotatedDataset training_dataset(training_data);
+  if (test_data) {
+    const AnnotatedDataset test_dataset(*test_data);
+    Sgd(training_dataset, epochs, mini_batch_size, eta, &test_dataset, options);
+  } else {
+    Sgd(training_dataset, epochs, mini_batch_size, eta, nullptr, options);
   }
-  return layer_outputs.back();
 }
 
-void Network::Sgd(AnnotatedData training_data, unsigned int epochs,
+void Network::Sgd(const Dataset &training_data, unsigned int epochs,
                   unsigned int mini_batch_size, NNType eta,
-                  std::optional<AnnotatedData> test_data) {
+                  const Dataset *test_data, const TrainingOptions &options) {
+  Sgd_(training_data, epochs, mini_batch_size, eta, test_data, options,
+       nullptr);
+}
+
+void Network::ResumeSgd(const std::string &checkpoint_path,
+                        const Dataset &training_data, unsigned int epochs,
+                        NNType eta, const Dataset *test_data,
+                        const TrainingOptions &options) {
+  const TrainingState state = LoadCheckpoint(checkpoint_path);
+  if (state.layer_sizes != layer_sizes_) {
+    throw std::runtime_error(checkpoint_path + " has different layer sizes");
+  }
+  if (state.optimizer != static_cast<std::uint32_t>(options.optimizer.type)) {
+    throw std::runtime_error(checkpoint_path +
+                             " is for a different optimizer type");
+  }
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    if (static_cast<kernels::Activation>(state.activations[layer_idx]) !=
+        LayerActivation_(layer_idx)) {
+      throw std::runtime_error(checkpoint_path + " has different activations");
+    }
+  }
+  if (state.permutation.size() != training_data.size()) {
+    throw std::runtime_error(checkpoint_path +
+                             " is for a different training set");
+  }
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    weights_[layer_idx] = state.weights[layer_idx];
+    biases_[layer_idx] = state.biases[layer_idx];
+    StoreWeights_(layer_idx);
+  }
+  Sgd_(training_data, epochs, state.mini_batch_size, eta, test_data, options,
+       &state);
+}
+
+void Network::Sgd_(const Dataset &training_data, unsigned int epochs,
+                   unsigned int mini_batch_size, NNType eta,
+                   const Dataset *test_data, const TrainingOptions &options,
+                   const TrainingState *resume) {
   // Train the neural network using mini-batch stochastic
   // gradient descent.  The "training_data" is a list of pairs
   // "(x, y)" representing the training inputs and the desired
   // outputs.  The other non-optional parameters are
   // self-explanatory.  If "test_data" is provided then the
   // network will be evaluated against the test data after each
-  // epoch, and partial progress printed out.  This is useful for
-  // tracking progress, but slows things down substantially.
+  // epoch, and partial progress printed out.  Evaluation is batched
+  // and uses the training threads, so it costs little next to an epoch.
+  Transport *transport = options.transport;
+  if (transport && options.hogwild) {
+    throw std::invalid_argument(
+        "Data parallel training can't be combined with Hogwild training");
+  }
+  ThreadPool thread_pool(options.n_threads);
+  // Data parallel training takes mini_batch_size examples of every step on
+  // each process
+  const unsigned int n_ranks = transport ? transport->size() : 1;
+  const unsigned int rank = transport ? transport->rank() : 0;
+  const unsigned int step_size = n_ranks * mini_batch_size;
+  // Synchronous training splits every mini-batch across the threads, while
+  // Hogwild gives every thread whole mini-batches
+  const unsigned int n_shards = std::min(thread_pool.size(), mini_batch_size);
+  ReserveWorkspaces_(thread_pool.size(),
+                     options.hogwild
+                         ? mini_batch_size
+                         : (mini_batch_size + n_shards - 1) / n_shards);
+  assert(training_data.input_size() == layer_sizes_.front());
+  assert(training_data.output_size() == layer_sizes_.back());
+  if (transport) {
+    BroadcastParameters_(*transport);
+  }
   const unsigned int n_test = test_data ? test_data->size() : 0;
   if (test_data) {
-    std::cout << "Initial evaluation: " << Evaluate_(test_data.value()) << " / "
-              << n_test << std::endl;
+    Log("Initial evaluation: " +
+        std::to_string(Evaluate_(*test_data, thread_pool)) + " / " +
+        std::to_string(n_test));
   }
   const unsigned int n_training = training_data.size();
-  for (unsigned int epoch_idx = 0; epoch_idx < epochs; epoch_idx++) {
-    // obtain a time-based seed:
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::shuffle(training_data.begin(), training_data.end(),
-                 std::default_random_engine(seed));
-    assert(n_training % mini_batch_size == 0);
-    const unsigned int n_mini_batches = n_training / mini_batch_size;
-    std::vector<AnnotatedData> mini_batches;
-    for (unsigned int mini_batch_idx = 0; mini_batch_idx < n_mini_batches;
-         mini_batch_idx++) {
-      const unsigned int start_idx = mini_batch_idx * mini_batch_size;
-      const unsigned int end_idx = (mini_batch_idx + 1) * mini_batch_size;
-      mini_batches.push_back(AnnotatedData(training_data.begin() + start_idx,
-                                           training_data.begin() + end_idx));
+  // obtain a time-based seed unless one was given:
+  unsigned seed =
+      options.seed ? *options.seed
+                   : std::chrono::system_clock::now().time_since_epoch().count();
+  if (transport) {
+    // Every process shuffles alike
+    Broadcast(*transport, &seed, sizeof(seed));
+  }
+  std::default_random_engine shuffle_engine(seed);
+  // Shuffle indices rather than the examples themselves, and train on views
+  // of the data selected by them
+  std::vector<unsigned int> permutation(n_training);
+  std::iota(permutation.begin(), permutation.end(), 0);
+  // A resumed job continues from the mini-batch after the checkpoint
+  unsigned int first_epoch_idx = 0;
+  unsigned int first_mini_batch_idx = 0;
+  if (resume) {
+    std::istringstream engine_state(resume->shuffle_engine);
+    engine_state >> shuffle_engine;
+    if (!engine_state) {
+      throw std::runtime_error("Invalid shuffle engine state in checkpoint");
     }
-    unsigned int mini_batch_idx = 0;
-    for (const auto &mini_batch : mini_batches) {
-      UpdateMiniBatch_(mini_batch, eta);
+    permutation = resume->permutation;
+    first_epoch_idx = resume->epoch_idx;
+    first_mini_batch_idx = resume->mini_batch_idx;
+  }
+  // Each process trains on its share of every step, gathered in order into
+  // rank_indices
+  const unsigned int n_rank_examples = n_training / n_ranks;
+  std::vector<unsigned int> rank_indices(n_ranks > 1 ? n_rank_examples : 0);
+  const unsigned int *epoch_indices =
+      n_ranks > 1 ? rank_indices.data() : permutation.data();
+  const MiniBatch epoch_data(training_data, epoch_indices, n_rank_examples);
+  // Mini-batches are assembled in the background if prefetching, and by the
+  // training threads otherwise
+  std::optional<Prefetcher> prefetcher;
+  if (options.prefetch_depth > 0) {
+    prefetcher.emplace(training_data, mini_batch_size, options.prefetch_depth,
+                       std::max(options.n_prefetch_threads, 1u));
+  }
+  // Allocates the optimizer's state once for the job
+  Optimizer optimizer(options.optimizer, layer_sizes_);
+  if (resume) {
+    optimizer.SetState(resume->optimizer_state);
+  }
+  std::optional<CheckpointWriter> checkpoint_writer;
+  if (!options.checkpoint_path.empty() && rank == 0) {
+    checkpoint_writer.emplace(options.checkpoint_path);
+  }
+  const unsigned int n_mini_batches = n_training / step_size;
+  for (unsigned int epoch_idx = first_epoch_idx; epoch_idx < epochs;
+       epoch_idx++) {
+    const unsigned int start_mini_batch_idx =
+        epoch_idx == first_epoch_idx ? first_mini_batch_idx : 0;
+    if (start_mini_batch_idx == 0) {
+      std::shuffle(permutation.begin(), permutation.end(), shuffle_engine);
     }
+    assert(n_training % step_size == 0);
+    for (unsigned int step_idx = 0; n_ranks > 1 && step_idx < n_mini_batches;
+         step_idx++) {
+      const auto share =
+          permutation.begin() + step_idx * step_size + rank * mini_batch_size;
+      std::copy(share, share + mini_batch_size,
+                rank_indices.begin() + step_idx * mini_batch_size);
+    }
+    // Index of the first example of this process in epoch_data
+    const unsigned int start_idx = start_mini_batch_idx * mini_batch_size;
+    const auto epoch_start = Clock::now();
+    // The loss and accuracy are summed over the epoch, and divided at the end
+    EpochReport epoch_report;
+    epoch_report.epoch_idx = epoch_idx;
+    epoch_report.n_examples = n_training - start_mini_batch_idx * step_size;
+    // Report a training step, and checkpoint after it if one is due and it
+    // isn't the last of the epoch (which is checkpointed as the start of the
+    // next one)
+    const auto finish_step = [&](unsigned int mini_batch_idx,
+                                 Clock::time_point step_start,
+                                 MiniBatchReport &report) {
+      report.epoch_idx = epoch_idx;
+      report.mini_batch_idx = mini_batch_idx;
+      report.n_examples = step_size;
+      report.seconds = SecondsSince(step_start);
+      report.examples_per_second = step_size / report.seconds;
+      epoch_report.loss += report.loss * step_size;
+      epoch_report.accuracy += report.accuracy * step_size;
+      epoch_report.phase_times += report.phase_times;
+      if (options.on_mini_batch) {
+        options.on_mini_batch(report);
+      }
+      if (checkpoint_writer && options.checkpoint_interval > 0 &&
+          (mini_batch_idx + 1) % options.checkpoint_interval == 0 &&
+          mini_batch_idx + 1 < n_mini_batches) {
+        Checkpoint_(*checkpoint_writer, mini_batch_size, epoch_idx,
+                    mini_batch_idx + 1, permutation, shuffle_engine,
+                    optimizer);
+      }
+    };
+    if (prefetcher) {
+      prefetcher->StartEpoch(epoch_indices + start_idx,
+                             n_rank_examples - start_idx, mini_batch_size);
+    }
+    if (options.hogwild) {
+      UpdateMiniBatchesHogwild_(epoch_data.Slice(start_idx, n_rank_examples),
+                                mini_batch_size, eta, optimizer, thread_pool,
+                                prefetcher ? &*prefetcher : nullptr,
+                                epoch_report);
+    } else if (prefetcher) {
+      for (unsigned int mini_batch_idx = start_mini_batch_idx;;
+           mini_batch_idx++) {
+        const auto step_start = Clock::now();
+        MiniBatchReport report;
+        const Batch *batch;
+        {
+          NN_TIME_PHASE(report.phase_times, Phase::kData);
+          batch = prefetcher->Next();
+        }
+        if (!batch) {
+          break;
+        }
+        UpdateMiniBatch_(batch->View(), eta, optimizer, transport,
+                         thread_pool, report);
+        prefetcher->Release(batch);
+        finish_step(mini_batch_idx, step_start, report);
+      }
+    } else {
+      for (unsigned int mini_batch_idx = start_mini_batch_idx;
+           mini_batch_idx < n_mini_batches; mini_batch_idx++) {
+        const auto step_start = Clock::now();
+        MiniBatchReport report;
+        const unsigned int batch_start_idx = mini_batch_idx * mini_batch_size;
+        UpdateMiniBatch_(epoch_data.Slice(batch_start_idx,
+                                          batch_start_idx + mini_batch_size),
+                         eta, optimizer, transport, thread_pool, report);
+        finish_step(mini_batch_idx, step_start, report);
+      }
+    }
+    if (checkpoint_writer) {
+      // Don't skip the end of an epoch, which is worth waiting for
+      checkpoint_writer->Wait();
+      Checkpoint_(*checkpoint_writer, mini_batch_size, epoch_idx + 1, 0,
+                  permutation, shuffle_engine, optimizer);
+    }
+    epoch_report.seconds = SecondsSince(epoch_start);
+    epoch_report.examples_per_second =
+        epoch_report.n_examples / epoch_report.seconds;
+    epoch_report.loss /= epoch_report.n_examples;
+    epoch_report.accuracy /= epoch_report.n_examples;
     if (test_data) {
-      std::cout << "Epoch " << epoch_idx << ": " << Evaluate_(test_data.value())
-                << " / " << n_test << std::endl;
+      NN_TIME_PHASE(epoch_report.phase_times, Phase::kEval);
+      epoch_report.n_test = n_test;
+      epoch_report.n_test_correct = Evaluate_(*test_data, thread_pool);
+    }
+    if (options.on_epoch) {
+      options.on_epoch(epoch_report);
+    } else if (test_data) {
+      Log("Epoch " + std::to_string(epoch_idx) + ": " +
+          std::to_string(epoch_report.n_test_correct) + " / " +
+          std::to_string(n_test));
     } else {
-      std::cout << "Epoch " << epoch_idx << " complete" << std::endl;
+      Log("Epoch " + std::to_string(epoch_idx) + " complete");
     }
   }
+  if (checkpoint_writer) {
+    checkpoint_writer->Wait();
+  }
+  if (prefetcher && options.prefetch_stats) {
+    *options.prefetch_stats = prefetcher->stats();
+  }
 }
 
-void Network::UpdateMiniBatch_(AnnotatedData mini_batch, NNType eta) {
-  Biases nabla_b;
-  for (const auto &layer_biases : biases_) {
-    nabla_b.push_back(Vector<NNType>::Zeros(layer_biases.length));
+void Network::Checkpoint_(
+    CheckpointWriter &writer, unsigned int mini_batch_size,
+    unsigned int epoch_idx, unsigned int mini_batch_idx,
+    const std::vector<unsigned int> &permutation,
+    const std::default_random_engine &shuffle_engine,
+    const Optimizer &optimizer) const {
+  TrainingState *state = writer.Begin();
+  if (!state) {
+    return;
+  }
+  state->layer_sizes = layer_sizes_;
+  state->activations.resize(num_layers_ - 1);
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    state->activations[layer_idx] =
+        static_cast<std::uint32_t>(LayerActivation_(layer_idx));
   }
-  Weights nabla_w;
-  for (const auto &layer_weights : weights_) {
-    nabla_w.push_back(
-        Matrix<NNType>::Zeros(layer_weights.height, layer_weights.width));
+  state->mini_batch_size = mini_batch_size;
+  state->epoch_idx = epoch_idx;
+  state->mini_batch_idx = mini_batch_idx;
+  state->permutation = permutation;
+  std::ostringstream engine_state;
+  engine_state << shuffle_engine;
+  state->shuffle_engine = engine_state.str();
+  // Copies into the buffers of the previous checkpoint, after the first
+  state->weights = weights_;
+  state->biases = biases_;
+  state->optimizer = static_cast<std::uint32_t>(optimizer.options().type);
+  optimizer.GetState(state->optimizer_state);
+  writer.Commit();
+}
+
+void Network::UpdateMiniBatch_(const MiniBatch &mini_batch, NNType eta,
+                               Optimizer &optimizer, Transport *transport,
+                               ThreadPool &thread_pool,
+                               MiniBatchReport &report) {
+  UpdateShards_(
+      mini_batch.size(),
+      [&](unsigned int start_idx, unsigned int end_idx, Workspace &workspace) {
+        ComputeGradients_(mini_batch.Slice(start_idx, end_idx), workspace);
+      },
+      eta, optimizer, transport, thread_pool, report);
+}
+
+void Network::UpdateMiniBatch_(const BatchView &batch, NNType eta,
+                               Optimizer &optimizer, Transport *transport,
+                               ThreadPool &thread_pool,
+                               MiniBatchReport &report) {
+  UpdateShards_(
+      batch.size,
+      [&](unsigned int start_idx, unsigned int end_idx, Workspace &workspace) {
+        Backprop_(batch.Slice(start_idx, end_idx), workspace);
+      },
+      eta, optimizer, transport, thread_pool, report);
+}
+
+template <typename ShardGradients>
+void Network::UpdateShards_(unsigned int batch_size,
+                            ShardGradients &&shard_gradients, NNType eta,
+                            Optimizer &optimizer, Transport *transport,
+                            ThreadPool &thread_pool, MiniBatchReport &report) {
+  // Split the mini-batch into one contiguous shard per thread, each with its
+  // own workspace and gradients
+  const unsigned int n_shards = std::min(thread_pool.size(), batch_size);
+  thread_pool.ParallelFor(n_shards, [&](unsigned int shard_idx) {
+    const unsigned int start_idx = shard_idx * batch_size / n_shards;
+    const unsigned int end_idx = (shard_idx + 1) * batch_size / n_shards;
+    auto &workspace = workspaces_[shard_idx];
+    workspace.phase_times = PhaseTimes();
+    shard_gradients(start_idx, end_idx, workspace);
+  });
+  double loss = 0;
+  unsigned int n_correct = 0;
+  for (unsigned int shard_idx = 0; shard_idx < n_shards; shard_idx++) {
+    loss += workspaces_[shard_idx].loss;
+    n_correct += workspaces_[shard_idx].n_correct;
   }
-  for (const auto &example : mini_batch) {
-    const auto delta_nabla_b_and_w = Backprop_(example);
-    const auto delta_nabla_b = delta_nabla_b_and_w.first;
-    const auto delta_nabla_w = delta_nabla_b_and_w.second;
-    for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
-      nabla_b[layer_idx] += delta_nabla_b[layer_idx];
-      nabla_w[layer_idx] += delta_nabla_w[layer_idx];
+  report.phase_times += workspaces_.front().phase_times;
+  {
+    NN_TIME_PHASE(report.phase_times, Phase::kUpdate);
+    // Tree reduction into the first shard: at each level, shard i
+    // accumulates shard i + stride, for every i that is a multiple of
+    // 2 * stride
+    for (unsigned int stride = 1; stride < n_shards; stride *= 2) {
+      const unsigned int n_pairs = (n_shards + 2 * stride - 1) / (2 * stride);
+      thread_pool.ParallelFor(n_pairs, [&](unsigned int pair_idx) {
+        const unsigned int dst_idx = pair_idx * 2 * stride;
+        const unsigned int src_idx = dst_idx + stride;
+        if (src_idx >= n_shards) {
+          return;
+        }
+        auto &dst = workspaces_[dst_idx];
+        const auto &src = workspaces_[src_idx];
+        for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1;
+             layer_idx++) {
+          dst.nabla_b[layer_idx] += src.nabla_b[layer_idx];
+          dst.nabla_w[layer_idx] += src.nabla_w[layer_idx];
+        }
+      });
     }
   }
+  // The other processes' shares of the step, after which every process
+  // has the same sums
+  unsigned int n_examples = batch_size;
+  if (transport) {
+    NN_TIME_PHASE(report.phase_times, Phase::kAllReduce);
+    AllReduceGradients_(*transport, loss, n_correct);
+    n_examples *= transport->size();
+  }
+  report.loss = loss / n_examples;
+  report.accuracy = static_cast<double>(n_correct) / n_examples;
+  NN_TIME_PHASE(report.phase_times, Phase::kUpdate);
+  ApplyGradients_(workspaces_.front(), eta, n_examples, optimizer);
+}
+
+void Network::AllReduceGradients_(Transport &transport, double &loss,
+                                  unsigned int &n_correct) {
+  auto &workspace = workspaces_.front();
+  std::size_t n_values = 2;
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    n_values += workspace.nabla_w[layer_idx].size() +
+                workspace.nabla_b[layer_idx].length;
+  }
+  all_reduce_data_.resize(n_values);
+  NNType *values = all_reduce_data_.data();
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    const auto &nabla_w = workspace.nabla_w[layer_idx];
+    const auto &nabla_b = workspace.nabla_b[layer_idx];
+    values = std::copy(nabla_w.data(), nabla_w.data() + nabla_w.size(), values);
+    values = std::copy(nabla_b.begin(), nabla_b.end(), values);
+  }
+  // Single precision is plenty for the statistics of a step
+  values[0] = static_cast<NNType>(loss);
+  values[1] = static_cast<NNType>(n_correct);
+  AllReduceSum(transport, all_reduce_data_.data(), n_values,
+               all_reduce_buffer_);
+  const NNType *sums = all_reduce_data_.data();
   for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
-    biases_[layer_idx] -= (eta / mini_batch.size()) * nabla_b[layer_idx];
-    weights_[layer_idx] -= (eta / mini_batch.size()) * nabla_w[layer_idx];
+    auto &nabla_w = workspace.nabla_w[layer_idx];
+    auto &nabla_b = workspace.nabla_b[layer_idx];
+    std::copy(sums, sums + nabla_w.size(), nabla_w.data());
+    sums += nabla_w.size();
+    std::copy(sums, sums + nabla_b.length, nabla_b.begin());
+    sums += nabla_b.length;
   }
+  loss = sums[0];
+  n_correct = static_cast<unsigned int>(sums[1]);
 }
 
-DeltaNablaBAndW Network::Backprop_(Example example) {
-  // Return a pair "(nabla_b, nabla_w)" representing the
-  // gradient for the cost function C_x. "nabla_b" and
-  // "nabla_w" are layer-by-layer lists of Vectors and
-  // Matrixes respectively
-  Biases nabla_b;
-  for (const auto &layer_biases : biases_) {
-    nabla_b.push_back(Vector<NNType>::Zeros(layer_biases.length));
+void Network::BroadcastParameters_(Transport &transport) {
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    auto &weights = weights_[layer_idx];
+    auto &biases = biases_[layer_idx];
+    Broadcast(transport, weights.data(), weights.size() * sizeof(NNType));
+    Broadcast(transport, biases.data(), biases.length * sizeof(NNType));
+    StoreWeights_(layer_idx);
   }
-  Weights nabla_w;
-  for (const auto &layer_weights : weights_) {
-    nabla_w.push_back(
-        Matrix<NNType>::Zeros(layer_weights.height, layer_weights.width));
+}
+
+void Network::UpdateMiniBatchesHogwild_(const MiniBatch &epoch_data,
+                                        unsigned int mini_batch_size,
+                                        NNType eta, Optimizer &optimizer,
+                                        ThreadPool &thread_pool,
+                                        Prefetcher *prefetcher,
+                                        EpochReport &report) {
+  // The work queue is the sequence of mini-batches with an atomic cursor, so
+  // taking work is a single fetch_add (or the prefetcher's queue)
+  const unsigned int n_mini_batches = epoch_data.size() / mini_batch_size;
+  std::atomic<unsigned int> next_mini_batch_idx{0};
+  thread_pool.ParallelFor(thread_pool.size(), [&](unsigned int thread_idx) {
+    auto &workspace = workspaces_[thread_idx];
+    workspace.phase_times = PhaseTimes();
+    // Every thread sums the loss and accuracy of its mini-batches
+    workspace.epoch_loss = 0;
+    workspace.epoch_n_correct = 0;
+    const auto update = [&] {
+      workspace.epoch_loss += workspace.loss;
+      workspace.epoch_n_correct += workspace.n_correct;
+      NN_TIME_PHASE(workspace.phase_times, Phase::kUpdate);
+      ApplyGradients_(workspace, eta, mini_batch_size, optimizer);
+    };
+    while (prefetcher) {
+      const Batch *batch;
+      {
+        NN_TIME_PHASE(workspace.phase_times, Phase::kData);
+        batch = prefetcher->Next();
+      }
+      if (!batch) {
+        return;
+      }
+      // Unlocked update, as below
+      Backprop_(batch->View(), workspace);
+      prefetcher->Release(batch);
+      update();
+    }
+    while (true) {
+      const unsigned int mini_batch_idx =
+          next_mini_batch_idx.fetch_add(1, std::memory_order_relaxed);
+      if (mini_batch_idx >= n_mini_batches) {
+        return;
+      }
+      const unsigned int start_idx = mini_batch_idx * mini_batch_size;
+      // Reads and writes the shared parameters while other threads do the
+      // same, without locking (see TrainingOptions::hogwild)
+      ComputeGradients_(
+          epoch_data.Slice(start_idx, start_idx + mini_batch_size), workspace);
+      update();
+    }
+  });
+  for (unsigned int thread_idx = 0; thread_idx < thread_pool.size();
+       thread_idx++) {
+    const auto &workspace = workspaces_[thread_idx];
+    report.loss += workspace.epoch_loss;
+    report.accuracy += workspace.epoch_n_correct;
+    auto phase_times = workspace.phase_times;
+    for (auto &seconds : phase_times.seconds) {
+      seconds /= thread_pool.size();
+    }
+    report.phase_times += phase_times;
   }
+}
 
-  // Feedforward
-  std::vector<Vector<NNType>> activations({example.first}); // layer activations
-  std::vector<Vector<NNType>> zs;                           // z vectors
+void Network::ApplyGradients_(const Workspace &workspace, NNType eta,
+                              unsigned int batch_size, Optimizer &optimizer) {
+  const std::uint64_t step = optimizer.BeginStep();
   for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
-    zs.push_back(weights_[layer_idx] * activations.back() + biases_[layer_idx]);
-    activations.push_back(Nonlinearity_(zs.back()));
+    optimizer.Update(layer_idx, step, eta, batch_size,
+                     workspace.nabla_w[layer_idx],
+                     workspace.nabla_b[layer_idx], weights_[layer_idx],
+                     biases_[layer_idx]);
+    StoreWeights_(layer_idx);
   }
+}
+
+void Network::SetWeightStorage(WeightStorage storage) {
+  weight_storage_ = storage;
+  float16_weights_.clear();
+  bfloat16_weights_.clear();
+  for (const auto &weights : weights_) {
+    if (storage == WeightStorage::kFloat16) {
+      float16_weights_.emplace_back(weights.height, weights.width);
+    } else if (storage == WeightStorage::kBFloat16) {
+      bfloat16_weights_.emplace_back(weights.height, weights.width);
+    }
+  }
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    StoreWeights_(layer_idx);
+  }
+}
 
-  // Backward pass
-  // Calculate the gradients of the last layer
-  auto delta = CostDerivative_(activations.back(), example.second) *
-               NonlinearityPrime_(zs.back());
-  nabla_b.back() = delta;
-  nabla_w.back() = delta.OuterProduct(activations.end()[-2]);
+void Network::SetSparseInputDensity(double max_density) {
+  assert(max_density >= 0 && max_density <= 1);
+  sparse_input_density_ = max_density;
+}
+
+void Network::Save(const std::string &path) const {
+  // The file is the layout of an inference model
+  InferenceModel(*this, 1).Save(path);
+}
+
+void Network::Load(const std::string &path) {
+  const ModelFile file(path);
+  if (file.layer_sizes() != layer_sizes_) {
+    throw std::runtime_error(path + " has different layer sizes");
+  }
+  for (unsigned int layer_idx = 0; layer_idx < num_layers_ - 1; layer_idx++) {
+    const auto &layer = file.layers()[layer_idx];
+    if (static_cast<kernels::Activation>(layer.activation) !=
+        LayerActivation_(layer_idx)) {
+      throw std::runtime_error(path + " has different activations");
+    }
+    auto &weights = weights_[layer_idx];
+    for (unsigned int row_idx = 0; row_idx < layer.n_outputs; row_idx++) {
+      const NNType *row = file.parameters() + layer.weights_offset +
+                          static_cast<std::size_t>(row_idx) * layer.stride;
+      std::copy(row, row + layer.n_inputs, weights.Row(row_idx).data());
+    }
+    const NNType *biases = file.parameters() + layer.biases_offset;
+    std::copy(biases, biases + layer.n_outputs, biases_[layer_idx].begin());
+    StoreWeights_(layer_idx);
+  }
+}
 
-  // Now iterate backwards from the penultimate layer (-2)
-  for (int neg_layer_idx = -2; neg_layer_idx > -num_layers_; neg_layer_idx--) {
-    const auto z = zs.end()[neg_layer_idx];
-    nabla_b.end()[neg_layer_idx] =
-        weights_.end()[neg_layer_idx + 1].Transpose() *
-        nabla_b.end()[neg_layer_idx + 1] * NonlinearityPrime_(z);
-    nabla_w.end()[neg_layer_idx] = nabla_b.end()[neg_layer_idx].OuterProduct(
-        activations.end()[neg_layer_idx - 1]);
+void Network::StoreWeights_(unsigned int layer_idx) {
+  const auto &weights = weights_[layer_idx];
+  if (weight_storage_ == WeightStorage::kFloat16) {
+    kernels::ConvertToHalf(weights.size(), weights.data(),
+                           float16_weights_[layer_idx].data());
+  } else if (weight_storage_ == WeightStorage::kBFloat16) {
+    kernels::ConvertToHalf(weights.size(), weights.data(),
+                           bfloat16_weights_[layer_idx].data());
   }
-  return std::make_pair(nabla_b, nabla_w);
 }
 
-Vector<NNType> Network::CostDerivative_(Vector<NNType> output,
-                                       Vector<NNType> ground_truth) {
-  return output - ground_truth;
+void Network::MultiplyByWeights_(unsigned int layer_idx,
+                                 MatrixView<const NNType> a,
+                                 bool transpose_weights,
+                                 MatrixView<NNType> c) const {
+  switch (weight_storage_) {
+  case WeightStorage::kFloat16:
+    Gemm(1.f, a, false, float16_weights_[layer_idx].View(), transpose_weights,
+         0.f, c);
+    break;
+  case WeightStorage::kBFloat16:
+    Gemm(1.f, a, false, bfloat16_weights_[layer_idx].View(),
+         transpose_weights, 0.f, c);
+    break;
+  default:
+    Gemm(1.f, a, false, weights_[layer_idx].View(), transpose_weights, 0.f,
+         c);
+  }
 }
 
-unsigned int Network::Evaluate_(AnnotatedData test_data) {
-  unsigned int n_correct = 0;
-  for (const auto &example : test_data) {
-    const auto output = FeedForward(example.first);
-    const auto result_idx = GetMaxIndex(output);
-    const auto gt_result_idx = OneHotToIndex(example.second);
-    if (result_idx == gt_result_idx) {
-      n_correct++;
+void Network::MultiplyLayerInputs_(unsigned int layer_idx,
+                                   MatrixView<const NNType> layer_inputs,
+                                   Workspace &workspace,
+                                   MatrixView<NNType> c) const {
+  if (layer_idx == 0) {
+    workspace.inputs_are_sparse =
+        sparse_input_density_ > 0 &&
+        workspace.sparse_inputs.Assign(layer_inputs, sparse_input_density_);
+    if (workspace.inputs_are_sparse) {
+      MultiplyTransposed(workspace.sparse_inputs.View(), weights_[0].View(),
+                         c);
+      return;
     }
   }
-  return n_correct;
+  MultiplyByWeights_(layer_idx, layer_inputs, true, c);
 }
 
-Vector<NNType> SigmoidNetwork::Nonlinearity_(Vector<NNType> weighted_inputs) {
-  return Sigmoid(weighted_inputs);
+void Network::WeightGradients_(unsigned int layer_idx,
+                               MatrixView<const NNType> delta,
+                               MatrixView<const NNType> layer_inputs,
+                               Workspace &workspace) {
+  auto nabla_w = workspace.nabla_w[layer_idx].View();
+  if (layer_idx == 0 && workspace.inputs_are_sparse) {
+    TransposedMultiply(delta, workspace.sparse_inputs.View(), nabla_w);
+    return;
+  }
+  Gemm(1.f, delta, true, layer_inputs, false, 0.f, nabla_w);
 }
 
-Vector<NNType> SigmoidNetwork::NonlinearityPrime_(Vector<NNType> weighted_inputs) {
-  return SigmoidPrime(weighted_inputs);
+void Network::ReserveWorkspaces_(unsigned int n_workspaces,
+                                 unsigned int max_batch_size) {
+  if (workspaces_.size() >= n_workspaces &&
+      workspaces_.front().max_batch_size >= max_batch_size) {
+    return;
+  }
+  workspaces_.clear();
+  for (unsigned int workspace_idx = 0; workspace_idx < n_workspaces;
+       workspace_idx++) {
+    workspaces_.emplace_back(layer_sizes_, max_batch_size);
+  }
 }
 
-Vector<NNType> ReluNetwork::Nonlinearity_(Vector<NNType> weighted_inputs) {
-  return Relu(weighted_inputs);
+void Network::ComputeGradients_(const MiniBatch &mini_batch,
+                                Workspace &workspace) {
+  // Stack the examples, one per row
+  assert(mini_batch.size() <= workspace.max_batch_size);
+  {
+    NN_TIME_PHASE(workspace.phase_times, Phase::kData);
+    workspace.batch.Assemble(mini_batch);
+  }
+  Backprop_(workspace.batch.View(), workspace);
 }
 
-Vector<NNType> ReluNetwork::NonlinearityPrime_(Vector<NNType> weighted_inputs) {
-  return ReluPrime(weighted_inputs);
+void Network::CostDerivative_(const BatchView &batch, Workspace &workspace) {
+  const auto &outputs = workspace.activations.back();
+  auto &cost_derivatives = workspace.deltas.back();
+  // The cost is half the squared norm of the derivative
+  double loss = 0;
+  unsigned int n_correct = 0;
+  for (unsigned int i = 0; i < batch.size; i++) {
+    const NNType *output = outputs.Row(i).data();
+    NNType *cost_derivative = cost_derivatives.Row(i).data();
+    unsigned int gt_result_idx;
+    if (batch.labels) {
+      std::copy(output, output + outputs.width, cost_derivative);
+      cost_derivative[batch.labels[i]] -= static_cast<NNType>(1);
+      gt_result_idx = batch.labels[i];
+    } else {
+      const NNType *ground_truth = batch.ground_truths.Row(i).data();
+      for (unsigned int j = 0; j < outputs.width; j++) {
+        cost_derivative[j] = output[j] - ground_truth[j];
+      }
+      gt_result_idx =
+          std::max_element(ground_truth, ground_truth + outputs.width) -
+          ground_truth;
+    }
+    NNType squared_norm = 0;
+    for (unsigned int j = 0; j < outputs.width; j++) {
+      squared_norm += cost_derivative[j] * cost_derivative[j];
+    }
+    loss += 0.5 * squared_norm;
+    const unsigned int result_idx =
+        std::max_element(output, output + outputs.width) - output;
+    if (result_idx == gt_result_idx) {
+      n_correct++;
+    }
+  }
+  workspace.loss = loss;
+  workspace.n_correct = n_correct;
+}
+
+unsigned int Network::Evaluate_(const Dataset &test_data,
+                                ThreadPool &thread_pool) {
+  // Every thread counts in its workspace, and the counts are summed at the
+  // end
+  ReserveWorkspaces_(thread_pool.size(), kInferenceBatchSize);
+  for (auto &workspace : workspaces_) {
+    workspace.n_correct = 0;
+  }
+  ForEachChunk_(
+      test_data.size(),
+      [&](unsigned int start_idx, unsigned int end_idx, Workspace &workspace) {
+        const unsigned int batch_size = end_idx - start_idx;
+        auto &inputs = workspace.batch.inputs;
+        auto &ground_truths = workspace.batch.ground_truths;
+        const auto &outputs = workspace.activations.back();
+        for (unsigned int example_idx = 0; example_idx < batch_size;
+             example_idx++) {
+          test_data.GetInput(start_idx + example_idx,
+                             inputs.Row(example_idx).data());
+        }
+        FeedForward_(inputs.Block(0, 0, batch_size, inputs.width), workspace);
+        for (unsigned int example_idx = 0; example_idx < batch_size;
+             example_idx++) {
+          const NNType *output = outputs.Row(example_idx).data();
+          const unsigned int result_idx =
+              std::max_element(output, output + outputs.width) - output;
+          unsigned int gt_result_idx;
+          if (test_data.has_labels()) {
+            gt_result_idx = test_data.Label(start_idx + example_idx);
+          } else {
+            NNType *ground_truth = ground_truths.Row(example_idx).data();
+            test_data.GetGroundTruth(start_idx + example_idx, ground_truth);
+            gt_result_idx = std::max_element(ground_truth,
+                                             ground_truth + ground_truths.width) -
+                            ground_truth;
+          }
+          if (result_idx == gt_result_idx) {
+            workspace.n_correct++;
+          }
+        }
+      },
+      thread_pool);
+  unsigned int n_correct = 0;
+  for (const auto &workspace : workspaces_) {
+    n_correct += workspace.n_correct;
+  }
+  return n_correct;
+}
+
+template <typename Chunk>
+void Network::ForEachChunk_(unsigned int n_examples, Chunk &&chunk,
+                            ThreadPool &thread_pool) {
+  // Every thread takes chunks from a shared atomic cursor, so uneven
+  // progress balances out
+  ReserveWorkspaces_(thread_pool.size(), kInferenceBatchSize);
+  const unsigned int chunk_size = workspaces_.front().max_batch_size;
+  const unsigned int n_chunks = (n_examples + chunk_size - 1) / chunk_size;
+  std::atomic<unsigned int> next_chunk_idx{0};
+  thread_pool.ParallelFor(thread_pool.size(), [&](unsigned int thread_idx) {
+    while (true) {
+      const unsigned int chunk_idx =
+          next_chunk_idx.fetch_add(1, std::memory_order_relaxed);
+      if (chunk_idx >= n_chunks) {
+        return;
+      }
+      const unsigned int start_idx = chunk_idx * chunk_size;
+      const unsigned int end_idx = std::min(start_idx + chunk_size, n_examples);
+      chunk(start_idx, end_idx, workspaces_[thread_idx]);
+    }
+  });
 }
 
-} // namespace nn
+} // namespace nn
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "optimizer.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+
+#include "kernels.hpp"
+
+namespace nn {
+
+namespace {
+
+/**
+ * @brief      Whether two lists of state buffers have the same shapes
+ */
+bool SameShapes(const std::vector<Matrix<NNType>> &matrices1,
+                const std::vector<Matrix<NNType>> &matrices2) {
+  if (matrices1.size() != matrices2.size()) {
+    return false;
+  }
+  for (std::size_t idx = 0; idx < matrices1.size(); idx++) {
+    if (matrices1[idx].height != matrices2[idx].height ||
+        matrices1[idx].width != matrices2[idx].width) {
+      return false;
+    }
+  }
+  return true;
+}
+bool SameShapes(const std::vector<Vector<NNType>> &vectors1,
+                const std::vector<Vector<NNType>> &vectors2) {
+  if (vectors1.size() != vectors2.size()) {
+    return false;
+  }
+  for (std::size_t idx = 0; idx < vectors1.size(); idx++) {
+    if (vectors1[idx].length != vectors2[idx].length) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief      Copy buffers into others of the same shapes, allocating them
+ * if they don't fit
+ */
+template <typename Buffer>
+void CopyBuffers(const std::vector<Buffer> &from, std::vector<Buffer> &to) {
+  if (!SameShapes(from, to)) {
+    to = from;
+    return;
+  }
+  for (std::size_t idx = 0; idx < from.size(); idx++) {
+    to[idx] = from[idx];
+  }
+}
+
+} // namespace
+
+unsigned int OptimizerBuffers(OptimizerType type) {
+  switch (type) {
+  case OptimizerType::kMomentum:
+  case OptimizerType::kNesterov:
+    return 1;
+  case OptimizerType::kAdam:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+Optimizer::Optimizer(const OptimizerOptions &options,
+                     const std::vector<unsigned int> &layer_sizes)
+    : options_(options) {
+  const unsigned int n_buffers = OptimizerBuffers(options.type);
+  for (unsigned int i = 1; i < layer_sizes.size(); i++) {
+    if (n_buffers >= 1) {
+      state_.weight_moments.emplace_back(layer_sizes[i], layer_sizes[i - 1]);
+      state_.bias_moments.emplace_back(layer_sizes[i]);
+    }
+    if (n_buffers >= 2) {
+      state_.weight_second_moments.emplace_back(layer_sizes[i],
+                                                layer_sizes[i - 1]);
+      state_.bias_second_moments.emplace_back(layer_sizes[i]);
+    }
+  }
+}
+
+void Optimizer::Update(unsigned int layer_idx, std::uint64_t step, NNType eta,
+                       unsigned int batch_size, const Matrix<NNType> &nabla_w,
+                       const Vector<NNType> &nabla_b, Matrix<NNType> &weights,
+                       Vector<NNType> &biases) {
+  assert(weights.size() == nabla_w.size());
+  assert(biases.length == nabla_b.length);
+  switch (options_.type) {
+  case OptimizerType::kMomentum:
+  case OptimizerType::kNesterov: {
+    const bool nesterov = options_.type == OptimizerType::kNesterov;
+    const NNType learning_rate = eta / batch_size;
+    kernels::MomentumUpdate(weights.size(), learning_rate, options_.momentum,
+                            nesterov, nabla_w.data(),
+                            state_.weight_moments[layer_idx].data(),
+                            weights.data());
+    kernels::MomentumUpdate(biases.length, learning_rate, options_.momentum,
+                            nesterov, nabla_b.data(),
+                            state_.bias_moments[layer_idx].data(),
+                            biases.data());
+    break;
+  }
+  case OptimizerType::kAdam: {
+    // Bias correction of the moments, which start at zero
+    const double step_size =
+        eta * std::sqrt(1 - std::pow(double(options_.beta2), double(step))) /
+        (1 - std::pow(double(options_.beta1), double(step)));
+    const NNType gradient_scale = static_cast<NNType>(1) / batch_size;
+    kernels::AdamUpdate(weights.size(), gradient_scale, options_.beta1,
+                        options_.beta2, static_cast<NNType>(step_size),
+                        options_.epsilon, nabla_w.data(),
+                        state_.weight_moments[layer_idx].data(),
+                        state_.weight_second_moments[layer_idx].data(),
+                        weights.data());
+    kernels::AdamUpdate(biases.length, gradient_scale, options_.beta1,
+                        options_.beta2, static_cast<NNType>(step_size),
+                        options_.epsilon, nabla_b.data(),
+                        state_.bias_moments[layer_idx].data(),
+                        state_.bias_second_moments[layer_idx].data(),
+                        biases.data());
+    break;
+  }
+  default:
+    AddScaled(biases, -eta / batch_size, nabla_b);
+    AddScaled(weights, -eta / batch_size, nabla_w);
+  }
+}
+
+void Optimizer::GetState(OptimizerState &state) const {
+  state.n_steps = n_steps_.load(std::memory_order_relaxed);
+  CopyBuffers(state_.weight_moments, state.weight_moments);
+  CopyBuffers(state_.bias_moments, state.bias_moments);
+  CopyBuffers(state_.weight_second_moments, state.weight_second_moments);
+  CopyBuffers(state_.bias_second_moments, state.bias_second_moments);
+}
+
+void Optimizer::SetState(const OptimizerState &state) {
+  if (!SameShapes(state.weight_moments, state_.weight_moments) ||
+      !SameShapes(state.bias_moments, state_.bias_moments) ||
+      !SameShapes(state.weight_second_moments,
+                  state_.weight_second_moments) ||
+      !SameShapes(state.bias_second_moments, state_.bias_second_moments)) {
+    throw std::runtime_error(
+        "Optimizer state doesn't match the optimizer or the network");
+  }
+  n_steps_.store(state.n_steps, std::memory_order_relaxed);
+  CopyBuffers(state.weight_moments, state_.weight_moments);
+  CopyBuffers(state.bias_moments, state_.bias_moments);
+  CopyBuffers(state.weight_second_moments, state_.weight_second_moments);
+  CopyBuffers(state.bias_second_moments, state_.bias_second_moments);
+}
+
+} // namespace nn
@@ -0,0 +1,139 @@
+#include "prefetcher.hpp"
+
+#include <cassert>
+#include <chrono>
+
+namespace nn {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+Prefetcher::Prefetcher(const Dataset &dataset, unsigned int max_batch_size,
+                       unsigned int depth, unsigned int n_producers)
+    : dataset_(dataset) {
+  assert(depth >= 1);
+  assert(n_producers >= 1);
+  for (unsigned int slot_idx = 0; slot_idx < depth; slot_idx++) {
+    slots_.push_back(Slot{Batch(dataset.input_size(), dataset.output_size(),
+                                max_batch_size)});
+  }
+  for (unsigned int producer_idx = 0; producer_idx < n_producers;
+       producer_idx++) {
+    producers_.emplace_back(&Prefetcher::ProducerLoop_, this);
+  }
+}
+
+Prefetcher::~Prefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  slot_freed_.notify_all();
+  for (auto &producer : producers_) {
+    producer.join();
+  }
+}
+
+void Prefetcher::StartEpoch(const unsigned int *indices,
+                            unsigned int n_examples, unsigned int batch_size) {
+  assert(batch_size > 0 && n_examples % batch_size == 0);
+  assert(batch_size <= slots_.front().batch.inputs.height);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(next_consumed_ == n_batches_);
+    for (const auto &slot : slots_) {
+      assert(slot.state == SlotState::kFree);
+      (void)slot;
+    }
+    indices_ = indices;
+    batch_size_ = batch_size;
+    n_batches_ = n_examples / batch_size;
+    next_produced_ = 0;
+    next_consumed_ = 0;
+  }
+  slot_freed_.notify_all();
+}
+
+const Batch *Prefetcher::Next() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (next_consumed_ >= n_batches_) {
+    return nullptr;
+  }
+  const unsigned int batch_idx = next_consumed_++;
+  auto &slot = slots_[batch_idx % slots_.size()];
+  const auto ready = [&] {
+    return slot.state == SlotState::kReady && slot.batch_idx == batch_idx;
+  };
+  if (!ready()) {
+    const auto start = Clock::now();
+    batch_ready_.wait(lock, ready);
+    stats_.n_consumer_stalls++;
+    stats_.consumer_wait_seconds += SecondsSince(start);
+  }
+  slot.state = SlotState::kInUse;
+  stats_.n_batches++;
+  return &slot.batch;
+}
+
+void Prefetcher::Release(const Batch *batch) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &slot : slots_) {
+      if (&slot.batch == batch) {
+        assert(slot.state == SlotState::kInUse);
+        slot.state = SlotState::kFree;
+      }
+    }
+  }
+  slot_freed_.notify_all();
+}
+
+PrefetchStats Prefetcher::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void Prefetcher::ProducerLoop_() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // Batch i goes in slot i % depth, once batch i - depth has been released
+    const auto can_produce = [this] {
+      return stopping_ ||
+             (next_produced_ < n_batches_ &&
+              slots_[next_produced_ % slots_.size()].state == SlotState::kFree);
+    };
+    if (!can_produce()) {
+      // Only count waits in the middle of an epoch as stalls
+      const bool mid_epoch = next_produced_ < n_batches_;
+      const auto start = Clock::now();
+      slot_freed_.wait(lock, can_produce);
+      if (mid_epoch) {
+        stats_.n_producer_stalls++;
+        stats_.producer_wait_seconds += SecondsSince(start);
+      }
+    }
+    if (stopping_) {
+      return;
+    }
+    const unsigned int batch_idx = next_produced_++;
+    auto &slot = slots_[batch_idx % slots_.size()];
+    slot.state = SlotState::kFilling;
+    slot.batch_idx = batch_idx;
+    const MiniBatch mini_batch(dataset_, indices_ + batch_idx * batch_size_,
+                               batch_size_);
+    lock.unlock();
+    slot.batch.Assemble(mini_batch);
+    lock.lock();
+    slot.state = SlotState::kReady;
+    batch_ready_.notify_all();
+  }
+}
+
+} // namespace nn
@@ -0,0 +1,185 @@
+#include "quantized_model.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#include "network.hpp"
+
+namespace nn {
+
+namespace {
+
+static_assert(std::is_same_v<NNType, float>,
+              "QuantizedModel runs on the single precision kernels");
+
+// Largest quantised input (see kernels::Int8Gemv)
+constexpr NNType kMaxQuantizedInput = 127.f;
+// Largest magnitude of a quantised weight, kept symmetric around zero
+constexpr NNType kMaxQuantizedWeight = 127.f;
+
+std::size_t RoundUpToLine(std::size_t n_bytes) {
+  return (n_bytes + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+/**
+ * @brief      Byte offsets of the buffers in a scratch slot, for layers of
+ * at most max_width inputs or outputs: activations (floats), then quantised
+ * inputs (bytes), then sums (int32)
+ */
+struct SlotLayout {
+  explicit SlotLayout(const std::vector<unsigned int> &layer_sizes) {
+    const std::size_t max_width =
+        *std::max_element(layer_sizes.begin(), layer_sizes.end());
+    quantized_offset = RoundUpToLine(max_width * sizeof(NNType));
+    sums_offset = quantized_offset + RoundUpToLine(max_width);
+    size = sums_offset + RoundUpToLine(max_width * sizeof(std::int32_t));
+  }
+  std::size_t quantized_offset;
+  std::size_t sums_offset;
+  std::size_t size;
+};
+
+} // namespace
+
+QuantizedModel::QuantizedModel(const Network &network,
+                               const Dataset &calibration_data,
+                               unsigned int n_calibration,
+                               unsigned int n_slots)
+    : quantized_offset_(SlotLayout(network.layer_sizes_).quantized_offset),
+      sums_offset_(SlotLayout(network.layer_sizes_).sums_offset),
+      slots_(n_slots, SlotLayout(network.layer_sizes_).size) {
+  assert(calibration_data.input_size() == network.layer_sizes_.front());
+  const unsigned int n_layers = network.num_layers_ - 1;
+  if (n_calibration == 0 || n_calibration > calibration_data.size()) {
+    n_calibration = calibration_data.size();
+  }
+
+  // Calibration: feed the sample forward in floats, recording the range of
+  // every layer's inputs. The range always includes 0, which is then exactly
+  // representable.
+  std::vector<NNType> input_min(n_layers, 0.f);
+  std::vector<NNType> input_max(n_layers, 0.f);
+  std::vector<std::vector<NNType>> activations(network.num_layers_);
+  for (unsigned int layer_idx = 0; layer_idx < network.num_layers_;
+       layer_idx++) {
+    activations[layer_idx].resize(network.layer_sizes_[layer_idx]);
+  }
+  for (unsigned int example_idx = 0; example_idx < n_calibration;
+       example_idx++) {
+    calibration_data.GetInput(example_idx, activations.front().data());
+    for (unsigned int layer_idx = 0; layer_idx < n_layers; layer_idx++) {
+      const auto &inputs = activations[layer_idx];
+      const auto range = std::minmax_element(inputs.begin(), inputs.end());
+      input_min[layer_idx] = std::min(input_min[layer_idx], *range.first);
+      input_max[layer_idx] = std::max(input_max[layer_idx], *range.second);
+      const auto &weights = network.weights_[layer_idx];
+      auto &outputs = activations[layer_idx + 1];
+      kernels::Sgemv(false, weights.height, weights.width, 1.f,
+                     weights.data(), weights.stride, inputs.data(), 0.f,
+                     outputs.data());
+      kernels::BiasActivation(network.LayerActivation_(layer_idx), 1,
+                              outputs.size(),
+                              network.biases_[layer_idx].data(),
+                              outputs.data(), outputs.size());
+    }
+  }
+
+  // Quantise the weights, one scale per row
+  std::size_t n_weight_bytes = 0;
+  for (unsigned int layer_idx = 0; layer_idx < n_layers; layer_idx++) {
+    const unsigned int n_inputs = network.layer_sizes_[layer_idx];
+    const unsigned int n_outputs = network.layer_sizes_[layer_idx + 1];
+    // int32 sums can't overflow
+    assert(n_inputs <= std::numeric_limits<std::int32_t>::max() /
+                           (kMaxQuantizedInput * kMaxQuantizedWeight));
+    const unsigned int stride = RoundUpToLine(n_inputs);
+    layers_.push_back(Layer{n_inputs, n_outputs, stride, n_weight_bytes, 0.f,
+                            0.f, Vector<NNType>(n_outputs),
+                            Vector<NNType>(n_outputs),
+                            network.LayerActivation_(layer_idx)});
+    n_weight_bytes += static_cast<std::size_t>(n_outputs) * stride;
+  }
+  weights_ = AllocateAligned<std::int8_t>(n_weight_bytes);
+  std::fill(weights_.get(), weights_.get() + n_weight_bytes, 0);
+  for (unsigned int layer_idx = 0; layer_idx < n_layers; layer_idx++) {
+    auto &layer = layers_[layer_idx];
+    NNType input_scale = (input_max[layer_idx] - input_min[layer_idx]) /
+                         kMaxQuantizedInput;
+    if (input_scale == 0.f) {
+      input_scale = 1.f;
+    }
+    layer.inverse_input_scale = 1.f / input_scale;
+    layer.zero_point = std::round(-input_min[layer_idx] / input_scale);
+    const auto &weights = network.weights_[layer_idx];
+    const auto &biases = network.biases_[layer_idx];
+    for (unsigned int row_idx = 0; row_idx < layer.n_outputs; row_idx++) {
+      const auto row = weights.Row(row_idx);
+      NNType max_magnitude = 0.f;
+      for (unsigned int col_idx = 0; col_idx < layer.n_inputs; col_idx++) {
+        max_magnitude = std::max(max_magnitude, std::abs(row[col_idx]));
+      }
+      const NNType row_scale =
+          max_magnitude > 0.f ? max_magnitude / kMaxQuantizedWeight : 1.f;
+      std::int8_t *quantized_row = weights_.get() + layer.weights_offset +
+                                   static_cast<std::size_t>(row_idx) *
+                                       layer.stride;
+      std::int32_t row_sum = 0;
+      for (unsigned int col_idx = 0; col_idx < layer.n_inputs; col_idx++) {
+        quantized_row[col_idx] =
+            static_cast<std::int8_t>(std::round(row[col_idx] / row_scale));
+        row_sum += quantized_row[col_idx];
+      }
+      // x = input_scale * (q - zero_point), so every sum over q is too
+      // large by zero_point * row_sum
+      layer.output_scales[row_idx] = input_scale * row_scale;
+      layer.biases[row_idx] = biases[row_idx] - layer.output_scales[row_idx] *
+                                                    layer.zero_point *
+                                                    row_sum;
+    }
+  }
+}
+
+void QuantizedModel::Predict(const NNType *input, NNType *output) const {
+  const unsigned int slot_idx = slots_.Acquire();
+  auto *slot = static_cast<unsigned char *>(slots_.data(slot_idx));
+  auto *activations = reinterpret_cast<NNType *>(slot);
+  auto *quantized = reinterpret_cast<std::uint8_t *>(slot + quantized_offset_);
+  auto *sums = reinterpret_cast<std::int32_t *>(slot + sums_offset_);
+  const NNType *layer_input = input;
+  for (unsigned int layer_idx = 0; layer_idx < layers_.size(); layer_idx++) {
+    const auto &layer = layers_[layer_idx];
+    // Adding 0.5 before rounding down rounds to nearest
+    kernels::QuantizeInputs(layer.n_inputs, layer_input,
+                            layer.inverse_input_scale, layer.zero_point + 0.5f,
+                            quantized);
+    kernels::Int8Gemv(layer.n_outputs, layer.n_inputs,
+                      weights_.get() + layer.weights_offset, layer.stride,
+                      quantized, sums);
+    // The last layer writes straight to the output
+    NNType *layer_output =
+        layer_idx + 1 == layers_.size() ? output : activations;
+    for (unsigned int output_idx = 0; output_idx < layer.n_outputs;
+         output_idx++) {
+      layer_output[output_idx] =
+          layer.output_scales[output_idx] * static_cast<NNType>(sums[output_idx]);
+    }
+    kernels::BiasActivation(layer.activation, 1, layer.n_outputs,
+                            layer.biases.data(), layer_output, layer.n_outputs);
+    layer_input = layer_output;
+  }
+  slots_.Release(slot_idx);
+}
+
+std::size_t QuantizedModel::parameter_bytes() const {
+  std::size_t n_bytes = 0;
+  for (const auto &layer : layers_) {
+    n_bytes += static_cast<std::size_t>(layer.n_outputs) * layer.n_inputs +
+               2 * sizeof(NNType) * layer.n_outputs;
+  }
+  return n_bytes;
+}
+
+} // namespace nn
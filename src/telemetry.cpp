@@ -0,0 +1,25 @@
+#include "telemetry.hpp"
+
+#include <iostream>
+#include <utility>
+
+namespace nn {
+
+namespace {
+
+std::function<void(const std::string &)> log_sink =
+    [](const std::string &message) { std::cout << message << std::endl; };
+
+} // namespace
+
+void SetLogSink(std::function<void(const std::string &)> sink) {
+  log_sink = std::move(sink);
+}
+
+void Log(const std::string &message) {
+  if (log_sink) {
+    log_sink(message);
+  }
+}
+
+} // namespace nn
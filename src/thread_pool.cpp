@@ -0,0 +1,86 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+#include "kernels.hpp"
+
+namespace nn {
+
+ThreadPool::ThreadPool(unsigned int n_threads) {
+  if (n_threads == 0) {
+    n_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  kernels::ReserveScratch();
+  for (unsigned int worker_idx = 1; worker_idx < n_threads; worker_idx++) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop_, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Run_(unsigned int n_tasks, Invoke invoke, void *context) {
+  if (workers_.empty() || n_tasks <= 1) {
+    for (unsigned int task_idx = 0; task_idx < n_tasks; task_idx++) {
+      invoke(context, task_idx);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    invoke_ = invoke;
+    context_ = context;
+    n_tasks_ = n_tasks;
+    next_task_.store(0, std::memory_order_relaxed);
+    n_busy_workers_ = workers_.size();
+    generation_++;
+  }
+  work_available_.notify_all();
+  RunTasks_();
+  std::unique_lock<std::mutex> lock(mutex_);
+  work_done_.wait(lock, [this] { return n_busy_workers_ == 0; });
+}
+
+void ThreadPool::RunTasks_() {
+  while (true) {
+    const unsigned int task_idx =
+        next_task_.fetch_add(1, std::memory_order_relaxed);
+    if (task_idx >= n_tasks_) {
+      return;
+    }
+    invoke_(context_, task_idx);
+  }
+}
+
+void ThreadPool::WorkerLoop_() {
+  kernels::ReserveScratch();
+  std::uint64_t seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_available_.wait(lock, [&] {
+        return stopping_ || generation_ != seen_generation;
+      });
+      if (stopping_) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+    RunTasks_();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      n_busy_workers_--;
+    }
+    work_done_.notify_one();
+  }
+}
+
+} // namespace nn
@@ -0,0 +1,395 @@
+#include "transport.hpp"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+namespace nn {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Most bytes copied into or out of a ring buffer at a time, so that the peer
+// can start on the first bytes while the next ones are copied
+constexpr std::size_t kMaxCopyBytes = std::size_t{64} << 10;
+// Number of times a rank polls its ring buffers without progress before it
+// yields its core
+constexpr unsigned int kSpinIterations = 1000;
+// Interval between attempts to reach a rank that isn't ready yet
+constexpr auto kRetryInterval = std::chrono::milliseconds(10);
+
+/**
+ * @brief      Start of a shared memory segment, before the channels and
+ * their ring buffers
+ */
+struct SegmentHeader {
+  alignas(64) std::atomic<std::uint32_t> n_attached;
+};
+
+[[noreturn]] void ThrowSystemError(const std::string &message) {
+  throw std::runtime_error(message + ": " + std::strerror(errno));
+}
+
+void CopyToRing(std::uint8_t *ring, std::size_t capacity,
+                std::uint64_t position, const std::uint8_t *data,
+                std::size_t n_bytes) {
+  const std::size_t offset = position % capacity;
+  const std::size_t n_first = std::min(n_bytes, capacity - offset);
+  std::memcpy(ring + offset, data, n_first);
+  std::memcpy(ring, data + n_first, n_bytes - n_first);
+}
+
+void CopyFromRing(const std::uint8_t *ring, std::size_t capacity,
+                  std::uint64_t position, std::uint8_t *data,
+                  std::size_t n_bytes) {
+  const std::size_t offset = position % capacity;
+  const std::size_t n_first = std::min(n_bytes, capacity - offset);
+  std::memcpy(data, ring + offset, n_first);
+  std::memcpy(data + n_first, ring, n_bytes - n_first);
+}
+
+/**
+ * @brief      Wait until a condition holds, yielding between checks. Throws
+ * std::runtime_error with the message if it doesn't by the deadline.
+ */
+template <typename Condition>
+void WaitUntil(Condition &&condition, Clock::time_point deadline,
+               const std::string &message) {
+  while (!condition()) {
+    if (Clock::now() > deadline) {
+      throw std::runtime_error(message);
+    }
+    std::this_thread::yield();
+  }
+}
+
+sockaddr_un SocketAddress(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Socket path " + path + " is too long");
+  }
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return address;
+}
+
+void CloseSocket(int &fd) {
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+/**
+ * @brief      Blocking send or receive of a whole buffer, for the handshake
+ */
+void SendAll(int fd, const void *data, std::size_t n_bytes) {
+  const auto *bytes = static_cast<const std::uint8_t *>(data);
+  while (n_bytes > 0) {
+    const ssize_t n_sent = send(fd, bytes, n_bytes, MSG_NOSIGNAL);
+    if (n_sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowSystemError("Can't send to the next rank");
+    }
+    bytes += n_sent;
+    n_bytes -= n_sent;
+  }
+}
+void ReceiveAll(int fd, void *data, std::size_t n_bytes) {
+  auto *bytes = static_cast<std::uint8_t *>(data);
+  while (n_bytes > 0) {
+    const ssize_t n_received = recv(fd, bytes, n_bytes, 0);
+    if (n_received == 0) {
+      throw std::runtime_error("The previous rank closed its socket");
+    }
+    if (n_received < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowSystemError("Can't receive from the previous rank");
+    }
+    bytes += n_received;
+    n_bytes -= n_received;
+  }
+}
+
+} // namespace
+
+SharedMemoryTransport::SharedMemoryTransport(const std::string &name,
+                                             unsigned int rank,
+                                             unsigned int size,
+                                             std::size_t buffer_bytes,
+                                             std::chrono::milliseconds timeout)
+    : rank_(rank), size_(size), buffer_bytes_(buffer_bytes),
+      timeout_(timeout), mapping_(MAP_FAILED),
+      mapping_bytes_(sizeof(SegmentHeader) +
+                     size * (sizeof(Channel) + buffer_bytes)) {
+  assert(rank < size);
+  assert(buffer_bytes > 0);
+  const auto deadline = Clock::now() + timeout;
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    ThrowSystemError("Can't open shared memory " + name);
+  }
+  // Every rank sets the same size. The segment is zero-filled, which is the
+  // initial value of the counters.
+  if (ftruncate(fd, mapping_bytes_) != 0) {
+    close(fd);
+    ThrowSystemError("Can't size shared memory " + name);
+  }
+  mapping_ = mmap(nullptr, mapping_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+  close(fd);
+  if (mapping_ == MAP_FAILED) {
+    ThrowSystemError("Can't map shared memory " + name);
+  }
+  auto &header = *static_cast<SegmentHeader *>(mapping_);
+  // The last rank to attach removes the name, which the mappings outlive
+  if (header.n_attached.fetch_add(1, std::memory_order_acq_rel) + 1 == size) {
+    shm_unlink(name.c_str());
+  }
+  try {
+    WaitUntil(
+        [&] {
+          return header.n_attached.load(std::memory_order_acquire) >= size;
+        },
+        deadline, "Timed out waiting for the ranks of " + name);
+  } catch (...) {
+    munmap(mapping_, mapping_bytes_);
+    throw;
+  }
+}
+
+SharedMemoryTransport::~SharedMemoryTransport() {
+  munmap(mapping_, mapping_bytes_);
+}
+
+void SharedMemoryTransport::Exchange(const void *send,
+                                     std::size_t send_bytes, void *receive,
+                                     std::size_t receive_bytes) {
+  // Channel r goes from rank r to the next one
+  Channel &out = Channel_(rank_);
+  std::uint8_t *out_buffer = Buffer_(rank_);
+  const unsigned int previous_rank = (rank_ + size_ - 1) % size_;
+  Channel &in = Channel_(previous_rank);
+  const std::uint8_t *in_buffer = Buffer_(previous_rank);
+  const auto *send_data = static_cast<const std::uint8_t *>(send);
+  auto *receive_data = static_cast<std::uint8_t *>(receive);
+  std::size_t n_sent = 0, n_received = 0;
+  unsigned int n_idle = 0;
+  // Set when this rank starts yielding, and reset by any progress
+  Clock::time_point deadline;
+  while (n_sent < send_bytes || n_received < receive_bytes) {
+    bool progress = false;
+    if (n_sent < send_bytes) {
+      // Acquiring the read count orders the peer's reads of the bytes before
+      // they are overwritten
+      const std::uint64_t n_written =
+          out.n_written.load(std::memory_order_relaxed);
+      const std::uint64_t n_free =
+          buffer_bytes_ -
+          (n_written - out.n_read.load(std::memory_order_acquire));
+      const std::size_t count = std::min<std::uint64_t>(
+          {n_free, send_bytes - n_sent, kMaxCopyBytes});
+      if (count > 0) {
+        CopyToRing(out_buffer, buffer_bytes_, n_written, send_data + n_sent,
+                   count);
+        out.n_written.store(n_written + count, std::memory_order_release);
+        n_sent += count;
+        progress = true;
+      }
+    }
+    if (n_received < receive_bytes) {
+      const std::uint64_t n_read = in.n_read.load(std::memory_order_relaxed);
+      const std::uint64_t n_available =
+          in.n_written.load(std::memory_order_acquire) - n_read;
+      const std::size_t count = std::min<std::uint64_t>(
+          {n_available, receive_bytes - n_received, kMaxCopyBytes});
+      if (count > 0) {
+        CopyFromRing(in_buffer, buffer_bytes_, n_read,
+                     receive_data + n_received, count);
+        in.n_read.store(n_read + count, std::memory_order_release);
+        n_received += count;
+        progress = true;
+      }
+    }
+    if (progress) {
+      n_idle = 0;
+    } else if (++n_idle > kSpinIterations) {
+      if (n_idle == kSpinIterations + 1) {
+        deadline = Clock::now() + timeout_;
+      } else if (Clock::now() > deadline) {
+        throw std::runtime_error(
+            "Timed out exchanging with rank " +
+            std::to_string(n_received < receive_bytes ? previous_rank
+                                                      : (rank_ + 1) % size_) +
+            ", which may have exited");
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+SharedMemoryTransport::Channel &
+SharedMemoryTransport::Channel_(unsigned int channel_idx) const {
+  auto *channels = reinterpret_cast<Channel *>(
+      static_cast<std::uint8_t *>(mapping_) + sizeof(SegmentHeader));
+  return channels[channel_idx];
+}
+
+std::uint8_t *SharedMemoryTransport::Buffer_(unsigned int channel_idx) const {
+  return static_cast<std::uint8_t *>(mapping_) + sizeof(SegmentHeader) +
+         size_ * sizeof(Channel) + channel_idx * buffer_bytes_;
+}
+
+SocketTransport::SocketTransport(const std::string &path_prefix,
+                                 unsigned int rank, unsigned int size,
+                                 std::chrono::milliseconds timeout)
+    : rank_(rank), size_(size) {
+  assert(rank < size);
+  const auto deadline = Clock::now() + timeout;
+  const std::string path = path_prefix + std::to_string(rank);
+  const sockaddr_un address = SocketAddress(path);
+  const sockaddr_un next_address =
+      SocketAddress(path_prefix + std::to_string((rank + 1) % size));
+  int listen_fd = -1;
+  try {
+    // Listen first, so that the previous rank can connect while this one
+    // connects to the next
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+      ThrowSystemError("Can't create a socket");
+    }
+    unlink(path.c_str());
+    if (bind(listen_fd, reinterpret_cast<const sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+        listen(listen_fd, 1) != 0) {
+      ThrowSystemError("Can't listen on " + path);
+    }
+    // The next rank may not be listening yet
+    while (true) {
+      next_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (next_fd_ < 0) {
+        ThrowSystemError("Can't create a socket");
+      }
+      if (connect(next_fd_, reinterpret_cast<const sockaddr *>(&next_address),
+                  sizeof(next_address)) == 0) {
+        break;
+      }
+      if (errno != ENOENT && errno != ECONNREFUSED) {
+        ThrowSystemError("Can't connect to " +
+                         std::string(next_address.sun_path));
+      }
+      CloseSocket(next_fd_);
+      if (Clock::now() > deadline) {
+        throw std::runtime_error("Timed out connecting to " +
+                                 std::string(next_address.sun_path));
+      }
+      std::this_thread::sleep_for(kRetryInterval);
+    }
+    const std::uint32_t rank_id = rank;
+    SendAll(next_fd_, &rank_id, sizeof(rank_id));
+    pollfd listen_poll{listen_fd, POLLIN, 0};
+    const auto remaining =
+        std::chrono::duration_cast<std::chrono::milliseconds>(deadline -
+                                                              Clock::now());
+    if (poll(&listen_poll, 1, std::max<long>(remaining.count(), 0)) <= 0) {
+      throw std::runtime_error("Timed out waiting for the previous rank on " +
+                               path);
+    }
+    previous_fd_ = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (previous_fd_ < 0) {
+      ThrowSystemError("Can't accept on " + path);
+    }
+    // A connection from outside the ring would break it silently
+    std::uint32_t previous_rank_id;
+    ReceiveAll(previous_fd_, &previous_rank_id, sizeof(previous_rank_id));
+    if (previous_rank_id != (rank + size - 1) % size) {
+      throw std::runtime_error("Unexpected connection on " + path);
+    }
+  } catch (...) {
+    CloseSocket(listen_fd);
+    CloseSocket(next_fd_);
+    CloseSocket(previous_fd_);
+    unlink(path.c_str());
+    throw;
+  }
+  CloseSocket(listen_fd);
+  unlink(path.c_str());
+}
+
+SocketTransport::~SocketTransport() {
+  CloseSocket(next_fd_);
+  CloseSocket(previous_fd_);
+}
+
+void SocketTransport::Exchange(const void *send, std::size_t send_bytes,
+                               void *receive,
+                               std::size_t receive_bytes) {
+  const auto *send_data = static_cast<const std::uint8_t *>(send);
+  auto *receive_data = static_cast<std::uint8_t *>(receive);
+  std::size_t n_sent = 0, n_received = 0;
+  while (n_sent < send_bytes || n_received < receive_bytes) {
+    pollfd polls[2];
+    nfds_t n_polls = 0;
+    if (n_sent < send_bytes) {
+      polls[n_polls++] = {next_fd_, POLLOUT, 0};
+    }
+    if (n_received < receive_bytes) {
+      polls[n_polls++] = {previous_fd_, POLLIN, 0};
+    }
+    if (poll(polls, n_polls, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowSystemError("Can't poll the sockets of the ring");
+    }
+    // Non-blocking transfers of whatever the sockets are ready for. Errors
+    // and hang-ups are reported by the calls themselves.
+    for (nfds_t poll_idx = 0; poll_idx < n_polls; poll_idx++) {
+      if (polls[poll_idx].revents == 0) {
+        continue;
+      }
+      if (polls[poll_idx].fd == next_fd_) {
+        const ssize_t count = ::send(next_fd_, send_data + n_sent,
+                                     send_bytes - n_sent,
+                                     MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (count < 0) {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            continue;
+          }
+          ThrowSystemError("Can't send to the next rank");
+        }
+        n_sent += count;
+      } else {
+        const ssize_t count = recv(previous_fd_, receive_data + n_received,
+                                   receive_bytes - n_received, MSG_DONTWAIT);
+        if (count == 0) {
+          throw std::runtime_error("The previous rank closed its socket");
+        }
+        if (count < 0) {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            continue;
+          }
+          ThrowSystemError("Can't receive from the previous rank");
+        }
+        n_received += count;
+      }
+    }
+  }
+}
+
+} // namespace nn
@@ -0,0 +1,75 @@
+#include "allocation_counter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<std::size_t> bytes_allocated{0};
+std::atomic<std::size_t> allocation_count{0};
+
+void *Allocate(std::size_t size) {
+  bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (void *pointer = std::malloc(size > 0 ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void *AllocateAligned(std::size_t size, std::align_val_t alignment) {
+  bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  const auto align = static_cast<std::size_t>(alignment);
+  // aligned_alloc needs a multiple of the alignment
+  const std::size_t rounded_size =
+      std::max((size + align - 1) / align * align, align);
+  if (void *pointer = std::aligned_alloc(align, rounded_size)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+} // namespace
+
+std::size_t BytesAllocated() { return bytes_allocated.load(); }
+
+std::size_t AllocationCount() { return allocation_count.load(); }
+
+#define NN_NOINLINE __attribute__((noinline))
+
+NN_NOINLINE void *operator new(std::size_t size) { return Allocate(size); }
+NN_NOINLINE void *operator new[](std::size_t size) { return Allocate(size); }
+NN_NOINLINE void *operator new(std::size_t size, std::align_val_t alignment) {
+  return AllocateAligned(size, alignment);
+}
+NN_NOINLINE void *operator new[](std::size_t size,
+                                 std::align_val_t alignment) {
+  return AllocateAligned(size, alignment);
+}
+NN_NOINLINE void operator delete(void *pointer) noexcept { std::free(pointer); }
+NN_NOINLINE void operator delete[](void *pointer) noexcept {
+  std::free(pointer);
+}
+NN_NOINLINE void operator delete(void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+NN_NOINLINE void operator delete[](void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+NN_NOINLINE void operator delete(void *pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+NN_NOINLINE void operator delete[](void *pointer, std::align_val_t) noexcept {
+  std::free(pointer);
+}
+NN_NOINLINE void operator delete(void *pointer, std::size_t,
+                                 std::align_val_t) noexcept {
+  std::free(pointer);
+}
+NN_NOINLINE void operator delete[](void *pointer, std::size_t,
+                                   std::align_val_t) noexcept {
+  std::free(pointer);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+
+// Linking allocation_counter.cpp into a program replaces the global operator
+// new and delete, so that every allocation made through them, which includes
+// the buffers of matrices and vectors, is counted. The replacements are in
+// their own translation unit and never inlined, so the compiler doesn't pair
+// the new expressions of a program with the free calls of the replacements.
+
+/**
+ * @brief      Total bytes requested from operator new since the start
+ */
+std::size_t BytesAllocated();
+
+/**
+ * @brief      Number of calls to operator new since the start
+ */
+std::size_t AllocationCount();
@@ -0,0 +1,112 @@
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "allocation_counter.hpp"
+#include "network.hpp"
+
+// Training allocates its buffers when a job starts, and nothing after that:
+// a job of several epochs must make exactly as many allocations as a job of
+// one, in every training mode.
+
+namespace {
+
+/**
+ * @brief      Generate examples whose class is the index of the largest of
+ * the first n_classes inputs, with only a fraction of the inputs non-zero
+ */
+nn::AnnotatedData GenerateAnnotatedData(unsigned int n_examples,
+                                        unsigned int n_inputs,
+                                        unsigned int n_classes,
+                                        double density) {
+  std::default_random_engine generator(0);
+  std::uniform_real_distribution<nn::NNType> distribution(0.f, 1.f);
+  nn::AnnotatedData examples;
+  for (unsigned int example_idx = 0; example_idx < n_examples; example_idx++) {
+    nn::Vector<nn::NNType> input(n_inputs);
+    for (auto &value : input) {
+      value = distribution(generator) < density ? distribution(generator) : 0;
+    }
+    unsigned int label = 0;
+    for (unsigned int class_idx = 1; class_idx < n_classes; class_idx++) {
+      if (input[class_idx] > input[label]) {
+        label = class_idx;
+      }
+    }
+    examples.emplace_back(input, nn::IndexToOneHot(label, n_classes));
+  }
+  return examples;
+}
+
+struct Job {
+  std::string name;
+  const nn::AnnotatedData &training_data;
+  // Evaluated after every epoch, if not null
+  const nn::AnnotatedData *test_data;
+  nn::TrainingOptions options;
+};
+
+/**
+ * @brief      The number of allocations of a training job on a new network
+ */
+std::size_t CountJobAllocations(const Job &job, unsigned int epochs) {
+  nn::SigmoidNetwork network({job.training_data.front().first.length, 16,
+                              job.training_data.front().second.length});
+  std::optional<std::reference_wrapper<const nn::AnnotatedData>> test_data;
+  if (job.test_data) {
+    test_data = *job.test_data;
+  }
+  const std::size_t count_before = AllocationCount();
+  network.Sgd(job.training_data, epochs, 10, 1.f, test_data, job.options);
+  return AllocationCount() - count_before;
+}
+
+} // namespace
+
+int main() {
+  nn::SetLogSink({});
+  const auto dense_data = GenerateAnnotatedData(400, 32, 4, 1.);
+  const auto sparse_data = GenerateAnnotatedData(400, 400, 4, 0.02);
+  const auto test_data = GenerateAnnotatedData(300, 32, 4, 1.);
+  std::vector<Job> jobs;
+  nn::TrainingOptions options;
+  options.seed = 0;
+  // Reporting progress without allocating
+  options.on_epoch = [](const nn::EpochReport &) {};
+  jobs.push_back({"1 thread", dense_data, nullptr, options});
+  options.n_threads = 4;
+  jobs.push_back({"4 threads", dense_data, nullptr, options});
+  options.hogwild = true;
+  jobs.push_back({"Hogwild", dense_data, nullptr, options});
+  options.hogwild = false;
+  options.prefetch_depth = 0;
+  jobs.push_back(
+      {"4 threads without prefetching", dense_data, nullptr, options});
+  options.n_threads = 1;
+  options.prefetch_depth = 2;
+  options.optimizer.type = nn::OptimizerType::kAdam;
+  jobs.push_back({"Adam", dense_data, nullptr, options});
+  options.optimizer.type = nn::OptimizerType::kSgd;
+  jobs.push_back({"sparse inputs", sparse_data, nullptr, options});
+  jobs.push_back({"test data", dense_data, &test_data, options});
+  options.n_threads = 4;
+  jobs.push_back({"test data on 4 threads", dense_data, &test_data, options});
+
+  // One-off allocations, such as of static state, are made by a first job
+  CountJobAllocations(jobs.front(), 1);
+
+  bool passed = true;
+  for (const auto &job : jobs) {
+    const std::size_t one_epoch = CountJobAllocations(job, 1);
+    const std::size_t four_epochs = CountJobAllocations(job, 4);
+    const bool job_passed = one_epoch == four_epochs;
+    std::cout << (job_passed ? "PASS " : "FAIL ") << job.name << ": "
+              << one_epoch << " allocations for 1 epoch, " << four_epochs
+              << " for 4" << std::endl;
+    passed &= job_passed;
+  }
+  return passed ? 0 : 1;
+}
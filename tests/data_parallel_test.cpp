@@ -0,0 +1,164 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "model_file.hpp"
+#include "network.hpp"
+#include "transport.hpp"
+
+// Data parallel training with several worker processes, each taking a share
+// of every mini-batch, against training in one process on the whole
+// mini-batch. Run with the number of processes and the transport, 'shm' or
+// 'socket'. The two must end with the same weights and biases, up to the
+// rounding of the gradients, which are summed in a different order.
+
+namespace {
+
+// Largest difference allowed between a parameter of the two networks
+constexpr double kTolerance = 1e-5;
+
+/**
+ * @brief      Generate examples of a classification problem: the class of
+ * an input is the index of its largest element among the first n_classes
+ *
+ * @param[in]  n_examples  The number of examples
+ * @param[in]  n_inputs    The input size
+ * @param[in]  n_classes   The number of classes, at most n_inputs
+ *
+ * @return     The examples
+ */
+nn::AnnotatedData GenerateAnnotatedData(unsigned int n_examples,
+                                        unsigned int n_inputs,
+                                        unsigned int n_classes) {
+  std::default_random_engine generator(1);
+  std::uniform_real_distribution<nn::NNType> distribution(0.f, 1.f);
+  nn::AnnotatedData examples;
+  for (unsigned int example_idx = 0; example_idx < n_examples; example_idx++) {
+    nn::Vector<nn::NNType> input(n_inputs);
+    for (auto &value : input) {
+      value = distribution(generator);
+    }
+    const unsigned int label =
+        std::max_element(input.begin(), input.begin() + n_classes) -
+        input.begin();
+    examples.emplace_back(input, nn::IndexToOneHot(label, n_classes));
+  }
+  return examples;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc != 3 || std::stoul(argv[1]) == 0 ||
+      (std::string(argv[2]) != "shm" && std::string(argv[2]) != "socket")) {
+    std::cerr << "Expected a number of processes and 'shm' or 'socket'"
+              << std::endl;
+    return 1;
+  }
+  const unsigned int n_processes = std::stoul(argv[1]);
+  const std::string transport_type{argv[2]};
+
+  constexpr unsigned int n_inputs = 64, n_classes = 8;
+  constexpr unsigned int epochs = 3, mini_batch_size = 10;
+  constexpr float eta = 1.f;
+  const unsigned int n_training = 1200 * n_processes;
+  const auto training_data =
+      GenerateAnnotatedData(n_training, n_inputs, n_classes);
+  const std::vector<unsigned int> layer_sizes({n_inputs, 32, n_classes});
+  // Rank 0 starts from these weights, and broadcasts them to the others
+  const std::string job = "nn-data-parallel-" + std::to_string(getpid());
+  const std::string initial_path = "/tmp/" + job + "-initial.model";
+  const std::string trained_path = "/tmp/" + job + "-trained.model";
+  nn::SigmoidNetwork network(layer_sizes);
+  network.Save(initial_path);
+  nn::TrainingOptions options;
+  options.seed = 0;
+
+  std::vector<pid_t> workers;
+  for (unsigned int rank = 0; rank < n_processes; rank++) {
+    const pid_t pid = fork();
+    if (pid != 0) {
+      workers.push_back(pid);
+      continue;
+    }
+    // Only rank 0 logs its progress
+    if (rank != 0) {
+      nn::SetLogSink({});
+    }
+    try {
+      std::unique_ptr<nn::Transport> transport;
+      if (transport_type == "shm") {
+        transport = std::make_unique<nn::SharedMemoryTransport>("/" + job,
+                                                                rank,
+                                                                n_processes);
+      } else {
+        transport = std::make_unique<nn::SocketTransport>(
+            "/tmp/" + job + "-", rank, n_processes);
+      }
+      // The other ranks' random weights are replaced by rank 0's
+      nn::SigmoidNetwork worker_network(layer_sizes);
+      if (rank == 0) {
+        worker_network.Load(initial_path);
+      }
+      auto worker_options = options;
+      worker_options.transport = transport.get();
+      worker_network.Sgd(training_data, epochs, mini_batch_size, eta,
+                         std::nullopt, worker_options);
+      if (rank == 0) {
+        worker_network.Save(trained_path);
+      }
+    } catch (const std::exception &error) {
+      std::cerr << "Rank " << rank << ": " << error.what() << std::endl;
+      _exit(1);
+    }
+    std::cout << std::flush;
+    _exit(0);
+  }
+  bool workers_succeeded = true;
+  for (const pid_t pid : workers) {
+    int status;
+    waitpid(pid, &status, 0);
+    workers_succeeded &= WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  if (!workers_succeeded) {
+    std::remove(initial_path.c_str());
+    return 1;
+  }
+
+  // The same job in this process, with the whole mini-batch of each step
+  const std::string reference_path = "/tmp/" + job + "-reference.model";
+  options.on_epoch = [](const nn::EpochReport &) {};
+  network.Sgd(training_data, epochs, n_processes * mini_batch_size, eta,
+              std::nullopt, options);
+  network.Save(reference_path);
+  std::remove(initial_path.c_str());
+
+  double max_difference = 0.;
+  {
+    const nn::ModelFile reference(reference_path);
+    const nn::ModelFile data_parallel(trained_path);
+    assert(reference.n_parameters() == data_parallel.n_parameters());
+    for (std::size_t idx = 0; idx < reference.n_parameters(); idx++) {
+      const double difference =
+          reference.parameters()[idx] - data_parallel.parameters()[idx];
+      max_difference = std::max(max_difference, std::fabs(difference));
+    }
+  }
+  std::remove(reference_path.c_str());
+  std::remove(trained_path.c_str());
+  const bool passed = max_difference <= kTolerance;
+  std::cout << (passed ? "PASS " : "FAIL ") << n_processes
+            << " processes over " << transport_type
+            << ": largest parameter difference from one process "
+            << max_difference << std::endl;
+  return passed ? 0 : 1;
+}
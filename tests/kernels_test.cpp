@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "kernels.hpp"
+
+// Accuracy of the dispatched Sgemm and Sgemv against naive double precision
+// loops, on every instruction set the CPU supports, for random shapes,
+// strides, transposes and scales. An element passes if its error is within
+// kTolerance of the sum of the magnitudes of the terms it adds up.
+
+namespace {
+
+constexpr double kTolerance = 1e-5;
+constexpr unsigned int kCases = 60;
+constexpr unsigned int kMaxSize = 96;
+
+std::default_random_engine generator(0);
+
+std::vector<float> RandomValues(std::size_t n) {
+  std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+  std::vector<float> values(n);
+  for (auto &value : values) {
+    value = distribution(generator);
+  }
+  return values;
+}
+
+unsigned int RandomSize() {
+  // Sizes around the register tiles and vector widths are more likely
+  static const unsigned int kEdgeSizes[] = {1, 2, 7, 8, 15, 16, 17, 31, 33};
+  std::uniform_int_distribution<unsigned int> coin(0, 1);
+  if (coin(generator)) {
+    std::uniform_int_distribution<unsigned int> pick(0, 8);
+    return kEdgeSizes[pick(generator)];
+  }
+  std::uniform_int_distribution<unsigned int> size(1, kMaxSize);
+  return size(generator);
+}
+
+unsigned int RandomPadding() {
+  std::uniform_int_distribution<unsigned int> padding(0, 5);
+  return padding(generator);
+}
+
+float RandomScale(bool allow_zero) {
+  static const float kScales[] = {0.f, 1.f, -0.5f, 2.25f};
+  std::uniform_int_distribution<unsigned int> pick(allow_zero ? 0 : 1, 3);
+  return kScales[pick(generator)];
+}
+
+/**
+ * @brief      Compare a result with the reference, printing the first
+ * failure
+ *
+ * @return     Whether every element is within the tolerance
+ */
+bool Check(const char *kernel, const char *case_name, const float *result,
+           const std::vector<double> &reference,
+           const std::vector<double> &magnitudes, unsigned int rows,
+           unsigned int columns, unsigned int stride) {
+  for (unsigned int i = 0; i < rows; i++) {
+    for (unsigned int j = 0; j < columns; j++) {
+      const double value = result[i * stride + j];
+      const double expected = reference[i * columns + j];
+      const double bound = kTolerance * std::max(magnitudes[i * columns + j],
+                                                 1e-30);
+      if (!(std::fabs(value - expected) <= bound)) {
+        std::cout << "FAIL " << kernel << " " << case_name << " at (" << i
+                  << ", " << j << "): " << value << " instead of " << expected
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TestSgemm() {
+  bool passed = true;
+  for (unsigned int case_idx = 0; case_idx < kCases; case_idx++) {
+    const unsigned int m = RandomSize(), n = RandomSize(), k = RandomSize();
+    const bool transpose_a = case_idx % 2, transpose_b = case_idx / 2 % 2;
+    const float alpha = RandomScale(false), beta = RandomScale(true);
+    // A is stored as m x k (k x m if transposed), B as k x n (n x k)
+    const unsigned int a_rows = transpose_a ? k : m;
+    const unsigned int a_columns = transpose_a ? m : k;
+    const unsigned int b_rows = transpose_b ? n : k;
+    const unsigned int b_columns = transpose_b ? k : n;
+    const unsigned int lda = a_columns + RandomPadding();
+    const unsigned int ldb = b_columns + RandomPadding();
+    const unsigned int ldc = n + RandomPadding();
+    const auto a = RandomValues(a_rows * lda);
+    const auto b = RandomValues(b_rows * ldb);
+    auto c = RandomValues(m * ldc);
+    std::vector<double> reference(m * n), magnitudes(m * n);
+    for (unsigned int i = 0; i < m; i++) {
+      for (unsigned int j = 0; j < n; j++) {
+        double sum = 0., magnitude = 0.;
+        for (unsigned int p = 0; p < k; p++) {
+          const double a_value =
+              transpose_a ? a[p * lda + i] : a[i * lda + p];
+          const double b_value =
+              transpose_b ? b[j * ldb + p] : b[p * ldb + j];
+          sum += a_value * b_value;
+          magnitude += std::fabs(a_value * b_value);
+        }
+        reference[i * n + j] = alpha * sum;
+        magnitudes[i * n + j] = std::fabs(alpha) * magnitude;
+        if (beta != 0.f) {
+          reference[i * n + j] += beta * double(c[i * ldc + j]);
+          magnitudes[i * n + j] += std::fabs(beta * double(c[i * ldc + j]));
+        }
+      }
+    }
+    if (beta == 0.f) {
+      // C mustn't be read
+      std::fill(c.begin(), c.end(), std::numeric_limits<float>::quiet_NaN());
+    }
+    nn::kernels::Sgemm(transpose_a, transpose_b, m, n, k, alpha, a.data(), lda,
+                       b.data(), ldb, beta, c.data(), ldc);
+    const std::string case_name =
+        std::to_string(m) + "x" + std::to_string(n) + "x" + std::to_string(k) +
+        (transpose_a ? " A^T" : "") + (transpose_b ? " B^T" : "") +
+        " alpha " + std::to_string(alpha) + " beta " + std::to_string(beta);
+    passed &= Check("Sgemm", case_name.c_str(), c.data(), reference,
+                    magnitudes, m, n, ldc);
+  }
+  return passed;
+}
+
+bool TestSgemv() {
+  bool passed = true;
+  for (unsigned int case_idx = 0; case_idx < kCases; case_idx++) {
+    const unsigned int m = RandomSize(), n = RandomSize();
+    const bool transpose_a = case_idx % 2;
+    const float alpha = RandomScale(false), beta = RandomScale(true);
+    const unsigned int lda = n + RandomPadding();
+    const unsigned int x_length = transpose_a ? m : n;
+    const unsigned int y_length = transpose_a ? n : m;
+    const auto a = RandomValues(m * lda);
+    const auto x = RandomValues(x_length);
+    auto y = RandomValues(y_length);
+    std::vector<double> reference(y_length), magnitudes(y_length);
+    for (unsigned int i = 0; i < y_length; i++) {
+      double sum = 0., magnitude = 0.;
+      for (unsigned int p = 0; p < x_length; p++) {
+        const double a_value = transpose_a ? a[p * lda + i] : a[i * lda + p];
+        sum += a_value * x[p];
+        magnitude += std::fabs(a_value * x[p]);
+      }
+      reference[i] = alpha * sum;
+      magnitudes[i] = std::fabs(alpha) * magnitude;
+      if (beta != 0.f) {
+        reference[i] += beta * double(y[i]);
+        magnitudes[i] += std::fabs(beta * double(y[i]));
+      }
+    }
+    if (beta == 0.f) {
+      std::fill(y.begin(), y.end(), std::numeric_limits<float>::quiet_NaN());
+    }
+    nn::kernels::Sgemv(transpose_a, m, n, alpha, a.data(), lda, x.data(), beta,
+                       y.data());
+    const std::string case_name =
+        std::to_string(m) + "x" + std::to_string(n) +
+        (transpose_a ? " A^T" : "") + " alpha " + std::to_string(alpha) +
+        " beta " + std::to_string(beta);
+    passed &= Check("Sgemv", case_name.c_str(), y.data(), reference,
+                    magnitudes, y_length, 1, 1);
+  }
+  return passed;
+}
+
+} // namespace
+
+int main() {
+  const nn::kernels::Isa active_isa = nn::kernels::ActiveIsa();
+  bool passed = true;
+  for (const auto isa : {nn::kernels::Isa::kGeneric, nn::kernels::Isa::kAvx2,
+                         nn::kernels::Isa::kAvx512}) {
+    if (!nn::kernels::SetIsa(isa)) {
+      std::cout << "Skipping " << nn::kernels::IsaName(isa)
+                << ", which this CPU doesn't support" << std::endl;
+      continue;
+    }
+    const bool isa_passed = TestSgemm() & TestSgemv();
+    std::cout << (isa_passed ? "PASS " : "FAIL ") << nn::kernels::IsaName(isa)
+              << std::endl;
+    passed &= isa_passed;
+  }
+  nn::kernels::SetIsa(active_isa);
+  return passed ? 0 : 1;
+}
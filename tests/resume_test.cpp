@@ -0,0 +1,139 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "dataset.hpp"
+#include "model_file.hpp"
+#include "network.hpp"
+
+// A training job interrupted after a mid-epoch checkpoint and resumed from
+// it against the same job run without interruption, for optimizers with and
+// without state buffers. The two must end with bit-identical weights and
+// biases.
+
+namespace {
+
+constexpr unsigned int kEpochs = 3;
+constexpr unsigned int kMiniBatchSize = 10;
+constexpr unsigned int kCheckpointInterval = 7;
+// The mini-batch of the first epoch the job is interrupted after, past the
+// first checkpoint, which the checkpoint writer is never busy for
+constexpr unsigned int kInterruptedMiniBatch = 10;
+
+/**
+ * @brief      Thrown to stop a training job, as if it had been preempted
+ */
+struct Interruption {};
+
+/**
+ * @brief      Generate examples of a classification problem: the class of
+ * an input is the index of its largest element among the first n_classes
+ */
+nn::AnnotatedData GenerateAnnotatedData(unsigned int n_examples,
+                                        unsigned int n_inputs,
+                                        unsigned int n_classes) {
+  std::default_random_engine generator(3);
+  std::uniform_real_distribution<nn::NNType> distribution(0.f, 1.f);
+  nn::AnnotatedData examples;
+  for (unsigned int example_idx = 0; example_idx < n_examples; example_idx++) {
+    nn::Vector<nn::NNType> input(n_inputs);
+    for (auto &value : input) {
+      value = distribution(generator);
+    }
+    const unsigned int label =
+        std::max_element(input.begin(), input.begin() + n_classes) -
+        input.begin();
+    examples.emplace_back(input, nn::IndexToOneHot(label, n_classes));
+  }
+  return examples;
+}
+
+/**
+ * @brief      Whether two model files have bit-identical parameters
+ */
+bool SameParameters(const std::string &path, const std::string &other_path) {
+  const nn::ModelFile model(path);
+  const nn::ModelFile other_model(other_path);
+  return model.n_parameters() == other_model.n_parameters() &&
+         std::equal(model.parameters(),
+                    model.parameters() + model.n_parameters(),
+                    other_model.parameters());
+}
+
+} // namespace
+
+int main() {
+  nn::SetLogSink({});
+  constexpr unsigned int n_inputs = 32, n_classes = 6;
+  const auto training_data = GenerateAnnotatedData(600, n_inputs, n_classes);
+  const nn::AnnotatedDataset training_dataset(training_data);
+  const std::vector<unsigned int> layer_sizes({n_inputs, 24, n_classes});
+  const std::string prefix = "/tmp/nn-resume-" + std::to_string(getpid());
+  const std::string initial_path = prefix + "-initial.model";
+  const std::string checkpoint_path = prefix + ".checkpoint";
+  const std::string uninterrupted_path = prefix + "-uninterrupted.model";
+  const std::string resumed_path = prefix + "-resumed.model";
+  nn::SigmoidNetwork(layer_sizes).Save(initial_path);
+
+  bool passed = true;
+  const std::vector<std::pair<nn::OptimizerType, std::string>> optimizers = {
+      {nn::OptimizerType::kSgd, "SGD"},
+      {nn::OptimizerType::kNesterov, "Nesterov momentum"},
+      {nn::OptimizerType::kAdam, "Adam"}};
+  for (const auto &[optimizer, optimizer_name] : optimizers) {
+    nn::TrainingOptions options;
+    options.n_threads = 2;
+    options.seed = 0;
+    options.optimizer.type = optimizer;
+    const float eta = optimizer == nn::OptimizerType::kAdam ? 0.01f : 1.f;
+
+    nn::SigmoidNetwork uninterrupted_network(layer_sizes);
+    uninterrupted_network.Load(initial_path);
+    uninterrupted_network.Sgd(training_dataset, kEpochs, kMiniBatchSize, eta,
+                              nullptr, options);
+    uninterrupted_network.Save(uninterrupted_path);
+
+    auto interrupted_options = options;
+    interrupted_options.checkpoint_path = checkpoint_path;
+    interrupted_options.checkpoint_interval = kCheckpointInterval;
+    interrupted_options.on_mini_batch = [](const nn::MiniBatchReport &report) {
+      if (report.mini_batch_idx == kInterruptedMiniBatch) {
+        throw Interruption();
+      }
+    };
+    nn::SigmoidNetwork interrupted_network(layer_sizes);
+    interrupted_network.Load(initial_path);
+    try {
+      interrupted_network.Sgd(training_dataset, kEpochs, kMiniBatchSize, eta,
+                              nullptr, interrupted_options);
+    } catch (const Interruption &) {
+    }
+    const auto state = nn::LoadCheckpoint(checkpoint_path);
+    const bool mid_epoch =
+        state.epoch_idx == 0 && state.mini_batch_idx == kCheckpointInterval;
+
+    // A new network, whose random weights the checkpoint replaces
+    nn::SigmoidNetwork resumed_network(layer_sizes);
+    resumed_network.ResumeSgd(checkpoint_path, training_dataset, kEpochs, eta,
+                              nullptr, options);
+    resumed_network.Save(resumed_path);
+    const bool optimizer_passed =
+        mid_epoch && SameParameters(uninterrupted_path, resumed_path);
+    std::cout << (optimizer_passed ? "PASS " : "FAIL ") << optimizer_name
+              << ": resumed from epoch " << state.epoch_idx << ", mini-batch "
+              << state.mini_batch_idx << std::endl;
+    passed &= optimizer_passed;
+    std::remove(checkpoint_path.c_str());
+    std::remove(uninterrupted_path.c_str());
+    std::remove(resumed_path.c_str());
+  }
+  std::remove(initial_path.c_str());
+  return passed ? 0 : 1;
+}
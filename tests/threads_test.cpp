@@ -0,0 +1,108 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "model_file.hpp"
+#include "network.hpp"
+
+// Training with a mini-batch split across threads against training on one
+// thread, from the same weights and with the same seed. The two must end
+// with the same weights and biases, up to the rounding of the gradients,
+// which the threads sum in a different order.
+
+namespace {
+
+// Largest difference allowed between a parameter of the two networks
+constexpr double kTolerance = 1e-5;
+
+/**
+ * @brief      Generate examples of a classification problem: the class of
+ * an input is the index of its largest element among the first n_classes
+ */
+nn::AnnotatedData GenerateAnnotatedData(unsigned int n_examples,
+                                        unsigned int n_inputs,
+                                        unsigned int n_classes) {
+  std::default_random_engine generator(2);
+  std::uniform_real_distribution<nn::NNType> distribution(0.f, 1.f);
+  nn::AnnotatedData examples;
+  for (unsigned int example_idx = 0; example_idx < n_examples; example_idx++) {
+    nn::Vector<nn::NNType> input(n_inputs);
+    for (auto &value : input) {
+      value = distribution(generator);
+    }
+    const unsigned int label =
+        std::max_element(input.begin(), input.begin() + n_classes) -
+        input.begin();
+    examples.emplace_back(input, nn::IndexToOneHot(label, n_classes));
+  }
+  return examples;
+}
+
+/**
+ * @brief      The largest difference between the parameters of two model
+ * files
+ */
+double MaxParameterDifference(const std::string &path,
+                              const std::string &other_path) {
+  const nn::ModelFile model(path);
+  const nn::ModelFile other_model(other_path);
+  assert(model.n_parameters() == other_model.n_parameters());
+  double max_difference = 0.;
+  for (std::size_t idx = 0; idx < model.n_parameters(); idx++) {
+    const double difference =
+        model.parameters()[idx] - other_model.parameters()[idx];
+    max_difference = std::max(max_difference, std::fabs(difference));
+  }
+  return max_difference;
+}
+
+} // namespace
+
+int main() {
+  nn::SetLogSink({});
+  constexpr unsigned int n_inputs = 48, n_classes = 8;
+  constexpr unsigned int epochs = 3, mini_batch_size = 20;
+  constexpr float eta = 1.f;
+  const auto training_data = GenerateAnnotatedData(1200, n_inputs, n_classes);
+  const std::vector<unsigned int> layer_sizes({n_inputs, 32, n_classes});
+  const std::string prefix = "/tmp/nn-threads-" + std::to_string(getpid());
+  const std::string initial_path = prefix + "-initial.model";
+  nn::SigmoidNetwork(layer_sizes).Save(initial_path);
+
+  // Train from the saved weights, and save the result
+  const auto train = [&](unsigned int n_threads) {
+    nn::SigmoidNetwork network(layer_sizes);
+    network.Load(initial_path);
+    nn::TrainingOptions options;
+    options.n_threads = n_threads;
+    options.seed = 0;
+    network.Sgd(training_data, epochs, mini_batch_size, eta, std::nullopt,
+                options);
+    const std::string path =
+        prefix + "-" + std::to_string(n_threads) + ".model";
+    network.Save(path);
+    return path;
+  };
+  const std::string serial_path = train(1);
+  bool passed = true;
+  for (const unsigned int n_threads : {2u, 3u, 4u, 7u}) {
+    const std::string path = train(n_threads);
+    const double max_difference = MaxParameterDifference(serial_path, path);
+    std::remove(path.c_str());
+    const bool threads_passed = max_difference <= kTolerance;
+    std::cout << (threads_passed ? "PASS " : "FAIL ") << n_threads
+              << " threads: largest parameter difference from 1 thread "
+              << max_difference << std::endl;
+    passed &= threads_passed;
+  }
+  std::remove(serial_path.c_str());
+  std::remove(initial_path.c_str());
+  return passed ? 0 : 1;
+}